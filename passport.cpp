@@ -1,31 +1,283 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <iomanip>
 #include <regex>
 #include <ctime>
 #include <limits> // For numeric_limits
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+#include <charconv>
+#include <cstring>
+#include <cmath>
+#include <sys/stat.h>
+#include <set>
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_POSIX_IO 1
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#endif
+#ifdef __linux__
+#define HAVE_INOTIFY 1
+#include <sys/inotify.h>
+#include <poll.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2_KERNELS 1
+#define HAVE_SSE42_CRC 1
+#include <immintrin.h>
+#endif
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <tuple>
+#include <utility>
+#include <cerrno>
+#include <queue>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <random>
+#include <filesystem>
 
 using namespace std;
 
 struct NewPassport {
     string passType,id,name,dob,nationality,phoneNumber,createdDate,appointmentDate,payment,paymentStatus;
     NewPassport* next;     // Pointer to the next node in the list
+    NewPassport* prev;     // Pointer to the previous node in the list
 };
 struct OldPassport {
     string passType,id,name,dob,issueDate,expiredDate,passportNumber,accountNumber,createdDate,appointmentDate,payment,paymentStatus;
     double balance;
     OldPassport* next;      // Pointer to the next node in the list
+    OldPassport* prev;      // Pointer to the previous node in the list
 };
-// Global head pointers for the singly linked lists
+// Global head and tail pointers for the doubly linked lists
 NewPassport* newHead = nullptr;
 OldPassport* oldHead = nullptr;
+NewPassport* newTail = nullptr;
+OldPassport* oldTail = nullptr;
 // File names for each passport type
 const string regularFileName = "regular4.csv";
 const string urgentFileName = "urgent4.csv";
 const string expiredRegularFileName = "expired_regular4.csv";
 const string expiredUrgentFileName = "expired_urgent4.csv";
+// Compact storage mode (--compact) keeps each list in one block-compressed file
+const string compactNewFileName = "new_passports4.pms";
+const string compactOldFileName = "old_passports4.pms";
+bool compactStorageMode = false;
+// Slot storage mode (--slots) keeps each list in a memory-mapped fixed-slot file
+const string slotNewFileName = "new_passports4.slots";
+const string slotOldFileName = "old_passports4.slots";
+bool slotStorageMode = false;
+const string bloomFileName = "passport_filters4.bloom";
+const string checksumFileName = "checksums4.crc";
+const string sortOrderFileName = "sort_order4.cfg";
+// Passport fees, charged when a passport is created or renewed
+const int regularPassportFee = 5000;
+const int urgentPassportFee = 25000;
+
+// Lazy loading mode (--lazy): startup only builds an index of record locations,
+// full records are parsed from disk on demand and kept in a bounded LRU cache
+struct RecordLocation {
+    string id, name, passType; // Key fields kept resident for search
+    int fileIndex;             // Index into the file list of the record's kind
+    streamoff offset;          // Byte offset of the record line in that file
+};
+template <typename T>
+class RecordCache {
+public:
+    explicit RecordCache(size_t capacity) : capacity(capacity) {}
+    T* get(const string& id) {
+        auto it = lookup.find(id);
+        if (it == lookup.end()) return nullptr;
+        entries.splice(entries.begin(), entries, it->second); // Mark as most recently used
+        return &it->second->second;
+    }
+    T* put(const string& id, const T& record) {
+        if (capacity == 0) return nullptr;
+        auto it = lookup.find(id);
+        if (it != lookup.end()) entries.erase(it->second);
+        entries.emplace_front(id, record);
+        lookup[id] = entries.begin();
+        if (entries.size() > capacity) { // Evict the least recently used record
+            lookup.erase(entries.back().first);
+            entries.pop_back();
+        }
+        return &entries.front().second;
+    }
+    void setCapacity(size_t newCapacity) { capacity = newCapacity; clear(); }
+    void clear() { entries.clear(); lookup.clear(); }
+private:
+    size_t capacity;
+    list<pair<string, T>> entries;
+    unordered_map<string, typename list<pair<string, T>>::iterator> lookup;
+};
+bool lazyLoadMode = false;
+bool newListMaterialized = true, oldListMaterialized = true;
+vector<RecordLocation> newLocations, oldLocations;
+unordered_map<string, size_t> newLocationById, oldLocationById;
+RecordCache<NewPassport> newRecordCache(1024);
+RecordCache<OldPassport> oldRecordCache(1024);
+// --- Record Pool ---
+// List nodes are allocated from a slot map instead of one `new` each. Slots
+// live in chunks of POOL_CHUNK_RECORDS that never move, so node pointers stay
+// valid, and records allocated together sit next to each other in memory. A
+// released slot goes on a free list and is reused by the next allocation.
+// Each slot has a generation that is bumped when it is released, so a
+// RecordHandle kept by an index notices that its record is gone even after
+// the slot was reused. Freeing a list drops whole chunks at once.
+const uint32_t POOL_CHUNK_RECORDS = 1024;
+struct RecordHandle {
+    uint32_t slot = UINT32_MAX;
+    uint32_t generation = 0;
+};
+template <typename T>
+class RecordPool {
+public:
+    // Returns a value-initialized record
+    T* allocate() {
+        uint32_t slot;
+        if (freeHead != NO_SLOT) {
+            slot = freeHead;
+            freeHead = entryAt(slot).nextFree;
+        } else {
+            if (highWater == chunks.size() * POOL_CHUNK_RECORDS) {
+                chunks.emplace_back(new Entry[POOL_CHUNK_RECORDS]);
+            }
+            slot = highWater++;
+            entryAt(slot).slot = slot;
+            entryAt(slot).generation = firstGeneration;
+        }
+        Entry& entry = entryAt(slot);
+        static_cast<T&>(entry) = T();
+        entry.live = true;
+        ++liveCount;
+        return &entry;
+    }
+    void release(T* record) {
+        Entry& entry = static_cast<Entry&>(*record);
+        static_cast<T&>(entry) = T(); // Frees the field strings now
+        entry.live = false;
+        ++entry.generation;
+        entry.nextFree = freeHead;
+        freeHead = entry.slot;
+        --liveCount;
+    }
+    RecordHandle handle(const T* record) const {
+        const Entry& entry = static_cast<const Entry&>(*record);
+        return {entry.slot, entry.generation};
+    }
+    // The record a handle was taken from, or nullptr once it was released
+    T* get(RecordHandle handle) {
+        if (handle.slot >= highWater) return nullptr;
+        Entry& entry = entryAt(handle.slot);
+        return entry.live && entry.generation == handle.generation ? &entry : nullptr;
+    }
+    // Visits the live records in memory order, not list order
+    template <typename F>
+    void forEach(F visit) {
+        for (uint32_t slot = 0; slot < highWater; ++slot) {
+            Entry& entry = entryAt(slot);
+            if (entry.live) visit(static_cast<T*>(&entry));
+        }
+    }
+    size_t size() const { return liveCount; }
+    // Releases every record. Slots handed out later start at a generation
+    // none of the old handles carry.
+    void clear() {
+        for (uint32_t slot = 0; slot < highWater; ++slot) {
+            firstGeneration = max(firstGeneration, entryAt(slot).generation + 1);
+        }
+        chunks.clear();
+        highWater = 0;
+        freeHead = NO_SLOT;
+        liveCount = 0;
+    }
+private:
+    static const uint32_t NO_SLOT = UINT32_MAX;
+    struct Entry : T {
+        uint32_t slot = 0, generation = 0, nextFree = NO_SLOT;
+        bool live = false;
+    };
+    vector<unique_ptr<Entry[]>> chunks;
+    uint32_t highWater = 0, freeHead = NO_SLOT, firstGeneration = 0;
+    size_t liveCount = 0;
+
+    Entry& entryAt(uint32_t slot) { return chunks[slot / POOL_CHUNK_RECORDS][slot % POOL_CHUNK_RECORDS]; }
+};
+RecordPool<NewPassport> newPool;
+RecordPool<OldPassport> oldPool;
+// Let list code written once for both record types find its list and pool
+NewPassport*& listHead(const NewPassport*) { return newHead; }
+OldPassport*& listHead(const OldPassport*) { return oldHead; }
+NewPassport*& listTail(const NewPassport*) { return newTail; }
+OldPassport*& listTail(const OldPassport*) { return oldTail; }
+RecordPool<NewPassport>& recordPool(const NewPassport*) { return newPool; }
+RecordPool<OldPassport>& recordPool(const OldPassport*) { return oldPool; }
+// Links a record after `prev`, or at the front when prev is null
+template <typename T>
+void linkRecordAfter(T* prev, T* record) {
+    record->prev = prev;
+    record->next = prev == nullptr ? listHead(record) : prev->next;
+    (record->next == nullptr ? listTail(record) : record->next->prev) = record;
+    (prev == nullptr ? listHead(record) : prev->next) = record;
+}
+template <typename T>
+void appendRecord(T* record) { linkRecordAfter(listTail(record), record); }
+template <typename T>
+void unlinkRecord(T* record) {
+    (record->prev == nullptr ? listHead(record) : record->prev->next) = record->next;
+    (record->next == nullptr ? listTail(record) : record->next->prev) = record->prev;
+    record->next = record->prev = nullptr;
+}
+// Unlinks a record and gives its slot back; the change hooks must have run
+template <typename T>
+void eraseRecord(T* record) {
+    unlinkRecord(record);
+    recordPool(record).release(record);
+}
+// Finds live records by ID. Entries hold handles, so an entry left behind by
+// a removed record can never return the record that reused its slot.
+template <typename T>
+class RecordIdIndex {
+public:
+    explicit RecordIdIndex(RecordPool<T>& pool) : pool(pool) {}
+    void add(T* record) { byId.emplace(record->id, pool.handle(record)); } // Keeps the first record of an ID
+    void remove(const string& id, const T* record) {
+        auto it = byId.find(id);
+        if (it != byId.end() && pool.get(it->second) == record) byId.erase(it);
+    }
+    T* find(const string& id) {
+        auto it = byId.find(id);
+        if (it == byId.end()) return nullptr;
+        T* record = pool.get(it->second);
+        return record != nullptr && record->id == id ? record : nullptr;
+    }
+    void clear() { byId.clear(); }
+private:
+    RecordPool<T>& pool;
+    unordered_map<string, RecordHandle> byId;
+};
+RecordIdIndex<NewPassport> newIdIndex(newPool);
+RecordIdIndex<OldPassport> oldIdIndex(oldPool);
+RecordIdIndex<NewPassport>& recordIdIndex(const NewPassport*) { return newIdIndex; }
+RecordIdIndex<OldPassport>& recordIdIndex(const OldPassport*) { return oldIdIndex; }
 // Forward declarations for all functions
 void createNewPassport(), createOldPassports();
 void updateNewPassport(), updateOldPassport();
@@ -35,6 +287,22 @@ void sortNewPassports(), sortOldPassports();
 void displayNewPassports(), displayOldPassports();
 void saveNewPassportsToFile(),saveOldPassportsToFile();
 void loadNewPassportsFromFile(), loadOldPassportsFromFile();
+string formatNewPassportLine(const NewPassport* temp), formatOldPassportLine(const OldPassport* temp);
+class RecordWriter;
+void logNewPassportChange(char op, const string& key, const NewPassport* record);
+void logOldPassportChange(char op, const string& key, const OldPassport* record);
+void buildNewPassportIndex(), buildOldPassportIndex();
+void saveNewPassportsCompact(), saveOldPassportsCompact();
+bool loadNewPassportsCompact(), loadOldPassportsCompact();
+bool fetchNewPassport(const RecordLocation& loc, NewPassport& out);
+bool fetchOldPassport(const RecordLocation& loc, OldPassport& out);
+void findDuplicateApplicants();
+void queryPassports(bool oldList);
+void bulkChangePassports();
+bool reconcilePayments(const string& statementFileName);
+void reconcilePaymentsMenu();
+void externalSortPassports(bool oldList, int sortOption), externalSortMenu();
+bool confirmNotDuplicate(const string& name, const string& dob);
 void freeNewPassportList(); // Function to deallocate new passport list memory
 void freeOldPassportList(); // Function to deallocate old passport list memory
 
@@ -47,10 +315,27 @@ bool isNumbersOnly(const string& str);
 bool isUniqueNewID(const string& id, const string& excludeID = "");
 bool isUniqueOldID(const string& id, const string& excludeID = "");
 bool isUniquePassportNumber(const string& passportNumber, const string& excludeID = "");
+bool ownsShardKey(const string& id), passportNumberOnOtherShards(const string& passportNumber);
 string getCurrentDate();
 string getDateOneMonthLater(const string& date);
 string getDateTwoDaysLater(const string& date);
 string getFileNameForPassType(const string& passType);
+bool readWholeFile(const string& fileName, string& contents);
+string normalizeName(const string& name), soundexCode(const string& word);
+bool dateToDays(const string& date, int64_t& days), exactDateToDays(const string& date, int64_t& days);
+bool idMightExist(const string& id), passportNumberMightExist(const string& passportNumber);
+bool archiveHasId(const string& id), archiveHasPassportNumber(const string& passportNumber);
+void archiveNow();
+void bloomAdd(const string& id, const string& passportNumber = "");
+void rebuildBloomFilters(), refreshBloomFilters();
+bool loadBloomFilters();
+void ensurePassportsLoaded(); // Materializes lazily indexed lists before any mutation
+void displayReport();
+void rebuildNewPassportIndexes(), rebuildOldPassportIndexes();
+void loadSortOrder();
+void lockInstance(), unlockInstance(), syncWithChangeFeed();
+void mergeOutsideChanges(), mergeOutsideChangesBeforeSave(const string& fileName);
+void reloadArchiveIndexes();
 
 bool isValidDate(const string& date) {
     regex datePattern("\\d{4}-\\d{2}-\\d{2}");
@@ -96,84 +381,485 @@ bool isNumbersOnly(const string& str) {
     regex pattern("^[0-9]+$");
     return regex_match(str, pattern);
 }
+// Until a lazily indexed list is loaded its IDs are only in the location
+// index, so a create can check its ID before the lists are materialized
 bool isUniqueNewID(const string& id, const string& excludeID) {
+    if (!ownsShardKey(id)) return false; // Only the owning shard may store it
+    if (!idMightExist(id)) return true; // Definitely not stored anywhere
     // Check new passports list
-    NewPassport* tempNew = newHead;
-    while (tempNew != nullptr) {
-        if (tempNew->id == id && tempNew->id != excludeID) return false;
-        tempNew = tempNew->next;
-    }
-    // Check old passports list
-    OldPassport* tempOld = oldHead;
-    while (tempOld != nullptr) {
-        if (tempOld->id == id) return false; // An ID from old list cannot be used for new
-        tempOld = tempOld->next;
-    }
-    return true;
+    if (id != excludeID && (newIdIndex.find(id) != nullptr || newLocationById.count(id) != 0)) return false;
+    // Check old passports list; an ID from the old list cannot be used for new
+    if (oldIdIndex.find(id) != nullptr || oldLocationById.count(id) != 0) return false;
+    return !archiveHasId(id);
 }
 
 bool isUniqueOldID(const string& id, const string& excludeID) {
+    if (!ownsShardKey(id)) return false;
+    if (!idMightExist(id)) return true; // Definitely not stored anywhere
     // Check old passports list
-    OldPassport* tempOld = oldHead;
-    while (tempOld != nullptr) {
-        if (tempOld->id == id && tempOld->id != excludeID) return false;
-        tempOld = tempOld->next;
-    }
-    // Check new passports list
-    NewPassport* tempNew = newHead;
-    while (tempNew != nullptr) {
-        if (tempNew->id == id) return false; // An ID from new list cannot be used for old
-        tempNew = tempNew->next;
-    }
-    return true;
+    if (id != excludeID && (oldIdIndex.find(id) != nullptr || oldLocationById.count(id) != 0)) return false;
+    // Check new passports list; an ID from the new list cannot be used for old
+    if (newIdIndex.find(id) != nullptr || newLocationById.count(id) != 0) return false;
+    return !archiveHasId(id);
 }
 
-bool isUniquePassportNumber(const string& passportNumber, const string& excludeID) {
+bool passportNumberFreeInShard(const string& passportNumber, const string& excludeID) {
+    if (!passportNumberMightExist(passportNumber)) return true;
     OldPassport* temp = oldHead;
     while (temp != nullptr) {
         if (temp->passportNumber == passportNumber && temp->id != excludeID) return false;
         temp = temp->next;
     }
-    return true;
+    return !archiveHasPassportNumber(passportNumber);
+}
+bool isUniquePassportNumber(const string& passportNumber, const string& excludeID) {
+    return passportNumberFreeInShard(passportNumber, excludeID) && !passportNumberOnOtherShards(passportNumber);
+}
+
+// --- Record Serialization ---
+// Saves and printers format records straight into a reusable byte buffer:
+// text is copied, numbers go through to_chars and dates and money through
+// the fixed-width writers below. Once a buffer has grown to its working size
+// nothing is allocated, and no stream locale or formatting flags are involved.
+void writeDigits(char* at, int value, int width) { // Zero-padded to `width`
+    for (int i = width - 1; i >= 0; --i, value /= 10) at[i] = static_cast<char>('0' + value % 10);
+}
+// Writes cents as units with two decimals ("-12.05"); needs 24 bytes
+char* writeCents(char* at, long long cents) {
+    unsigned long long magnitude = cents < 0 ? 0ull - static_cast<unsigned long long>(cents) : cents;
+    if (cents < 0) *at++ = '-';
+    at = to_chars(at, at + 20, magnitude / 100).ptr;
+    *at++ = '.';
+    writeDigits(at, static_cast<int>(magnitude % 100), 2);
+    return at + 2;
+}
+class RecordWriter {
+public:
+    RecordWriter& clear() {
+        length = 0;
+        return *this;
+    }
+    const char* data() const { return bytes.data(); }
+    size_t size() const { return length; }
+    RecordWriter& put(char c) {
+        *reserve(1) = c;
+        ++length;
+        return *this;
+    }
+    RecordWriter& put(const char* text, size_t count) {
+        memcpy(reserve(count), text, count);
+        length += count;
+        return *this;
+    }
+    RecordWriter& put(const string& text) { return put(text.data(), text.size()); }
+    template <size_t N>
+    RecordWriter& put(const char (&literal)[N]) { return put(literal, N - 1); }
+    RecordWriter& number(long long value) {
+        char* at = reserve(20);
+        length = static_cast<size_t>(to_chars(at, at + 20, value).ptr - bytes.data());
+        return *this;
+    }
+    // Two decimals, rounded to the cent like the report totals
+    RecordWriter& money(double amount) {
+        char* at = reserve(24);
+        length = static_cast<size_t>(writeCents(at, llround(amount * 100)) - bytes.data());
+        return *this;
+    }
+    RecordWriter& date(int year, int month, int day) {
+        char* at = reserve(10);
+        writeDigits(at, year, 4);
+        at[4] = '-';
+        writeDigits(at + 5, month, 2);
+        at[7] = '-';
+        writeDigits(at + 8, day, 2);
+        length += 10;
+        return *this;
+    }
+private:
+    vector<char> bytes;
+    size_t length = 0;
+
+    char* reserve(size_t count) {
+        if (length + count > bytes.size()) bytes.resize(max(bytes.size() * 2, length + count + 256));
+        return &bytes[length];
+    }
+};
+// Dates fit the short-string buffer, so returning one does not allocate
+string formatDate(int year, int month, int day) {
+    char text[10];
+    writeDigits(text, year, 4);
+    text[4] = '-';
+    writeDigits(text + 5, month, 2);
+    text[7] = '-';
+    writeDigits(text + 8, day, 2);
+    return string(text, sizeof(text));
+}
+// Reads YYYY-MM-DD without a stream; false if the fields are not numbers
+bool parseDateFields(const string& date, int& year, int& month, int& day) {
+    const char* end = date.data() + date.size();
+    from_chars_result field = from_chars(date.data(), end, year);
+    if (field.ec != errc() || field.ptr == end || *field.ptr != '-') return false;
+    field = from_chars(field.ptr + 1, end, month);
+    if (field.ec != errc() || field.ptr == end || *field.ptr != '-') return false;
+    field = from_chars(field.ptr + 1, end, day);
+    return field.ec == errc();
+}
+
+// --- Record Schema ---
+// The fields of each record type are listed once below, in CSV column order.
+// The CSV parser and writer, the printers and the record comparison are
+// generated from these lists by folding over the member pointers at compile
+// time, so each field access is a fixed offset with no per-field dispatch,
+// and a new field only has to be added to its schema.
+template <auto Member>
+struct SchemaField {
+    static constexpr auto member = Member;
+    const char* column; // CSV header name
+    const char* label;  // Prefix in the one-line display
+    const char* title;  // Prefix in the block display
+};
+constexpr auto newPassportSchema = make_tuple(
+    SchemaField<&NewPassport::passType>{"PassType", "Type: ", "Passport Type: "},
+    SchemaField<&NewPassport::id>{"ID", "ID: ", "ID: "},
+    SchemaField<&NewPassport::name>{"Name", "Name: ", "Name: "},
+    SchemaField<&NewPassport::dob>{"DOB", "DOB: ", "DOB: "},
+    SchemaField<&NewPassport::nationality>{"Nationality", "Nationality: ", "Nationality: "},
+    SchemaField<&NewPassport::phoneNumber>{"Phone", "Phone: ", "Phone Number: "},
+    SchemaField<&NewPassport::createdDate>{"CreatedDate", "Created: ", "Created Date: "},
+    SchemaField<&NewPassport::appointmentDate>{"AppointmentDate", "Appointment: ", "Appointment Date: "},
+    SchemaField<&NewPassport::payment>{"Payment", "Payment: $", "Payment: "},
+    SchemaField<&NewPassport::paymentStatus>{"PaymentStatus", "Status: ", "Payment Status: "});
+constexpr auto oldPassportSchema = make_tuple(
+    SchemaField<&OldPassport::passType>{"PassType", "Type: ", "Passport Type: "},
+    SchemaField<&OldPassport::id>{"ID", "ID: ", "ID: "},
+    SchemaField<&OldPassport::name>{"Name", "Name: ", "Name: "},
+    SchemaField<&OldPassport::dob>{"DOB", "DOB: ", "DOB: "},
+    SchemaField<&OldPassport::issueDate>{"IssueDate", "Issue Date: ", "Issue Date: "},
+    SchemaField<&OldPassport::expiredDate>{"ExpiredDate", "Expiry Date: ", "Expiry Date: "},
+    SchemaField<&OldPassport::passportNumber>{"PassportNumber", "Passport Number: ", "Passport Number: "},
+    SchemaField<&OldPassport::accountNumber>{"AccountNumber", "Account Number: ", "Account Number: "},
+    SchemaField<&OldPassport::balance>{"Balance", "Balance: $", "Balance: $"},
+    SchemaField<&OldPassport::createdDate>{"CreatedDate", "Created: ", "Created Date: "},
+    SchemaField<&OldPassport::appointmentDate>{"AppointmentDate", "Appointment: ", "Appointment Date: "},
+    SchemaField<&OldPassport::payment>{"Payment", "Payment: $", "Payment: "},
+    SchemaField<&OldPassport::paymentStatus>{"PaymentStatus", "Status: ", "Payment Status: "});
+constexpr const auto& recordSchema(const NewPassport*) { return newPassportSchema; }
+constexpr const auto& recordSchema(const OldPassport*) { return oldPassportSchema; }
+template <typename T>
+constexpr size_t schemaSize = tuple_size<remove_reference_t<decltype(recordSchema(static_cast<const T*>(nullptr)))>>::value;
+
+// Calls visit(field, index) for every field, index being a compile-time constant
+template <typename Schema, typename F, size_t... I>
+void forEachSchemaField(const Schema& schema, F&& visit, index_sequence<I...>) {
+    (visit(get<I>(schema), integral_constant<size_t, I>()), ...);
+}
+template <typename T, typename F>
+void forEachField(F&& visit) {
+    forEachSchemaField(recordSchema(static_cast<const T*>(nullptr)), visit, make_index_sequence<schemaSize<T>>());
+}
+inline RecordWriter& putFieldValue(RecordWriter& out, const string& value) { return out.put(value); }
+inline RecordWriter& putFieldValue(RecordWriter& out, double value) { return out.money(value); }
+
+template <typename T>
+RecordWriter& appendCsvHeader(RecordWriter& out) {
+    forEachField<T>([&](const auto& field, auto index) {
+        if constexpr (index > 0) out.put(',');
+        out.put(field.column, strlen(field.column));
+    });
+    return out;
+}
+template <typename T>
+RecordWriter& appendCsvLine(RecordWriter& out, const T* record) {
+    forEachField<T>([&](const auto& field, auto index) {
+        if constexpr (index > 0) out.put(',');
+        putFieldValue(out, record->*field.member);
+    });
+    return out;
+}
+// "Type: Regular, ID: ..." on one line
+template <typename T>
+RecordWriter& appendRecordSummary(RecordWriter& out, const T* record) {
+    forEachField<T>([&](const auto& field, auto index) {
+        if constexpr (index > 0) out.put(", ");
+        putFieldValue(out.put(field.label, strlen(field.label)), record->*field.member);
+    });
+    return out.put('\n');
+}
+// One "Title: value" line per field
+template <typename T>
+RecordWriter& appendRecordBlock(RecordWriter& out, const T* record) {
+    forEachField<T>([&](const auto& field, auto) {
+        putFieldValue(out.put(field.title, strlen(field.title)), record->*field.member).put('\n');
+    });
+    return out;
+}
+// Like std::stod without the exceptions, except that the whole field must be
+// a finite number: "12abc", "nan" and "inf" are rejected
+bool parseFieldNumber(const string& text, double& value) {
+    char* end;
+    errno = 0;
+    value = strtod(text.c_str(), &end);
+    return end != text.c_str() && end == text.c_str() + text.size() && errno != ERANGE && isfinite(value);
+}
+// Splits a CSV line into the fields like consecutive getline calls would:
+// a missing trailing field keeps its value, and an unreadable number fails
+// the line.
+template <typename T>
+bool parseCsvLine(const string& line, T* record) {
+    if (line.empty()) return false;
+    size_t pos = 0;
+    bool exhausted = false, ok = true;
+    string number;
+    forEachField<T>([&](const auto& field, auto index) {
+        if (!ok) return;
+        auto& value = record->*field.member;
+        size_t end = line.size();
+        if constexpr (index + 1 < schemaSize<T>) end = min(line.find(',', pos), line.size());
+        if constexpr (is_same<remove_reference_t<decltype(value)>, double>::value) {
+            if (exhausted) number.clear();
+            else number.assign(line, pos, end - pos);
+            ok = parseFieldNumber(number, value);
+        } else if (!exhausted) {
+            value.assign(line, pos, end - pos);
+        }
+        if (end == line.size()) exhausted = true;
+        else pos = end + 1;
+    });
+    record->next = nullptr;
+    return ok;
+}
+thread_local RecordWriter printBuffer; // Reused by the record printers
+template <typename T>
+void printRecordSummary(const T* record) {
+    RecordWriter& out = appendRecordSummary(printBuffer.clear(), record);
+    cout.write(out.data(), static_cast<streamsize>(out.size()));
+}
+template <typename T>
+void printRecordBlock(const T* record) {
+    RecordWriter& out = appendRecordBlock(printBuffer.clear().put("--------------------------------\n"), record);
+    cout.write(out.data(), static_cast<streamsize>(out.size()));
+}
+// Field-by-field equality; the list links are not compared
+template <typename T>
+bool sameFields(const T& a, const T& b) {
+    bool same = true;
+    forEachField<T>([&](const auto& field, auto) { same = same && a.*field.member == b.*field.member; });
+    return same;
+}
+
+// --- Checksums ---
+// Data files are protected by CRC32C (Castagnoli) checksums: one per
+// CHECKSUM_BLOCK_SIZE bytes of each CSV file, kept in checksumFileName,
+// one per block in the compact files and one per record slot. Loading
+// verifies them, so a save cut short by a crash is reported instead of
+// silently loading a partial store. CPUs with SSE4.2 compute the CRC with
+// the crc32 instruction; elsewhere a slicing-by-8 table is used.
+const size_t CHECKSUM_BLOCK_SIZE = 1 << 20;
+bool damagedDataFiles = false; // Set when a loaded file fails its checksum
+
+struct Crc32cTable {
+    uint32_t entries[8][256]; // entries[k][b]: CRC of byte b followed by k zero bytes
+    Crc32cTable() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit) crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+            entries[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (int k = 1; k < 8; ++k) entries[k][i] = (entries[k - 1][i] >> 8) ^ entries[0][entries[k - 1][i] & 0xFF];
+        }
+    }
+};
+uint32_t crc32cSoftware(uint32_t crc, const unsigned char* p, size_t size) {
+    static const Crc32cTable tables;
+    const uint32_t (&table)[8][256] = tables.entries;
+    for (; size >= 8; size -= 8, p += 8) {
+        uint32_t low, high;
+        memcpy(&low, p, 4);
+        memcpy(&high, p + 4, 4);
+        low ^= crc;
+        crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^ table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24] ^
+              table[3][high & 0xFF] ^ table[2][(high >> 8) & 0xFF] ^ table[1][(high >> 16) & 0xFF] ^ table[0][high >> 24];
+    }
+    for (; size > 0; --size, ++p) crc = (crc >> 8) ^ table[0][(crc ^ *p) & 0xFF];
+    return crc;
+}
+#ifdef HAVE_SSE42_CRC
+__attribute__((target("sse4.2"))) uint32_t crc32cHardware(uint32_t crc, const unsigned char* p, size_t size) {
+#ifdef __x86_64__
+    uint64_t wide = crc;
+    for (; size >= 8; size -= 8, p += 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        wide = _mm_crc32_u64(wide, word);
+    }
+    crc = static_cast<uint32_t>(wide);
+#endif
+    for (; size >= 4; size -= 4, p += 4) {
+        uint32_t word;
+        memcpy(&word, p, 4);
+        crc = _mm_crc32_u32(crc, word);
+    }
+    for (; size > 0; --size, ++p) crc = _mm_crc32_u8(crc, *p);
+    return crc;
+}
+bool cpuHasSse42() {
+    static const bool hasSse42 = __builtin_cpu_supports("sse4.2");
+    return hasSse42;
+}
+#endif
+// Extends `crc` (a previous result, 0 to start) over `size` bytes
+uint32_t crc32c(const void* data, size_t size, uint32_t crc = 0) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+#ifdef HAVE_SSE42_CRC
+    if (cpuHasSse42()) return ~crc32cHardware(~crc, p, size);
+#endif
+    return ~crc32cSoftware(~crc, p, size);
+}
+// The checksum file has one line per CSV file: name, size, then one CRC in
+// hex per block
+map<string, vector<string>> readChecksumFile() {
+    map<string, vector<string>> entries;
+    ifstream in(checksumFileName);
+    string line;
+    while (getline(in, line)) {
+        stringstream ss(line);
+        string fileName, field;
+        ss >> fileName;
+        while (ss >> field) entries[fileName].push_back(field);
+    }
+    return entries;
+}
+// The fields of a checksum entry: the size, then the CRC of each block
+vector<string> blockChecksums(string_view data) {
+    vector<string> fields(1, to_string(data.size()));
+    for (size_t offset = 0; offset < data.size(); offset += CHECKSUM_BLOCK_SIZE) {
+        char hex[9];
+        snprintf(hex, sizeof(hex), "%08x", crc32c(data.data() + offset, min(CHECKSUM_BLOCK_SIZE, data.size() - offset)));
+        fields.push_back(hex);
+    }
+    return fields;
+}
+// Each data file's part of the Bloom filter signature, kept from the block
+// checksums taken when the file was last written or read, so a save does not
+// read and hash the files it did not touch (see dataFilesSignature)
+map<string, string> dataFileSignatures;
+void noteFileChecksums(const string& fileName, const vector<string>& fields) {
+    string joined;
+    for (const string& field : fields) joined += field + ' ';
+    char hex[9];
+    snprintf(hex, sizeof(hex), "%08x", crc32c(joined.data(), joined.size()));
+    dataFileSignatures[fileName] = fields[0] + ':' + hex;
+}
+// Records the checksums of files just written from memory, given as
+// (name, contents) pairs, with one update of the checksum file
+void recordChecksums(const vector<pair<string, string_view>>& files) {
+    map<string, vector<string>> entries = readChecksumFile();
+    for (const auto& file : files) {
+        entries[file.first] = blockChecksums(file.second);
+        noteFileChecksums(file.first, entries[file.first]);
+    }
+    ofstream out(checksumFileName + ".tmp", ios::trunc);
+    for (const auto& entry : entries) {
+        out << entry.first;
+        for (const string& field : entry.second) out << " " << field;
+        out << "\n";
+    }
+    out.close();
+    if (!out || rename((checksumFileName + ".tmp").c_str(), checksumFileName.c_str()) != 0) {
+        cout << "Error writing file " << checksumFileName << "!\n";
+    }
+}
+enum ChecksumState { CHECKSUM_MATCH, CHECKSUM_APPENDED, CHECKSUM_MISMATCH };
+// Compares file contents with a checksum entry: the file exactly as saved,
+// the saved bytes intact with more appended after them, or anything else.
+// On a mismatch badBlock is the first block that differs, or 0 when the file
+// is shorter than it was saved.
+ChecksumState compareWithChecksums(string_view contents, const vector<string>& fields, size_t* badBlock = nullptr) {
+    size_t recordedSize = fields.empty() ? 0 : static_cast<size_t>(strtoull(fields[0].c_str(), nullptr, 10));
+    if (badBlock != nullptr) *badBlock = 0;
+    if (fields.empty() || contents.size() < recordedSize) return CHECKSUM_MISMATCH;
+    for (size_t index = 1, offset = 0; offset < recordedSize; ++index, offset += CHECKSUM_BLOCK_SIZE) {
+        uint32_t crc = crc32c(contents.data() + offset, min(CHECKSUM_BLOCK_SIZE, recordedSize - offset));
+        if (index >= fields.size() || strtoul(fields[index].c_str(), nullptr, 16) != crc) {
+            if (badBlock != nullptr) *badBlock = index;
+            return CHECKSUM_MISMATCH;
+        }
+    }
+    return contents.size() == recordedSize ? CHECKSUM_MATCH : CHECKSUM_APPENDED;
+}
+// Checks a CSV file, given as its contents, against its recorded checksums.
+// Files without an entry (never saved by this version) pass, and so does a
+// file another tool appended to since the last save: the saved bytes are
+// intact. The lazy index takes such a file as it is; the loaders pass
+// savedSize and read only the saved bytes, and the rows after them are merged
+// like any other outside change once the lists are loaded.
+bool verifyChecksums(const string& fileName, string_view contents, size_t* savedSize = nullptr) {
+    if (savedSize != nullptr) *savedSize = contents.size();
+    map<string, vector<string>> entries = readChecksumFile();
+    auto entry = entries.find(fileName);
+    if (entry == entries.end() || entry->second.empty()) return true;
+    size_t badBlock;
+    ChecksumState state = compareWithChecksums(contents, entry->second, &badBlock);
+    if (state == CHECKSUM_APPENDED) {
+        size_t recordedSize = static_cast<size_t>(strtoull(entry->second[0].c_str(), nullptr, 10));
+        cout << "Warning: " << fileName << " has " << contents.size() - recordedSize << " bytes added after its last save; "
+             << (savedSize != nullptr ? "they are checked before they are merged.\n" : "they are loaded as they are.\n");
+        if (savedSize != nullptr) *savedSize = recordedSize;
+    } else if (state == CHECKSUM_MISMATCH && badBlock == 0) {
+        cout << "Error: " << fileName << " is " << contents.size() << " bytes but was saved with " << entry->second[0]
+             << "; it was cut short or changed outside the program.\n";
+    } else if (state == CHECKSUM_MISMATCH) {
+        cout << "Error: " << fileName << " is damaged: block " << badBlock << " (from byte "
+             << (badBlock - 1) * CHECKSUM_BLOCK_SIZE << ") does not match its checksum.\n";
+    }
+    return state != CHECKSUM_MISMATCH;
+}
+// Saves write each CSV file to name.tmp, commit by replacing the checksum
+// file and then rename the tmp file into place, so a data file and its entry
+// change together. A tmp file left by a crash after the commit matches the
+// entry and the rename is finished here; one from before the commit is
+// discarded with its save. Called before loading, with the instance lock held.
+void finishInterruptedSave(const string& fileName) {
+    string tmpName = fileName + ".tmp", pending;
+    if (!readWholeFile(tmpName, pending)) return;
+    map<string, vector<string>> entries = readChecksumFile();
+    auto entry = entries.find(fileName);
+    if (entry != entries.end() && compareWithChecksums(pending, entry->second) == CHECKSUM_MATCH) {
+        rename(tmpName.c_str(), fileName.c_str());
+    } else {
+        remove(tmpName.c_str());
+    }
+}
+void exitIfDataDamaged() {
+    if (!damagedDataFiles) return;
+    cout << "Restore the damaged file(s) from a backup. A CSV file can also be loaded as it is after deleting "
+         << checksumFileName << ".\n";
+    exit(1);
 }
 
 // --- Date Helper Functions ---
 string getCurrentDate() {
     time_t now = time(nullptr);
     tm* current = localtime(&now);
-    stringstream ss;
-    ss << setfill('0') << setw(4) << current->tm_year + 1900 << "-"
-       << setw(2) << current->tm_mon + 1 << "-"
-       << setw(2) << current->tm_mday;
-    return ss.str();
+    return formatDate(current->tm_year + 1900, current->tm_mon + 1, current->tm_mday);
 }
 
 string getDateOneMonthLater(const string& date) {
     int year, month, day;
-    istringstream iss(date);
-    char dash1, dash2;
-    iss >> year >> dash1 >> month >> dash2 >> day;
-    if (iss.fail() || dash1 != '-' || dash2 != '-') return "";
+    if (!parseDateFields(date, year, month, day)) return "";
 
     month += 1;
     if (month > 12) {
         month = 1;
         year++;
     }
-
-    stringstream ss;
-    ss << setfill('0') << setw(4) << year << "-"
-       << setw(2) << month << "-"
-       << setw(2) << day;
-    return ss.str();
+    return formatDate(year, month, day);
 }
 
 string getDateTwoDaysLater(const string& date) {
     int year, month, day;
-    istringstream iss(date);
-    char dash1, dash2;
-    iss >> year >> dash1 >> month >> dash2 >> day;
-    if (iss.fail() || dash1 != '-' || dash2 != '-') return "";
+    if (!parseDateFields(date, year, month, day)) return "";
 
     // Convert to tm struct for easier date manipulation
    tm t = {};
@@ -189,1110 +875,6762 @@ string getDateTwoDaysLater(const string& date) {
     time_t time_stamp = mktime(&t);
     time_stamp += (2 * 24 * 60 * 60); // Add 2 days in seconds
     tm* new_time = localtime(&time_stamp);
-
-    stringstream ss;
-    ss << setfill('0') << setw(4) << new_time->tm_year + 1900 << "-"
-       << setw(2) << new_time->tm_mon + 1 << "-"
-       << setw(2) << new_time->tm_mday;
-    return ss.str();
+    return formatDate(new_time->tm_year + 1900, new_time->tm_mon + 1, new_time->tm_mday);
 }
 
-string getFileNameForPassType(const string& passType) {
-    if (passType == "Regular") return regularFileName;
-    if (passType == "Urgent") return urgentFileName;
-    if (passType == "ExpiredRegular") return expiredRegularFileName;
-    if (passType == "ExpiredUrgent") return expiredUrgentFileName;
-    return "";
-}
+// --- Trigram Name Index ---
+// Inverted index from character trigrams of normalized names to records.
+// Supports substring and typo-tolerant name search ranked by similarity and
+// is kept current through the record change hooks below. Queries of one or
+// two letters are matched by a scan of the names instead.
+template <typename T>
+struct NameIndex {
+    struct Doc {
+        const T* record;
+        string normalized;
+        vector<uint32_t> grams;
+        bool alive;
+    };
+    vector<Doc> docs;
+    unordered_map<const T*, uint32_t> docOf;
+    unordered_map<uint32_t, vector<uint32_t>> postings;
+    size_t deadDocs = 0;
 
-void saveNewPassportsToFile() {
-  ofstream outRegular(regularFileName, ios::trunc);
-    if (outRegular) {
-        outRegular << "PassType,ID,Name,DOB,Nationality,Phone,CreatedDate,AppointmentDate,Payment,PaymentStatus\n";
-        outRegular.close();
+    static void trigrams(const string& normalized, vector<uint32_t>& grams) {
+        string padded = "  " + normalized + " ";
+        grams.clear();
+        for (size_t i = 0; i + 3 <= padded.size(); ++i) {
+            grams.push_back((static_cast<uint32_t>(static_cast<unsigned char>(padded[i])) << 16) |
+                            (static_cast<uint32_t>(static_cast<unsigned char>(padded[i + 1])) << 8) |
+                            static_cast<unsigned char>(padded[i + 2]));
+        }
+        sort(grams.begin(), grams.end());
+        grams.erase(unique(grams.begin(), grams.end()), grams.end());
     }
-    ofstream outUrgent(urgentFileName, ios::trunc);
-    if (outUrgent) {
-        outUrgent << "PassType,ID,Name,DOB,Nationality,Phone,CreatedDate,AppointmentDate,Payment,PaymentStatus\n";
-        outUrgent.close();
+    void add(const T* record) {
+        uint32_t docId = static_cast<uint32_t>(docs.size());
+        docs.push_back({record, normalizeName(record->name), {}, true});
+        trigrams(docs.back().normalized, docs.back().grams);
+        for (uint32_t gram : docs.back().grams) postings[gram].push_back(docId);
+        docOf[record] = docId;
     }
-    NewPassport* temp = newHead;
-    while (temp != nullptr) {
-        string fileName = getFileNameForPassType(temp->passType);
-        ofstream out(fileName, ios::app); // Open in append mode
-        if (!out) {
-            cout << "Error opening file " << fileName << " for writing!\n";
-            return;
+    void remove(const T* record) {
+        auto it = docOf.find(record);
+        if (it == docOf.end()) return;
+        Doc& doc = docs[it->second];
+        doc.alive = false; // Postings are skipped lazily and dropped on compaction
+        doc.grams.clear();
+        doc.normalized.clear();
+        docOf.erase(it);
+        if (++deadDocs > 1024 && deadDocs > docs.size() / 2) compact();
+    }
+    void compact() {
+        vector<Doc> live;
+        for (Doc& doc : docs) {
+            if (doc.alive) live.push_back(move(doc));
         }
-        out << temp->passType << ","
-            << temp->id << "," << temp->name << ","
-            << temp->dob << "," << temp->nationality << "," << temp->phoneNumber << ","
-            << temp->createdDate << "," << temp->appointmentDate << "," << temp->payment << ","
-            << temp->paymentStatus << "\n";
-        out.close();
-        temp = temp->next;
-    }   
-}
-void saveOldPassportsToFile() {
- ofstream outExpiredRegular(expiredRegularFileName, ios::trunc);
-    if (outExpiredRegular) {
-        outExpiredRegular << "PassType,ID,Name,DOB,IssueDate,ExpiredDate,PassportNumber,AccountNumber,Balance,CreatedDate,AppointmentDate,Payment,PaymentStatus\n";
-        outExpiredRegular.close();
+        clear();
+        for (const Doc& doc : live) add(doc.record);
     }
-    ofstream outExpiredUrgent(expiredUrgentFileName, ios::trunc);
-    if (outExpiredUrgent) {
-        outExpiredUrgent << "PassType,ID,Name,DOB,IssueDate,ExpiredDate,PassportNumber,AccountNumber,Balance,CreatedDate,AppointmentDate,Payment,PaymentStatus\n";
-        outExpiredUrgent.close();
+    void clear() {
+        docs.clear();
+        docOf.clear();
+        postings.clear();
+        deadDocs = 0;
     }
-    OldPassport* temp = oldHead;
-    while (temp != nullptr) {
-        string fileName = getFileNameForPassType(temp->passType);
-        ofstream out(fileName, ios::app); // Open in append mode
-        if (!out) {
-            cout << "Error opening file " << fileName << " for writing!\n";
-            return;
+    // Returns up to `limit` records whose name contains the query or shares
+    // enough trigrams with it, best match first.
+    vector<pair<const T*, double>> search(const string& query, size_t limit) const {
+        const double MIN_SIMILARITY = 0.4;
+        string normalized = normalizeName(query);
+        vector<uint32_t> queryGrams;
+        trigrams(normalized, queryGrams);
+        unordered_map<uint32_t, uint32_t> shared;
+        for (uint32_t gram : queryGrams) {
+            auto it = postings.find(gram);
+            if (it == postings.end()) continue;
+            for (uint32_t docId : it->second) {
+                if (docs[docId].alive) ++shared[docId];
+            }
         }
-        out << temp->passType << "," << temp->id << "," << temp->name << ","
-            << temp->dob << "," << temp->issueDate << "," << temp->expiredDate << ","
-            << temp->passportNumber << "," << temp->accountNumber << "," << fixed << setprecision(2) << temp->balance << ","
-            << temp->createdDate << "," << temp->appointmentDate << "," << temp->payment << ","
-            << temp->paymentStatus << "\n";
-        out.close();
-        temp = temp->next;
-    }
-}
-void loadNewPassportsFromFile() {
-freeNewPassportList(); 
-    string fileNames[] = {regularFileName, urgentFileName};
-    for (const string& fileName : fileNames) {
-        ifstream in(fileName);
-        if (!in) continue; 
-        string line;
-        getline(in, line); 
-        while (getline(in, line)) {
-            stringstream ss(line);
-            string token;
-            NewPassport* newPass = new NewPassport(); 
-            getline(ss, newPass->passType, ',');
-            getline(ss, newPass->id, ',');
-            getline(ss, newPass->name, ',');
-            getline(ss, newPass->dob, ',');
-            getline(ss, newPass->nationality, ',');
-            getline(ss, newPass->phoneNumber, ',');
-            getline(ss, newPass->createdDate, ',');
-            getline(ss, newPass->appointmentDate, ',');
-            getline(ss, newPass->payment, ',');
-            getline(ss, newPass->paymentStatus); 
-            newPass->next = nullptr;
-            // Add to the end of the list
-            if (newHead == nullptr) {
-                newHead = newPass;
-            } else {
-                NewPassport* temp = newHead;
-                while (temp->next != nullptr) {
-                    temp = temp->next;
-                }
-                temp->next = newPass;
+        // A fragment shorter than a trigram inside a name ("eb" in "kebede")
+        // shares no trigram with it, so short queries also scan the names
+        if (!normalized.empty() && normalized.size() < 3) {
+            for (uint32_t docId = 0; docId < docs.size(); ++docId) {
+                if (docs[docId].alive && docs[docId].normalized.find(normalized) != string::npos) shared.emplace(docId, 0);
             }
         }
-        in.close();
+        vector<pair<const T*, double>> results;
+        for (const auto& candidate : shared) {
+            const Doc& doc = docs[candidate.first];
+            double score = 2.0 * candidate.second / (queryGrams.size() + doc.grams.size()); // Dice coefficient
+            if (doc.normalized == normalized) score = 1.0;
+            else if (!normalized.empty() && doc.normalized.find(normalized) != string::npos) score = min(0.99, score + 0.5);
+            if (score >= MIN_SIMILARITY) results.push_back({doc.record, score});
+        }
+        sort(results.begin(), results.end(), [](const pair<const T*, double>& a, const pair<const T*, double>& b) {
+            return a.second > b.second;
+        });
+        if (results.size() > limit) results.resize(limit);
+        return results;
+    }
+};
+NameIndex<NewPassport> newNameIndex;
+NameIndex<OldPassport> oldNameIndex;
+
+// --- Applicant Blocking Index ---
+// Records by the blocking keys of Duplicate Applicant Detection (date of birth
+// plus the Soundex code of the first or last name token), kept current by the
+// change hooks. The on-create duplicate check compares a new applicant only
+// with the records in its own blocks instead of scanning both lists.
+vector<string> applicantBlockingKeys(const string& normalizedName, const string& dob) {
+    size_t firstSpace = normalizedName.find(' '), lastSpace = normalizedName.rfind(' ');
+    vector<string> keys{dob + '|' + soundexCode(normalizedName.substr(0, firstSpace))};
+    if (lastSpace != string::npos) {
+        string last = dob + '|' + soundexCode(normalizedName.substr(lastSpace + 1));
+        if (last != keys[0]) keys.push_back(last);
     }
+    return keys;
 }
-void loadOldPassportsFromFile() {
- freeOldPassportList(); // Clear existing list before loading
-    string fileNames[] = {expiredRegularFileName, expiredUrgentFileName};
-    for (const string& fileName : fileNames) {
-        ifstream in(fileName);
-        if (!in) continue; // File might not exist yet
-        string line;
-        getline(in, line); // Skip header
-        while (getline(in, line)) {
-            stringstream ss(line);
-            string token;
-            OldPassport* oldPass = new OldPassport(); 
-            getline(ss, oldPass->passType, ',');
-            getline(ss, oldPass->id, ',');
-            getline(ss, oldPass->name, ',');
-            getline(ss, oldPass->dob, ',');
-            getline(ss, oldPass->issueDate, ',');
-            getline(ss, oldPass->expiredDate, ',');
-            getline(ss, oldPass->passportNumber, ',');
-            getline(ss, oldPass->accountNumber, ',');
-            getline(ss, token, ','); // Read balance as string first
-            oldPass->balance = stod(token); 
-            getline(ss, oldPass->createdDate, ',');
-            getline(ss, oldPass->appointmentDate, ',');
-            getline(ss, oldPass->payment, ',');
-            getline(ss, oldPass->paymentStatus);
-            oldPass->next = nullptr;
-            // Add to the end of the list
-            if (oldHead == nullptr) {
-                oldHead = oldPass;
-            } else {
-                OldPassport* temp = oldHead;
-                while (temp->next != nullptr) {
-                    temp = temp->next;
-                }
-                temp->next = oldPass;
+template <typename T>
+class ApplicantIndex {
+public:
+    void add(const T* record) {
+        for (const string& key : applicantBlockingKeys(normalizeName(record->name), record->dob)) {
+            blocks[key].push_back(record);
+        }
+    }
+    // `keys` is the record as it was when added
+    void remove(const T* keys, const T* record) {
+        for (const string& key : applicantBlockingKeys(normalizeName(keys->name), keys->dob)) {
+            auto it = blocks.find(key);
+            if (it == blocks.end()) continue;
+            vector<const T*>& members = it->second;
+            auto member = find(members.begin(), members.end(), record);
+            if (member == members.end()) continue;
+            *member = members.back();
+            members.pop_back();
+            if (members.empty()) blocks.erase(it);
+        }
+    }
+    void clear() { blocks.clear(); }
+    // Calls visit once for every record that shares a block with the applicant
+    template <typename Visit>
+    void forEachCandidate(const string& normalizedName, const string& dob, Visit visit) const {
+        vector<const T*> seen; // Records of the first block, which may be in the second too
+        for (const string& key : applicantBlockingKeys(normalizedName, dob)) {
+            auto it = blocks.find(key);
+            if (it == blocks.end()) continue;
+            for (const T* record : it->second) {
+                if (find(seen.begin(), seen.end(), record) != seen.end()) continue;
+                seen.push_back(record);
+                visit(record);
             }
         }
-        in.close();
     }
+private:
+    unordered_map<string, vector<const T*>> blocks;
+};
+ApplicantIndex<NewPassport> newApplicants;
+ApplicantIndex<OldPassport> oldApplicants;
+
+// --- Aggregate Reports ---
+// Running totals per list, adjusted by the change hooks so that printing a
+// report never scans the records. Money is kept in integer cents.
+struct PassportReport {
+    long long records = 0;
+    long long collectedCents = 0;   // Payments of records with status Yes
+    long long outstandingCents = 0; // Payments of records not yet confirmed
+    long long balanceCents = 0;     // Account balances (old passports only)
+    unordered_map<string, long long> byPassType, byPaymentStatus, byNationality, appointmentsPerDay;
+};
+PassportReport newReport, oldReport;
+long long moneyToCents(const string& amount) {
+    return llround(strtod(amount.c_str(), nullptr) * 100);
 }
-void createNewPassport() {
-string id, name, dob, nationality, phoneNumber, payment, paymentStatus, passType;
-    int passportTypeChoice;
-    cout << "Select Passport Type:\n1. Regular\n2. Urgent\nEnter choice (1 or 2): ";
-    cin >> passportTypeChoice;
-    cin.ignore(numeric_limits<streamsize>::max(), '\n'); // Clear buffer
-    const int MAX_ID_LEN = 10;
-    do {
-        cout << "Enter ID (max " << MAX_ID_LEN << " chars, alphanumeric): ";
-        getline(cin, id);
-        if (id.length() > MAX_ID_LEN) {
-            cout << "your size is limit pls try again (max " << MAX_ID_LEN << " chars).\n";
-            continue; // Ask for input again
-        }
-        if (!isAlphanumeric(id)) {
-            cout << "Invalid ID: Must be alphanumeric.\n";
-        } else if (!isUniqueNewID(id)) {
-            cout << "Error: This ID already exists.\n";
+void adjustCount(unordered_map<string, long long>& counts, const string& key, long long delta) {
+    long long& count = counts[key];
+    count += delta;
+    if (count == 0) counts.erase(key);
+}
+void adjustReport(PassportReport& report, const string& passType, const string& payment,
+                  const string& paymentStatus, const string& appointmentDate, int delta) {
+    report.records += delta;
+    long long cents = moneyToCents(payment) * delta;
+    if (paymentStatus == "Yes") report.collectedCents += cents;
+    else report.outstandingCents += cents;
+    adjustCount(report.byPassType, passType, delta);
+    adjustCount(report.byPaymentStatus, paymentStatus, delta);
+    adjustCount(report.appointmentsPerDay, appointmentDate, delta);
+}
+void adjustNewReport(const NewPassport* record, int delta) {
+    adjustReport(newReport, record->passType, record->payment, record->paymentStatus, record->appointmentDate, delta);
+    adjustCount(newReport.byNationality, record->nationality, delta);
+}
+void adjustOldReport(const OldPassport* record, int delta) {
+    adjustReport(oldReport, record->passType, record->payment, record->paymentStatus, record->appointmentDate, delta);
+    oldReport.balanceCents += llround(record->balance * 100) * delta;
+}
+string formatCents(long long cents) {
+    char text[32];
+    char* end = writeCents(text + 1, cents);
+    text[0] = '$';
+    if (cents < 0) swap(text[0], text[1]); // "-$12.05"
+    return string(text, end);
+}
+
+// --- Snapshot Reads ---
+// Display, search and reports read an immutable snapshot of a list instead of
+// the live nodes. A snapshot is the list order as node pointers plus the
+// report; the records themselves are read from the live nodes. Writers hold
+// storeMutex, and before they change a node in place or free it they copy it
+// into every snapshot a reader still holds, so copies are only made while
+// someone reads and only of the records that change. A published snapshot
+// nobody holds is dropped instead of copied into. The next reader after a
+// write publishes a new snapshot, reusing the order of the last one when no
+// record was added, removed or moved, or keeps reading the last one while a
+// write is still in progress.
+mutex storeMutex;
+template <typename T>
+class ListSnapshot {
+public:
+    ListSnapshot(shared_ptr<const vector<const T*>> order, const PassportReport& report)
+        : report(report), order(move(order)) {}
+    PassportReport report;
+    size_t size() const { return order->size(); }
+    bool empty() const { return order->empty(); }
+    // Visits the records in list order as of the snapshot until visit
+    // returns false. A live node is read with preservedMutex held, so a
+    // writer waits for the current record before it changes it.
+    template <typename F>
+    void forEach(F visit) const {
+        for (const T* node : *order) {
+            lock_guard<mutex> lock(preservedMutex);
+            auto it = preserved.find(node);
+            if (!visit(it == preserved.end() ? node : it->second.get())) return;
         }
-    } while (id.length() > MAX_ID_LEN || !isAlphanumeric(id) || !isUniqueNewID(id));
-    const int MAX_NAME_LEN = 25;
-    do {
-        cout << "Enter Full Name (max " << MAX_NAME_LEN << " chars, letters only): ";
-        getline(cin, name);
-        if (name.length() > MAX_NAME_LEN) {
-            cout << "your size is limit pls try again (max " << MAX_NAME_LEN << " chars).\n";
-            continue;
+    }
+private:
+    template <typename> friend class VersionedList;
+    shared_ptr<const vector<const T*>> order;
+    mutable mutex preservedMutex;
+    mutable unordered_map<const T*, unique_ptr<T>> preserved; // Nodes changed since the snapshot was taken
+
+    void keep(const T* node) const {
+        lock_guard<mutex> lock(preservedMutex);
+        unique_ptr<T>& copy = preserved[node];
+        if (!copy) copy.reset(new T(*node));
+    }
+};
+template <typename T>
+class VersionedList {
+public:
+    VersionedList(T* const* head, const PassportReport* report) : head(head), report(report) {}
+    // Writers call these with storeMutex held. preserve runs before a node is
+    // changed in place or freed, the others after the list changed.
+    void preserve(const T* record) {
+        forEachHeld([record](const ListSnapshot<T>& snapshot) { snapshot.keep(record); });
+    }
+    void preserveAll() { // Before the whole list is freed
+        forEachHeld([](const ListSnapshot<T>& snapshot) {
+            for (const T* node : *snapshot.order) snapshot.keep(node);
+        });
+    }
+    void updated(const T& before, const T* record) {
+        lock_guard<mutex> lock(pinMutex);
+        stale = true;
+        if (before.prev != record->prev || before.next != record->next) orderStale = true; // Moved in the list
+    }
+    void reordered() { // Inserted, erased, relinked or reloaded
+        lock_guard<mutex> lock(pinMutex);
+        stale = orderStale = true;
+    }
+    shared_ptr<const ListSnapshot<T>> pin() {
+        {
+            lock_guard<mutex> lock(pinMutex);
+            if (published && !stale) return published;
         }
-        if (!isLettersOnly(name)) cout << "Invalid name: Must contain letters only.\n";
-    } while (name.length() > MAX_NAME_LEN || !isLettersOnly(name));
-    do {
-        cout << "Enter Date of Birth (YYYY-MM-DD): ";
-        getline(cin, dob);
-        if (!isValidDate(dob)) cout << "Invalid format. Try again.\n";
-        else if (!isOver18(dob)) cout << "Error: Applicant must be 18 or older.\n";
-    } while (!isValidDate(dob) || !isOver18(dob));
-    const int MAX_NATIONALITY_LEN = 15;
-    do {
-        cout << "Enter Nationality (max " << MAX_NATIONALITY_LEN << " chars, letters only): ";
-        getline(cin, nationality);
-        if (nationality.length() > MAX_NATIONALITY_LEN) {
-            cout << "your size is limit pls try again (max " << MAX_NATIONALITY_LEN << " chars).\n";
-            continue;
+        unique_lock<mutex> lock(storeMutex, try_to_lock);
+        if (!lock.owns_lock()) {
+            {
+                lock_guard<mutex> pinLock(pinMutex);
+                if (published) return published; // A write is in progress: read the last committed version
+            }
+            lock.lock();
         }
-        if (!isLettersOnly(nationality)) cout << "Invalid nationality: Must contain letters only.\n";
-    } while (nationality.length() > MAX_NATIONALITY_LEN || !isLettersOnly(nationality));
-    const int MAX_PHONE_LEN = 12;
-    do {
-        cout << "Enter Phone Number (max " << MAX_PHONE_LEN << " chars, numbers only): ";
-        getline(cin, phoneNumber);
-        if (phoneNumber.length() > MAX_PHONE_LEN) {
-            cout << "your size is limit pls try again (max " << MAX_PHONE_LEN << " chars).\n";
-            continue;
+        lock_guard<mutex> pinLock(pinMutex);
+        if (published && !stale) return published;
+        shared_ptr<const vector<const T*>> order;
+        if (published && !orderStale) {
+            order = published->order;
+        } else {
+            shared_ptr<vector<const T*>> nodes = make_shared<vector<const T*>>();
+            for (const T* node = *head; node != nullptr; node = node->next) nodes->push_back(node);
+            order = nodes;
         }
-        if (!isNumbersOnly(phoneNumber)) cout << "Invalid phone number: Must contain numbers only.\n";
-    } while (phoneNumber.length() > MAX_PHONE_LEN || !isNumbersOnly(phoneNumber));
-    if (passportTypeChoice == 1) {
-        payment = "5000";
-        passType = "Regular";
-        cout << "Payment Amount: $" << payment << " (Regular Passport)\n";
-    } else if (passportTypeChoice == 2) {
-        payment = "25000";
-        passType = "Urgent";
-        cout << "Payment Amount: $" << payment << " (Urgent Passport)\n";
-    } else {
-        cout << "Invalid passport type choice. Passport creation cancelled.\n";
-        return;
+        published = make_shared<ListSnapshot<T>>(order, *report);
+        pinned.push_back(published);
+        stale = orderStale = false;
+        return published;
     }
-    do {
-        cout << "Is payment confirmed? (Yes/No): ";
-        getline(cin, paymentStatus);
-        if (paymentStatus != "Yes" && paymentStatus != "No") {
-            cout << "Invalid status: Must be Yes or No.\n";
+private:
+    T* const* head;
+    const PassportReport* report;
+    mutex pinMutex; // Guards the members below; readers only get a snapshot under it
+    shared_ptr<ListSnapshot<T>> published;
+    vector<weak_ptr<ListSnapshot<T>>> pinned; // Every snapshot handed out that may still be held
+    bool stale = true, orderStale = true;
+
+    template <typename F>
+    void forEachHeld(F keep) {
+        lock_guard<mutex> lock(pinMutex);
+        stale = true;
+        for (size_t i = 0; i < pinned.size();) {
+            shared_ptr<ListSnapshot<T>> snapshot = pinned[i].lock();
+            bool unread = snapshot == published && snapshot.use_count() == 2; // Only `published` and this copy
+            if (unread) published.reset();
+            if (!snapshot || unread) {
+                pinned[i] = pinned.back();
+                pinned.pop_back();
+                continue;
+            }
+            keep(*snapshot);
+            ++i;
         }
-    } while (paymentStatus != "Yes" && paymentStatus != "No");
-    if (paymentStatus != "Yes") {
-        cout << "Error: Passport cannot be created until payment is confirmed.\n";
-        return;
     }
-    string createdDate = getCurrentDate();
-    cout << "Created Date (auto-set): " << createdDate << "\n";
-    string appointmentDate;
-    if (passType == "Regular") {
-        appointmentDate = getDateOneMonthLater(createdDate);
-        cout << "Appointment Date (auto-set, 1 month from creation): " << appointmentDate << "\n";
-    } else {
-        appointmentDate = getDateTwoDaysLater(createdDate);
-        cout << "Appointment Date (auto-set, 2 days from creation): " << appointmentDate << "\n";
+};
+VersionedList<NewPassport> newVersions(&newHead, &newReport);
+VersionedList<OldPassport> oldVersions(&oldHead, &oldReport);
+VersionedList<NewPassport>& recordVersions(const NewPassport*) { return newVersions; }
+VersionedList<OldPassport>& recordVersions(const OldPassport*) { return oldVersions; }
+// Call instead of copying a record before changing it in place: returns the
+// copy the change hook compares with and keeps the node for held snapshots
+template <typename T>
+T beginRecordChange(const T* record) {
+    recordVersions(record).preserve(record);
+    return *record;
+}
+// Runs a check on the live lists under storeMutex. The create, update and
+// delete dialogs validate input with it between prompts, so the lock is never
+// held while the clerk types; they take it again to recheck and commit.
+template <typename F>
+auto underStoreMutex(F check) -> decltype(check()) {
+    lock_guard<mutex> readLock(storeMutex);
+    return check();
+}
+
+void printCounts(const string& title, const unordered_map<string, long long>& first,
+                 const unordered_map<string, long long>& second) {
+    map<string, long long> merged(first.begin(), first.end());
+    for (const auto& entry : second) merged[entry.first] += entry.second;
+    cout << title << ":\n";
+    if (merged.empty()) cout << "  (none)\n";
+    for (const auto& entry : merged) {
+        cout << "  " << (entry.first.empty() ? "(blank)" : entry.first) << ": " << entry.second << "\n";
     }
-    if (!isValidDate(appointmentDate)) {
-        cout << "Error: Invalid appointment date generated. Passport creation cancelled.\n";
-        return;
+}
+void printReport(const PassportReport& newReport, const PassportReport& oldReport) {
+    static const unordered_map<string, long long> none;
+    cout << "\n--- Passport Report ---\n";
+    cout << "New passports: " << newReport.records << "\n";
+    cout << "Old passports: " << oldReport.records << "\n";
+    printCounts("By passport type", newReport.byPassType, oldReport.byPassType);
+    printCounts("By payment status", newReport.byPaymentStatus, oldReport.byPaymentStatus);
+    printCounts("By nationality (new passports)", newReport.byNationality, none);
+    cout << "Revenue collected: " << formatCents(newReport.collectedCents + oldReport.collectedCents) << "\n";
+    cout << "Payments outstanding: " << formatCents(newReport.outstandingCents + oldReport.outstandingCents) << "\n";
+    cout << "Total old passport balance: " << formatCents(oldReport.balanceCents) << "\n";
+    printCounts("Appointments per day", newReport.appointmentsPerDay, oldReport.appointmentsPerDay);
+}
+void displayReport() {
+    ensurePassportsLoaded();
+    shared_ptr<const ListSnapshot<NewPassport>> newSnapshot = newVersions.pin();
+    shared_ptr<const ListSnapshot<OldPassport>> oldSnapshot = oldVersions.pin();
+    printReport(newSnapshot->report, oldSnapshot->report);
+}
+
+// --- Ordered Indexes ---
+// Skip lists over the records keyed by (name, pass type) and (pass type, name),
+// with the ID as final tie-breaker. The change hooks keep them current at
+// O(log n) per change, so sorted output is a plain traversal. Keys are copied
+// into the nodes because an update changes the record before the hook runs.
+typedef tuple<string, string, string> OrderKey;
+template <typename T>
+class OrderedIndex {
+public:
+    explicit OrderedIndex(OrderKey (*keyOf)(const T*)) : keyOf(keyOf), level(1), seed(0x9E3779B97F4A7C15ull) {
+        head.forward.assign(MAX_LEVEL, nullptr);
     }
-  // Create a new node and add to the end of the list
-    NewPassport* newPass = new NewPassport;
-    newPass->passType = passType;
-    newPass->id = id;
-    newPass->name = name;
-    newPass->dob = dob;
-    newPass->nationality = nationality;
-    newPass->phoneNumber = phoneNumber;
-    newPass->createdDate = createdDate;
-    newPass->appointmentDate = appointmentDate;
-    newPass->payment = payment;
-    newPass->paymentStatus = paymentStatus;
-    newPass->next = nullptr;
-    if (newHead == nullptr) {
-        newHead = newPass;
-    } else {
-        NewPassport* temp = newHead;
-        while (temp->next != nullptr) {
-            temp = temp->next;
+    ~OrderedIndex() { clear(); }
+    OrderKey key(const T* record) const { return keyOf(record); }
+    void insert(T* record) {
+        Node* update[MAX_LEVEL];
+        OrderKey k = keyOf(record);
+        findPredecessors(k, update);
+        int nodeLevel = randomLevel();
+        if (nodeLevel > level) {
+            for (int i = level; i < nodeLevel; ++i) update[i] = &head;
+            level = nodeLevel;
+        }
+        Node* node = new Node{k, record, vector<Node*>(nodeLevel, nullptr)};
+        for (int i = 0; i < nodeLevel; ++i) {
+            node->forward[i] = update[i]->forward[i];
+            update[i]->forward[i] = node;
         }
-        temp->next = newPass;
-    }
-    saveNewPassportsToFile();
-    cout << "New passport added successfully!\n";
-}
-void createOldPassports() {
- string persons[5][8] = {
-        {"001", "Abebea", "1990-05-15", "2015-06-01", "2020-06-01", "P123", "ACC1001", "20000.00"},
-        {"002", "Aster", "1985-08-22", "2014-09-10", "2019-09-10", "P234", "ACC1002", "3000.00"},
-        {"003", "abdi", "1992-03-10", "2016-04-15", "2021-04-15", "P345", "ACC1003", "35000.00"},
-        {"004", "Lami", "1988-11-30", "2013-12-05", "2018-12-05", "P456", "ACC1004", "10000.00"},
-        {"005", "Robel", "1995-07-20", "2017-08-25", "2022-08-25", "P567", "ACC1005", "40000.00"},
-    };
-    cout << "--- Create Old Passport ---\n";
-    int searchOption;
-    string searchValue;
-    int index = -1;
-    cout << "Search Old Record By:\n";
-    cout << "1. ID\n2. Name\n3. Passport Number\nEnter choice: ";
-    cin >> searchOption;
-    cin.ignore(numeric_limits<streamsize>::max(), '\n');
-    switch (searchOption) {
-        case 1:
-            cout << "Enter ID (or ## to cancel): ";
-            getline(cin, searchValue);
-            if (searchValue == "##") return;
-            for (int i = 0; i < 5; ++i) {
-                if (persons[i][0] == searchValue) {
-                    index = i;
-                    break;
-                }
-            }
-            break;
-        case 2:
-            cout << "Enter Name: ";
-            getline(cin, searchValue);
-            for (int i = 0; i < 5; ++i) {
-                if (persons[i][1] == searchValue) {
-                    index = i;
-                    break;
-                }
-            }
-            break;
-        case 3:
-            cout << "Enter Passport Number: ";
-            getline(cin, searchValue);
-            for (int i = 0; i < 5; ++i) {
-                if (persons[i][5] == searchValue) {
-                    index = i;
-                    break;
-                }
-            }
-            break;
-        default:
-            cout << "Invalid search option.\n";
-            return;
     }
-    if (index == -1) {
-        cout << "No matching record found.\n";
-        return;
+    void erase(const OrderKey& k) {
+        Node* update[MAX_LEVEL];
+        findPredecessors(k, update);
+        Node* target = update[0]->forward[0];
+        if (target == nullptr || target->key != k) return;
+        for (int i = 0; i < level && update[i]->forward[i] == target; ++i) update[i]->forward[i] = target->forward[i];
+        delete target;
+        while (level > 1 && head.forward[level - 1] == nullptr) --level;
     }
-    int typeChoice;
-    string passType="expired";
-    cout << "Select Passport Type:\n1. Expired Regular\n2. Expired Urgent\nEnter choice (1 or 2): ";
-    cin >> typeChoice;
-    cin.ignore(numeric_limits<streamsize>::max(), '\n');
-    if (typeChoice == 1) passType = "ExpiredRegular";
-    else if (typeChoice == 2) passType = "ExpiredUrgent";
-    else {
-        cout << "Invalid passport type choice. Operation cancelled.\n";
-        return;
+    // Record ordered immediately before the given key, or nullptr at the front
+    T* predecessor(const OrderKey& k) const {
+        Node* update[MAX_LEVEL];
+        findPredecessors(k, update);
+        return update[0] == &head ? nullptr : update[0]->record;
     }
-    string enteredId = persons[index][0];
-    string enteredPassportNumber = persons[index][5];
-    if (!isAlphanumeric(enteredId)) {
-        cout << "Invalid ID: Must be alphanumeric.\n";
-        return;
+    template <typename F>
+    void forEach(F visit) const {
+        for (Node* node = head.forward[0]; node != nullptr; node = node->forward[0]) visit(node->record);
     }
-    if (!isUniqueOldID(enteredId)) {
-        cout << "Error: This ID already exists in the system.\n";
-        return;
+    // Visits records from the first key not less than `k` until visit returns false
+    template <typename F>
+    void forEachFrom(const OrderKey& k, F visit) const {
+        Node* update[MAX_LEVEL];
+        findPredecessors(k, update);
+        for (Node* node = update[0]->forward[0]; node != nullptr && visit(node->record); node = node->forward[0]) {}
     }
-    if (!isUniquePassportNumber(enteredPassportNumber)) {
-        cout << "Error: Passport number already exists in the system.\n";
-        return;
+    void clear() {
+        Node* node = head.forward[0];
+        while (node != nullptr) {
+            Node* next = node->forward[0];
+            delete node;
+            node = next;
+        }
+        head.forward.assign(MAX_LEVEL, nullptr);
+        level = 1;
     }
-    // Create and fill old passport object
-    OldPassport* oldPass = new OldPassport();
-    oldPass->passType = passType;
-    oldPass->id = enteredId;
-    oldPass->name = persons[index][1];
-    oldPass->dob = persons[index][2];
-    oldPass->issueDate = persons[index][3];
-    oldPass->expiredDate = persons[index][4];
-    oldPass->passportNumber = enteredPassportNumber;
-    oldPass->accountNumber = persons[index][6];
-    oldPass->balance = stod(persons[index][7]);
-    oldPass->createdDate = getCurrentDate();
-    oldPass->appointmentDate = (passType == "ExpiredRegular")
-                                ? getDateOneMonthLater(oldPass->createdDate)
-                                : getDateTwoDaysLater(oldPass->createdDate);
-    oldPass->payment = "0.0";
-    oldPass->paymentStatus = "Pending";
-    oldPass->next = nullptr;
-    if (oldHead == nullptr) {
-        oldHead = oldPass;
-    } else {
-        OldPassport* temp = oldHead;
-        while (temp->next != nullptr) {
-            temp = temp->next;
+private:
+    static const int MAX_LEVEL = 32;
+    struct Node {
+        OrderKey key;
+        T* record;
+        vector<Node*> forward;
+    };
+    OrderKey (*keyOf)(const T*);
+    Node head;
+    int level;
+    uint64_t seed;
+    void findPredecessors(const OrderKey& k, Node** update) const {
+        Node* x = const_cast<Node*>(&head);
+        for (int i = level - 1; i >= 0; --i) {
+            while (x->forward[i] != nullptr && x->forward[i]->key < k) x = x->forward[i];
+            update[i] = x;
         }
-        temp->next = oldPass;
     }
-    cout << "Old Passport Created:\n";
-    cout << "ID: " << oldPass->id
-         << " | Name: " << oldPass->name
-         << " | DOB: " << oldPass->dob
-         << " | Issue Date: " << oldPass->issueDate
-         << " | Expired Date: " << oldPass->expiredDate
-         << " | Passport No.: " << oldPass->passportNumber
-         << " | Balance: $" << fixed << setprecision(2) << oldPass->balance
-         << " | Type: " << oldPass->passType
-         << " | Created: " << oldPass->createdDate
-         << " | Appointment: " << oldPass->appointmentDate
-         << " | Payment: " << oldPass->payment
-         << " | Status: " << oldPass->paymentStatus << "\n";
-    saveOldPassportsToFile();
-    cout << "--- Passport creation completed ---\n";
-}
-void updateNewPassport() {
-string idToUpdate;
-    cout << "Enter New Passport ID to update: ";
-    getline(cin, idToUpdate);
-
-    NewPassport* current = newHead;
-    while (current != nullptr && current->id != idToUpdate) {
-        current = current->next;
+    int randomLevel() { // Each level is kept with probability 1/4
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        int nodeLevel = 1;
+        for (uint64_t bits = seed; (bits & 3) == 0 && nodeLevel < MAX_LEVEL; bits >>= 2) ++nodeLevel;
+        return nodeLevel;
     }
+};
+template <typename T>
+OrderKey nameOrderKey(const T* record) { return OrderKey(record->name, record->passType, record->id); }
+template <typename T>
+OrderKey typeOrderKey(const T* record) { return OrderKey(record->passType, record->name, record->id); }
+OrderedIndex<NewPassport> newByName(nameOrderKey<NewPassport>), newByType(typeOrderKey<NewPassport>);
+OrderedIndex<OldPassport> oldByName(nameOrderKey<OldPassport>), oldByType(typeOrderKey<OldPassport>);
+// Active list order: 0 = insertion order, 1 = by name, 2 = by passport type.
+// Once a list was sorted, new and updated records are placed in order.
+int newSortOrder = 0, oldSortOrder = 0;
 
-    if (current != nullptr) {
-
-        string newId, newName, newDob, newNationality, newPhoneNumber, newPayment, paymentStatus, newPassType;
-        int passportTypeChoice;
+OrderedIndex<NewPassport>* activeNewOrder() {
+    return newSortOrder == 1 ? &newByName : newSortOrder == 2 ? &newByType : nullptr;
+}
+OrderedIndex<OldPassport>* activeOldOrder() {
+    return oldSortOrder == 1 ? &oldByName : oldSortOrder == 2 ? &oldByType : nullptr;
+}
+void saveSortOrder() {
+    ofstream out(sortOrderFileName, ios::trunc);
+    if (out) out << "new=" << newSortOrder << "\nold=" << oldSortOrder << "\n";
+}
+void loadSortOrder() {
+    ifstream in(sortOrderFileName);
+    string line;
+    while (getline(in, line)) {
+        if (line.compare(0, 4, "new=") == 0) newSortOrder = atoi(line.c_str() + 4);
+        else if (line.compare(0, 4, "old=") == 0) oldSortOrder = atoi(line.c_str() + 4);
+    }
+    if (newSortOrder < 0 || newSortOrder > 2) newSortOrder = 0;
+    if (oldSortOrder < 0 || oldSortOrder > 2) oldSortOrder = 0;
+}
+// Rewires the list to follow the active ordered index
+void relinkNewPassports() {
+    OrderedIndex<NewPassport>* order = activeNewOrder();
+    if (order == nullptr) return;
+    newHead = newTail = nullptr;
+    order->forEach([](NewPassport* record) { appendRecord(record); });
+    newVersions.reordered(); // Snapshots taken before the sort keep their order
+}
+void relinkOldPassports() {
+    OrderedIndex<OldPassport>* order = activeOldOrder();
+    if (order == nullptr) return;
+    oldHead = oldTail = nullptr;
+    order->forEach([](OldPassport* record) { appendRecord(record); });
+    oldVersions.reordered(); // Snapshots taken before the sort keep their order
+}
+// Adds a node to the list: in sorted position when an order is active,
+// otherwise at the end in O(1). Must run before onNewPassportInserted.
+void linkNewPassport(NewPassport* record) {
+    OrderedIndex<NewPassport>* order = activeNewOrder();
+    if (order != nullptr) linkRecordAfter(order->predecessor(order->key(record)), record);
+    else appendRecord(record);
+}
+void linkOldPassport(OldPassport* record) {
+    OrderedIndex<OldPassport>* order = activeOldOrder();
+    if (order != nullptr) linkRecordAfter(order->predecessor(order->key(record)), record);
+    else appendRecord(record);
+}
+// Moves an updated node to its new sorted position. Must run before
+// onNewPassportUpdated, while the ordered index still holds the old key.
+void repositionNewPassport(NewPassport* record) {
+    OrderedIndex<NewPassport>* order = activeNewOrder();
+    if (order == nullptr) return;
+    NewPassport* oldPrev = record->prev;
+    unlinkRecord(record);
+    NewPassport* newPrev = order->predecessor(order->key(record));
+    if (newPrev == record) newPrev = oldPrev; // Key moved forward past no other record
+    linkRecordAfter(newPrev, record);
+}
+void repositionOldPassport(OldPassport* record) {
+    OrderedIndex<OldPassport>* order = activeOldOrder();
+    if (order == nullptr) return;
+    OldPassport* oldPrev = record->prev;
+    unlinkRecord(record);
+    OldPassport* newPrev = order->predecessor(order->key(record));
+    if (newPrev == record) newPrev = oldPrev;
+    linkRecordAfter(newPrev, record);
+}
 
-        cout << "Select New Passport Type:\n1. Regular\n2. Urgent\nEnter choice (1 or 2): ";
-        cin >> passportTypeChoice;
-        cin.ignore(numeric_limits<streamsize>::max(), '\n'); // Clear buffer
+// --- Fixed-Slot Storage ---
+// Slot storage mode (--slots) keeps each list in a memory-mapped file of
+// fixed-size slots. The first 4 KiB are the header; every record owns one slot
+// and is rewritten in place on update. Deleted slots form a free list that
+// later inserts reuse. Saving only msyncs the pages that were touched, in
+// units of the system page size. A value wider than its slot field is
+// rejected rather than cut, and the change is reported at the next save.
+// A slot header is [state][crc]: a used slot keeps the CRC32C of its record
+// bytes there, a free slot the next free slot.
+template <typename T>
+struct SlotField {
+    string T::*field;
+    size_t width; // Longest value the slot can hold
+};
+const SlotField<NewPassport> newSlotFields[] = {
+    {&NewPassport::passType, 16}, {&NewPassport::id, 10}, {&NewPassport::name, 25},
+    {&NewPassport::dob, 10}, {&NewPassport::nationality, 15}, {&NewPassport::phoneNumber, 12},
+    {&NewPassport::createdDate, 10}, {&NewPassport::appointmentDate, 10},
+    {&NewPassport::payment, 12}, {&NewPassport::paymentStatus, 8},
+};
+const SlotField<OldPassport> oldSlotFields[] = {
+    {&OldPassport::passType, 16}, {&OldPassport::id, 10}, {&OldPassport::name, 25},
+    {&OldPassport::dob, 10}, {&OldPassport::issueDate, 10}, {&OldPassport::expiredDate, 10},
+    {&OldPassport::passportNumber, 8}, {&OldPassport::accountNumber, 16},
+    {&OldPassport::createdDate, 10}, {&OldPassport::appointmentDate, 10},
+    {&OldPassport::payment, 12}, {&OldPassport::paymentStatus, 8},
+};
+// Balance is the only non-string field; it is stored as integer cents
+inline size_t slotExtraSize(const NewPassport*) { return 0; }
+inline size_t slotExtraSize(const OldPassport*) { return sizeof(int64_t); }
+inline void writeSlotExtra(char*, const NewPassport*) {}
+inline void writeSlotExtra(char* p, const OldPassport* record) {
+    int64_t cents = llround(record->balance * 100);
+    memcpy(p, &cents, sizeof(cents));
+}
+inline void readSlotExtra(const char*, NewPassport*) {}
+inline void readSlotExtra(const char* p, OldPassport* record) {
+    int64_t cents;
+    memcpy(&cents, p, sizeof(cents));
+    record->balance = cents / 100.0;
+}
 
-        const int MAX_ID_LEN = 10;
-        do {
-            cout << "Enter New ID (max " << MAX_ID_LEN << " chars, alphanumeric, current: " << current->id << "): ";
-            getline(cin, newId);
-            if (newId.length() > MAX_ID_LEN) {
-                cout << "your size is limit pls try again (max " << MAX_ID_LEN << " chars).\n";
-                continue;
-            }
-            if (!isAlphanumeric(newId)) {
-                cout << "Invalid ID: Must be alphanumeric.\n";
-            } else if (!isUniqueNewID(newId, current->id)) {
-                cout << "Error: This ID already exists.\n";
+#ifdef HAVE_POSIX_IO
+template <typename T, size_t N>
+class SlotFile {
+public:
+    SlotFile(const string& fileName, const SlotField<T> (&fields)[N]) : fileName(fileName), fields(fields) {
+        long systemPageSize = sysconf(_SC_PAGESIZE);
+        pageSize = systemPageSize > 0 ? static_cast<size_t>(systemPageSize) : 4096;
+        slotSize = SLOT_HEADER;
+        for (const SlotField<T>& field : fields) slotSize += 1 + field.width;
+        slotSize += slotExtraSize(static_cast<const T*>(nullptr));
+        slotSize = (slotSize + 7) / 8 * 8;
+    }
+    ~SlotFile() { close(); }
+    bool isOpen() const { return base != nullptr; }
+    // Maps the file, creating an empty one when needed. Returns false on error.
+    bool open(bool& created) {
+        fd = ::open(fileName.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            cout << "Error: cannot open " << fileName << ".\n";
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            cout << "Error: cannot open " << fileName << ".\n";
+            close();
+            return false;
+        }
+        created = info.st_size == 0;
+        if (created) {
+            if (!mapBytes(HEADER_SIZE + 64 * slotSize)) return false;
+            memcpy(header().magic, "PMSLOT2", 8);
+            header().slotSize = slotSize;
+            header().capacity = 64;
+            header().highWater = 0;
+            header().freeHead = NO_SLOT;
+            markDirty(0, HEADER_SIZE);
+            return true;
+        }
+        if (static_cast<size_t>(info.st_size) < HEADER_SIZE) {
+            cout << "Error: " << fileName << " is too short to be a slot file.\n";
+            close();
+            return false;
+        }
+        if (!mapBytes(static_cast<size_t>(info.st_size))) return false;
+        bool legacy = memcmp(header().magic, "PMSLOT1", 8) == 0;
+        if ((!legacy && memcmp(header().magic, "PMSLOT2", 8) != 0) || header().slotSize != slotSize) {
+            cout << "Error: " << fileName << " has an unexpected slot layout.\n";
+            close();
+            return false;
+        }
+        // The slot counts must fit the file, or slotAt would run past the mapping
+        const Header& h = header();
+        if (h.capacity > (mappedBytes - HEADER_SIZE) / slotSize || h.highWater > h.capacity ||
+            (h.freeHead != NO_SLOT && h.freeHead >= h.highWater)) {
+            cout << "Error: " << fileName << " is damaged: its header does not match the file size.\n";
+            damagedDataFiles = true;
+            close();
+            return false;
+        }
+        if (legacy) {
+            // Slots written before checksums existed: stamp them once
+            for (uint64_t slot = 0; slot < header().highWater; ++slot) {
+                char* p = slotAt(slot);
+                if (*reinterpret_cast<uint64_t*>(p) == SLOT_USED) stampChecksum(p);
             }
-        } while (newId.length() > MAX_ID_LEN || !isAlphanumeric(newId) || !isUniqueNewID(newId, current->id));
-
-        const int MAX_NAME_LEN = 25;
-        do {
-            cout << "Enter New Full Name (max " << MAX_NAME_LEN << " chars, letters only, current: " << current->name << "): ";
-            getline(cin, newName);
-            if (newName.length() > MAX_NAME_LEN) {
-                cout << "your size is limit pls try again (max " << MAX_NAME_LEN << " chars).\n";
+            memcpy(header().magic, "PMSLOT2", 8);
+            markDirty(0, mappedBytes);
+        }
+        return true;
+    }
+    void close() {
+        if (base != nullptr) {
+            flush();
+            munmap(base, mappedBytes);
+            base = nullptr;
+        }
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+        slotOf.clear();
+    }
+    // Creates a node for every used slot, in slot order. Slots that fail
+    // their checksum are reported and skipped.
+    template <typename F>
+    void forEachRecord(F visit) {
+        for (uint64_t slot = 0; slot < header().highWater; ++slot) {
+            char* p = slotAt(slot);
+            if (*reinterpret_cast<uint64_t*>(p) != SLOT_USED) continue;
+            if (*reinterpret_cast<uint32_t*>(p + 8) != crc32c(p + SLOT_HEADER, slotSize - SLOT_HEADER)) {
+                cout << "Error: " << fileName << " is damaged: slot " << slot << " does not match its checksum.\n";
+                damagedDataFiles = true;
                 continue;
             }
-            if (!isLettersOnly(newName)) cout << "Invalid name: Must contain letters only.\n";
-        } while (newName.length() > MAX_NAME_LEN || !isLettersOnly(newName));
-
-        do {
-            cout << "Enter New Date of Birth (YYYY-MM-DD, current: " << current->dob << "): ";
-            getline(cin, newDob);
-            if (!isValidDate(newDob)) cout << "Invalid format. Try again.\n";
-            else if (!isOver18(newDob)) cout << "Error: Applicant must be 18 or older.\n";
-        } while (!isValidDate(newDob) || !isOver18(newDob));
-
-
-        const int MAX_NATIONALITY_LEN = 15;
-        do {
-            cout << "Enter New Nationality (max " << MAX_NATIONALITY_LEN << " chars, letters only, current: " << current->nationality << "): ";
-            getline(cin, newNationality);
-            if (newNationality.length() > MAX_NATIONALITY_LEN) {
-                cout << "your size is limit pls try again (max " << MAX_NATIONALITY_LEN << " chars).\n";
-                continue;
+            T* record = recordPool(static_cast<const T*>(nullptr)).allocate();
+            const char* field = p + SLOT_HEADER;
+            for (const SlotField<T>& f : fields) {
+                unsigned char len = static_cast<unsigned char>(*field);
+                (record->*f.field).assign(field + 1, min<size_t>(len, f.width));
+                field += 1 + f.width;
             }
-            if (!isLettersOnly(newNationality)) cout << "Invalid nationality: Must contain letters only.\n";
-        } while (newNationality.length() > MAX_NATIONALITY_LEN || !isLettersOnly(newNationality));
-
-        const int MAX_PHONE_LEN = 12;
-        do {
-            cout << "Enter New Phone Number (max " << MAX_PHONE_LEN << " chars, numbers only, current: " << current->phoneNumber << "): ";
-            getline(cin, newPhoneNumber);
-            if (newPhoneNumber.length() > MAX_PHONE_LEN) {
-                cout << "your size is limit pls try again (max " << MAX_PHONE_LEN << " chars).\n";
-                continue;
+            readSlotExtra(field, record);
+            slotOf[record] = slot;
+            visit(record);
+        }
+    }
+    // Stores a new record; false, with the reason printed, if it does not
+    // fit its fields or the file cannot grow
+    bool insert(const T* record) {
+        if (!fits(record)) return false;
+        uint64_t slot;
+        if (header().freeHead != NO_SLOT) {
+            slot = header().freeHead;
+            uint64_t next = *reinterpret_cast<uint64_t*>(slotAt(slot) + 8);
+            if (next != NO_SLOT && next >= header().highWater) {
+                cout << "Error: " << fileName << " is damaged: its free list leaves the used slots.\n";
+                ++failedChanges;
+                return false;
             }
-            if (!isNumbersOnly(newPhoneNumber)) cout << "Invalid phone number: Must contain numbers only.\n";
-        } while (newPhoneNumber.length() > MAX_PHONE_LEN || !isNumbersOnly(newPhoneNumber));
-
-        if (passportTypeChoice == 1) {
-            newPayment = "5000";
-            newPassType = "Regular";
-            cout << "Payment Amount: $" << newPayment << " (Regular Passport)\n";
-        } else if (passportTypeChoice == 2) {
-            newPayment = "25000";
-            newPassType = "Urgent";
-            cout << "Payment Amount: $" << newPayment << " (Urgent Passport)\n";
+            header().freeHead = next;
         } else {
-            cout << "Invalid passport type choice. Update cancelled.\n";
-            return;
+            if (header().highWater == header().capacity && !grow()) {
+                cout << "Error: cannot grow " << fileName << "; passport " << record->id << " was not stored.\n";
+                ++failedChanges;
+                return false;
+            }
+            slot = header().highWater++;
         }
-
-        do {
-            cout << "Is payment confirmed? (Yes/No): ";
-            getline(cin, paymentStatus);
-            if (paymentStatus != "Yes" && paymentStatus != "No") {
-                cout << "Invalid status: Must be Yes or No.\n";
+        markDirty(0, HEADER_SIZE);
+        slotOf[record] = slot;
+        return write(record);
+    }
+    // Rewrites a record's slot; false if a value is wider than its field
+    bool write(const T* record) {
+        auto it = slotOf.find(record);
+        if (it == slotOf.end() || !fits(record)) return false;
+        char* p = slotAt(it->second);
+        *reinterpret_cast<uint64_t*>(p) = SLOT_USED;
+        char* field = p + SLOT_HEADER;
+        for (const SlotField<T>& f : fields) {
+            const string& value = record->*f.field;
+            size_t len = value.size();
+            *field = static_cast<char>(len);
+            memcpy(field + 1, value.data(), len);
+            memset(field + 1 + len, 0, f.width - len);
+            field += 1 + f.width;
+        }
+        writeSlotExtra(field, record);
+        stampChecksum(p);
+        markDirty(static_cast<size_t>(p - base), slotSize);
+        return true;
+    }
+    void erase(const T* record) {
+        auto it = slotOf.find(record);
+        if (it == slotOf.end()) return;
+        char* p = slotAt(it->second);
+        *reinterpret_cast<uint64_t*>(p) = SLOT_FREE;
+        *reinterpret_cast<uint64_t*>(p + 8) = header().freeHead;
+        header().freeHead = it->second;
+        markDirty(static_cast<size_t>(p - base), slotSize);
+        markDirty(0, HEADER_SIZE);
+        slotOf.erase(it);
+    }
+    // Writes back only the dirty pages, one msync per contiguous range.
+    // False if a page could not be written or a change since the last flush
+    // could not be stored; pages that failed stay dirty for the next try.
+    bool flush() {
+        if (base == nullptr) return true;
+        bool written = true;
+        set<size_t> failedPages;
+        auto it = dirtyPages.begin();
+        while (it != dirtyPages.end()) {
+            auto start = it;
+            size_t first = *it, last = *it;
+            while (++it != dirtyPages.end() && *it == last + 1) last = *it;
+            size_t length = min((last - first + 1) * pageSize, mappedBytes - first * pageSize);
+            if (msync(base + first * pageSize, length, MS_SYNC) != 0) {
+                written = false;
+                failedPages.insert(start, it);
             }
-        } while (paymentStatus != "Yes" && paymentStatus != "No");
-
-        if (paymentStatus != "Yes") {
-            cout << "Error: Passport cannot be updated until payment is confirmed.\n";
-            return;
         }
+        dirtyPages.swap(failedPages);
+        if (!written) cout << "Error writing file " << fileName << ": " << strerror(errno) << "\n";
+        if (failedChanges > 0) {
+            cout << "Error: " << failedChanges << " change(s) could not be stored in " << fileName
+                 << " and will be missing after a restart.\n";
+            failedChanges = 0;
+            written = false;
+        }
+        return written;
+    }
+    void clear() {
+        // Used when importing a list: every slot goes back to unused
+        header().highWater = 0;
+        header().freeHead = NO_SLOT;
+        slotOf.clear();
+        markDirty(0, HEADER_SIZE);
+    }
+private:
+    static const size_t HEADER_SIZE = 4096, SLOT_HEADER = 16; // The header size is part of the file format
+    static const uint64_t NO_SLOT = ~0ull, SLOT_USED = 1, SLOT_FREE = 2;
+    struct Header {
+        char magic[8];
+        uint64_t slotSize, capacity, highWater, freeHead;
+    };
+    string fileName;
+    const SlotField<T> (&fields)[N];
+    size_t slotSize, pageSize;
+    int fd = -1;
+    char* base = nullptr;
+    size_t mappedBytes = 0, failedChanges = 0;
+    unordered_map<const T*, uint64_t> slotOf;
+    set<size_t> dirtyPages;
 
-        string createdDate = getCurrentDate();
-        cout << "Created Date (auto-set): " << createdDate << "\n";
-
-        string appointmentDate;
-        if (newPassType == "Regular") {
-            appointmentDate = getDateOneMonthLater(createdDate);
-            cout << "Appointment Date (auto-set, 1 month from creation): " << appointmentDate << "\n";
-        } else {
-            appointmentDate = getDateTwoDaysLater(createdDate);
-            cout << "Appointment Date (auto-set, 2 days from creation): " << appointmentDate << "\n";
+    Header& header() { return *reinterpret_cast<Header*>(base); }
+    char* slotAt(uint64_t slot) { return base + HEADER_SIZE + slot * slotSize; }
+    bool fits(const T* record) {
+        for (const SlotField<T>& f : fields) {
+            if ((record->*f.field).size() > f.width) {
+                cout << "Error: value '" << record->*f.field << "' of passport " << record->id << " is longer than the "
+                     << f.width << " characters " << fileName << " holds; it was not stored.\n";
+                ++failedChanges;
+                return false;
+            }
         }
-        if (!isValidDate(appointmentDate)) {
-            cout << "Error: Invalid appointment date generated. Passport creation cancelled.\n";
-            return;
+        return true;
+    }
+    void stampChecksum(char* p) {
+        *reinterpret_cast<uint64_t*>(p + 8) = crc32c(p + SLOT_HEADER, slotSize - SLOT_HEADER);
+    }
+    void markDirty(size_t offset, size_t length) {
+        for (size_t page = offset / pageSize; page <= (offset + length - 1) / pageSize; ++page) dirtyPages.insert(page);
+    }
+    bool mapBytes(size_t bytes) {
+        if (ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+            cout << "Error: cannot resize " << fileName << ".\n";
+            return false;
         }
-        // Update the struct fields of the found node
-        current->passType = newPassType;
-        current->id = newId;
-        current->name = newName;
+        void* mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) {
+            cout << "Error: cannot map " << fileName << ".\n";
+            return false;
+        }
+        base = static_cast<char*>(mapped);
+        mappedBytes = bytes;
+        return true;
+    }
+    // Doubles the capacity. The old mapping stays in place until the new one
+    // exists, so a failure leaves the file as it was.
+    bool grow() {
+        uint64_t capacity = header().capacity * 2;
+        if (!flush()) return false;
+        char* oldBase = base;
+        size_t oldBytes = mappedBytes;
+        if (!mapBytes(HEADER_SIZE + capacity * slotSize)) {
+            if (ftruncate(fd, static_cast<off_t>(oldBytes)) != 0) cout << "Error: cannot resize " << fileName << ".\n";
+            base = oldBase;
+            mappedBytes = oldBytes;
+            return false;
+        }
+        munmap(oldBase, oldBytes);
+        header().capacity = capacity;
+        markDirty(0, HEADER_SIZE);
+        return true;
+    }
+};
+SlotFile<NewPassport, 10> newSlotFile(slotNewFileName, newSlotFields);
+SlotFile<OldPassport, 12> oldSlotFile(slotOldFileName, oldSlotFields);
+
+// Loads the list from its slot file. On the first run (no slot file yet)
+// returns false so the caller loads the CSV files and imports them.
+bool loadNewPassportsSlots() {
+    newSlotFile.close();
+    bool created = false;
+    if (!newSlotFile.open(created)) return false;
+    if (created) return false;
+    freeNewPassportList();
+    newSlotFile.forEachRecord([](NewPassport* record) { appendRecord(record); });
+    return true;
+}
+bool loadOldPassportsSlots() {
+    oldSlotFile.close();
+    bool created = false;
+    if (!oldSlotFile.open(created)) return false;
+    if (created) return false;
+    freeOldPassportList();
+    oldSlotFile.forEachRecord([](OldPassport* record) { appendRecord(record); });
+    return true;
+}
+// A record that cannot be stored stops the program before it runs on a
+// slot file that is missing records; the file is removed, so the next start
+// imports the CSV files again
+void importNewPassportsToSlots() {
+    if (!newSlotFile.isOpen()) return;
+    newSlotFile.clear();
+    bool stored = true;
+    for (NewPassport* temp = newHead; temp != nullptr && stored; temp = temp->next) stored = newSlotFile.insert(temp);
+    if (newSlotFile.flush() && stored) return;
+    newSlotFile.close();
+    remove(slotNewFileName.c_str());
+    damagedDataFiles = true;
+}
+void importOldPassportsToSlots() {
+    if (!oldSlotFile.isOpen()) return;
+    oldSlotFile.clear();
+    bool stored = true;
+    for (OldPassport* temp = oldHead; temp != nullptr && stored; temp = temp->next) stored = oldSlotFile.insert(temp);
+    if (oldSlotFile.flush() && stored) return;
+    oldSlotFile.close();
+    remove(slotOldFileName.c_str());
+    damagedDataFiles = true;
+}
+#else
+// Memory-mapped slot storage needs POSIX mmap; other platforms keep the CSV files
+struct NoSlotFile {
+    bool isOpen() const { return false; }
+    template <typename T> bool insert(const T*) { return false; }
+    template <typename T> bool write(const T*) { return false; }
+    template <typename T> void erase(const T*) {}
+    bool flush() { return true; }
+};
+NoSlotFile newSlotFile, oldSlotFile;
+bool loadNewPassportsSlots() { return false; }
+bool loadOldPassportsSlots() { return false; }
+void importNewPassportsToSlots() {}
+void importOldPassportsToSlots() {}
+#endif
+
+// --- Columnar Store ---
+// Every field that filters well as an integer also lives in a contiguous
+// column: dates as day numbers, money as cents and low-cardinality text as
+// dictionary codes. Rows are kept current by the change hooks (erase swaps
+// the last row into the hole), so range filters and sums run as SIMD kernels
+// over plain arrays instead of chasing list nodes.
+enum ColumnKind { COLUMN_NONE, COLUMN_DAYS, COLUMN_CENTS, COLUMN_CODE };
+template <typename T>
+struct QueryField {
+    const char* name;
+    const char* alias;
+    string T::*text;            // Text field, or nullptr for a numeric one
+    double (*number)(const T*); // Numeric field accessor
+    ColumnKind column;
+};
+template <typename T>
+double paymentAmount(const T* record) { return strtod(record->payment.c_str(), nullptr); }
+double balanceAmount(const OldPassport* record) { return record->balance; }
+const QueryField<NewPassport> newQueryFields[] = {
+    {"type", "passtype", &NewPassport::passType, nullptr, COLUMN_CODE},
+    {"id", "id", &NewPassport::id, nullptr, COLUMN_NONE},
+    {"name", "name", &NewPassport::name, nullptr, COLUMN_NONE},
+    {"dob", "dob", &NewPassport::dob, nullptr, COLUMN_DAYS},
+    {"nationality", "nationality", &NewPassport::nationality, nullptr, COLUMN_CODE},
+    {"phone", "phonenumber", &NewPassport::phoneNumber, nullptr, COLUMN_NONE},
+    {"created", "createddate", &NewPassport::createdDate, nullptr, COLUMN_DAYS},
+    {"appointment", "appointmentdate", &NewPassport::appointmentDate, nullptr, COLUMN_DAYS},
+    {"status", "paymentstatus", &NewPassport::paymentStatus, nullptr, COLUMN_CODE},
+    {"payment", "payment", nullptr, paymentAmount<NewPassport>, COLUMN_CENTS},
+};
+const QueryField<OldPassport> oldQueryFields[] = {
+    {"type", "passtype", &OldPassport::passType, nullptr, COLUMN_CODE},
+    {"id", "id", &OldPassport::id, nullptr, COLUMN_NONE},
+    {"name", "name", &OldPassport::name, nullptr, COLUMN_NONE},
+    {"dob", "dob", &OldPassport::dob, nullptr, COLUMN_DAYS},
+    {"issue", "issuedate", &OldPassport::issueDate, nullptr, COLUMN_DAYS},
+    {"expiry", "expireddate", &OldPassport::expiredDate, nullptr, COLUMN_DAYS},
+    {"passport", "passportnumber", &OldPassport::passportNumber, nullptr, COLUMN_NONE},
+    {"account", "accountnumber", &OldPassport::accountNumber, nullptr, COLUMN_NONE},
+    {"created", "createddate", &OldPassport::createdDate, nullptr, COLUMN_DAYS},
+    {"appointment", "appointmentdate", &OldPassport::appointmentDate, nullptr, COLUMN_DAYS},
+    {"status", "paymentstatus", &OldPassport::paymentStatus, nullptr, COLUMN_CODE},
+    {"payment", "payment", nullptr, paymentAmount<OldPassport>, COLUMN_CENTS},
+    {"balance", "balance", nullptr, balanceAmount, COLUMN_CENTS},
+};
+const size_t NEW_PAYMENT_FIELD = 9, OLD_PAYMENT_FIELD = 11; // Positions of "payment" above
+const int32_t INVALID_DAYS = INT32_MIN; // Column value of a missing, malformed or impossible date
+
+// Scalar kernels; also handle the rows after the last full 64-row word
+template <typename V>
+void filterColumnScalar(const V* values, size_t begin, size_t end, V lo, V hi, bool negate, uint64_t* bits) {
+    for (size_t i = begin; i < end; ++i) {
+        bool inside = values[i] >= lo && values[i] <= hi;
+        if (inside == negate) bits[i >> 6] &= ~(1ull << (i & 63));
+    }
+}
+int64_t sumSelectedScalar(const int64_t* values, size_t begin, size_t end, const uint64_t* bits) {
+    int64_t total = 0;
+    for (size_t i = begin; i < end; ++i) {
+        if (bits[i >> 6] >> (i & 63) & 1) total += values[i];
+    }
+    return total;
+}
+#ifdef HAVE_AVX2_KERNELS
+bool cpuHasAvx2() {
+    static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+    return hasAvx2;
+}
+__attribute__((target("avx2")))
+void filterColumn32Avx2(const int32_t* values, size_t words, int32_t lo, int32_t hi, bool negate, uint64_t* bits) {
+    const __m256i low = _mm256_set1_epi32(lo), high = _mm256_set1_epi32(hi);
+    for (size_t w = 0; w < words; ++w) {
+        uint64_t outside = 0;
+        for (int j = 0; j < 8; ++j) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + w * 64 + j * 8));
+            __m256i out = _mm256_or_si256(_mm256_cmpgt_epi32(low, v), _mm256_cmpgt_epi32(v, high));
+            outside |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(out)))) << (j * 8);
+        }
+        bits[w] &= negate ? outside : ~outside;
+    }
+}
+__attribute__((target("avx2")))
+void filterColumn64Avx2(const int64_t* values, size_t words, int64_t lo, int64_t hi, bool negate, uint64_t* bits) {
+    const __m256i low = _mm256_set1_epi64x(lo), high = _mm256_set1_epi64x(hi);
+    for (size_t w = 0; w < words; ++w) {
+        uint64_t outside = 0;
+        for (int j = 0; j < 16; ++j) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + w * 64 + j * 4));
+            __m256i out = _mm256_or_si256(_mm256_cmpgt_epi64(low, v), _mm256_cmpgt_epi64(v, high));
+            outside |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_pd(_mm256_castsi256_pd(out)))) << (j * 4);
+        }
+        bits[w] &= negate ? outside : ~outside;
+    }
+}
+__attribute__((target("avx2")))
+int64_t sumSelectedAvx2(const int64_t* values, size_t words, const uint64_t* bits) {
+    const __m256i lanes = _mm256_setr_epi64x(1, 2, 4, 8);
+    __m256i total = _mm256_setzero_si256();
+    for (size_t w = 0; w < words; ++w) {
+        uint64_t word = bits[w];
+        if (word == 0) continue;
+        for (int j = 0; j < 16; ++j) {
+            __m256i nibble = _mm256_set1_epi64x(static_cast<int64_t>((word >> (j * 4)) & 15));
+            __m256i selected = _mm256_cmpeq_epi64(_mm256_and_si256(nibble, lanes), lanes);
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + w * 64 + j * 4));
+            total = _mm256_add_epi64(total, _mm256_and_si256(v, selected));
+        }
+    }
+    int64_t parts[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(parts), total);
+    return parts[0] + parts[1] + parts[2] + parts[3];
+}
+#endif
+// Clears the bit of every row whose value is outside [lo, hi], or inside it when negated
+void filterColumn(const int32_t* values, size_t n, int32_t lo, int32_t hi, bool negate, uint64_t* bits) {
+    size_t words = 0;
+#ifdef HAVE_AVX2_KERNELS
+    if (cpuHasAvx2()) {
+        words = n / 64;
+        filterColumn32Avx2(values, words, lo, hi, negate, bits);
+    }
+#endif
+    filterColumnScalar(values, words * 64, n, lo, hi, negate, bits);
+}
+void filterColumn(const int64_t* values, size_t n, int64_t lo, int64_t hi, bool negate, uint64_t* bits) {
+    size_t words = 0;
+#ifdef HAVE_AVX2_KERNELS
+    if (cpuHasAvx2()) {
+        words = n / 64;
+        filterColumn64Avx2(values, words, lo, hi, negate, bits);
+    }
+#endif
+    filterColumnScalar(values, words * 64, n, lo, hi, negate, bits);
+}
+int lowestBit(uint64_t word) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(word);
+#else
+    int bit = 0;
+    while ((word >> bit & 1) == 0) ++bit;
+    return bit;
+#endif
+}
+int64_t sumSelected(const int64_t* values, size_t n, const uint64_t* bits) {
+    size_t words = 0;
+    int64_t total = 0;
+#ifdef HAVE_AVX2_KERNELS
+    if (cpuHasAvx2()) {
+        words = n / 64;
+        total = sumSelectedAvx2(values, words, bits);
+    }
+#endif
+    return total + sumSelectedScalar(values, words * 64, n, bits);
+}
+
+template <typename T>
+class ColumnStore {
+public:
+    struct Column {
+        ColumnKind kind;
+        vector<int32_t> narrow;             // Days and codes
+        vector<int64_t> wide;               // Cents
+        vector<uint64_t> exact;             // Days: bit set where the text is an exact date
+        unordered_map<string, int32_t> codes; // Dictionary of a code column
+    };
+    template <size_t N>
+    explicit ColumnStore(const QueryField<T> (&fields)[N]) : fields(fields), columns(N) {
+        for (size_t f = 0; f < N; ++f) columns[f].kind = fields[f].column;
+    }
+    size_t size() const { return rows.size(); }
+    const T* record(size_t row) const { return rows[row]; }
+    const Column& column(size_t field) const { return columns[field]; }
+    void add(const T* record) {
+        rowOf[record] = static_cast<uint32_t>(rows.size());
+        rows.push_back(record);
+        for (size_t f = 0; f < columns.size(); ++f) {
+            Column& column = columns[f];
+            if (column.kind == COLUMN_CENTS) {
+                column.wide.push_back(llround(fields[f].number(record) * 100));
+            } else if (column.kind == COLUMN_DAYS) {
+                int64_t days;
+                bool exact = exactDateToDays(record->*fields[f].text, days);
+                size_t row = column.narrow.size();
+                if (row % 64 == 0) column.exact.push_back(0);
+                if (exact) column.exact[row >> 6] |= 1ull << (row & 63);
+                column.narrow.push_back(exact ? static_cast<int32_t>(days) : INVALID_DAYS);
+            } else if (column.kind == COLUMN_CODE) {
+                auto code = column.codes.insert({record->*fields[f].text, static_cast<int32_t>(column.codes.size())});
+                column.narrow.push_back(code.first->second);
+            }
+        }
+    }
+    void remove(const T* record) {
+        auto it = rowOf.find(record);
+        if (it == rowOf.end()) return;
+        uint32_t row = it->second, last = static_cast<uint32_t>(rows.size() - 1);
+        rowOf.erase(it);
+        if (row != last) {
+            rows[row] = rows[last];
+            rowOf[rows[row]] = row;
+        }
+        rows.pop_back();
+        for (Column& column : columns) {
+            if (!column.wide.empty()) {
+                column.wide[row] = column.wide[last];
+                column.wide.pop_back();
+            }
+            if (!column.narrow.empty()) {
+                column.narrow[row] = column.narrow[last];
+                column.narrow.pop_back();
+            }
+            if (!column.exact.empty()) {
+                uint64_t lastBit = column.exact[last >> 6] >> (last & 63) & 1;
+                column.exact[row >> 6] = (column.exact[row >> 6] & ~(1ull << (row & 63))) | lastBit << (row & 63);
+                column.exact[last >> 6] &= ~(1ull << (last & 63));
+                if (last % 64 == 0) column.exact.pop_back();
+            }
+        }
+    }
+    void clear() {
+        rows.clear();
+        rowOf.clear();
+        for (Column& column : columns) {
+            column.narrow.clear();
+            column.wide.clear();
+            column.exact.clear();
+        }
+    }
+private:
+    const QueryField<T>* fields;
+    vector<Column> columns; // One per field; COLUMN_NONE ones stay empty
+    vector<const T*> rows;
+    unordered_map<const T*, uint32_t> rowOf;
+};
+ColumnStore<NewPassport> newColumns(newQueryFields);
+ColumnStore<OldPassport> oldColumns(oldQueryFields);
+
+// --- Change Feed ---
+// Every create, update, delete and archive sweep appends one JSON line to
+// changeFeedFileName: a sequence number that keeps growing across restarts,
+// the time, the operation, the list and the record before and after the
+// change (null where there is none). The file is never rewritten, so
+// downstream systems can tail it from a saved checkpoint with
+// --consume-changes NAME instead of diffing the CSV files.
+const string changeFeedFileName = "changes4.log";
+const char* const newPassportColumns[] = {"PassType", "ID", "Name", "DOB", "Nationality", "Phone",
+                                          "CreatedDate", "AppointmentDate", "Payment", "PaymentStatus"};
+const char* const oldPassportColumns[] = {"PassType", "ID", "Name", "DOB", "IssueDate", "ExpiredDate",
+                                          "PassportNumber", "AccountNumber", "Balance", "CreatedDate",
+                                          "AppointmentDate", "Payment", "PaymentStatus"};
+ofstream changeFeed;
+unsigned long long changeFeedSeq = 0;
+bool changeFeedArchiving = false; // Set while a sweep moves records out
+bool applyingRemoteChanges = false; // Set while replaying another instance's events
+
+string jsonString(const string& text) {
+    string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+// Turns a data file line into a JSON object keyed by the file's column names
+template <size_t N>
+string recordJson(const string& line, const char* const (&columns)[N]) {
+    string out = "{";
+    size_t start = 0;
+    for (size_t i = 0; i < N; ++i) {
+        size_t comma = i + 1 < N ? line.find(',', start) : string::npos;
+        out += (i > 0 ? "," : "") + jsonString(columns[i]) + ":" + jsonString(line.substr(start, comma - start));
+        start = comma == string::npos ? line.size() : comma + 1;
+    }
+    return out + "}";
+}
+// Sequence number of the last complete event in the feed, 0 if there is none
+unsigned long long lastChangeSeq() {
+    ifstream in(changeFeedFileName, ios::binary);
+    if (!in) return 0;
+    in.seekg(0, ios::end);
+    streamoff size = in.tellg();
+    streamoff start = max<streamoff>(0, size - 65536);
+    string tail(static_cast<size_t>(size - start), '\0');
+    in.seekg(start);
+    in.read(&tail[0], static_cast<streamsize>(tail.size()));
+    size_t end = tail.rfind('\n'); // Anything after it is a line cut short
+    if (end == string::npos) return 0;
+    size_t lineStart = end == 0 ? string::npos : tail.rfind('\n', end - 1);
+    lineStart = lineStart == string::npos ? 0 : lineStart + 1;
+    size_t seqPos = tail.find("\"seq\":", lineStart);
+    return seqPos == string::npos || seqPos > end ? 0 : strtoull(tail.c_str() + seqPos + 6, nullptr, 10);
+}
+bool openChangeFeed() {
+    changeFeedSeq = lastChangeSeq();
+    struct stat info;
+    bool cutShort = false;
+    if (stat(changeFeedFileName.c_str(), &info) == 0 && info.st_size > 0) {
+        ifstream in(changeFeedFileName, ios::binary);
+        in.seekg(-1, ios::end);
+        cutShort = in.get() != '\n';
+    }
+    changeFeed.open(changeFeedFileName, ios::binary | ios::app);
+    if (!changeFeed) {
+        cout << "Error opening file " << changeFeedFileName << " for writing!\n";
+        return false;
+    }
+    if (cutShort) changeFeed << "\n"; // Keep the next event on a line of its own
+    return true;
+}
+void publishChange(const char* op, const char* list, const string& id, const string& before, const string& after) {
+    if (!changeFeed.is_open() || applyingRemoteChanges) return;
+    time_t now = time(nullptr);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+    if (changeFeedArchiving && strcmp(op, "delete") == 0) op = "archive";
+    changeFeed << "{\"seq\":" << ++changeFeedSeq << ",\"time\":\"" << stamp << "\",\"op\":\"" << op
+               << "\",\"list\":\"" << list << "\",\"id\":" << jsonString(id) << ",\"before\":"
+               << (before.empty() ? "null" : before) << ",\"after\":" << (after.empty() ? "null" : after) << "}\n";
+    changeFeed.flush(); // Consumers only read complete lines
+}
+void publishNewPassportChange(const char* op, const NewPassport* before, const NewPassport* after) {
+    if (!changeFeed.is_open()) return;
+    publishChange(op, "new", (after != nullptr ? after : before)->id,
+                  before != nullptr ? recordJson(formatNewPassportLine(before), newPassportColumns) : "",
+                  after != nullptr ? recordJson(formatNewPassportLine(after), newPassportColumns) : "");
+}
+void publishOldPassportChange(const char* op, const OldPassport* before, const OldPassport* after) {
+    if (!changeFeed.is_open()) return;
+    publishChange(op, "old", (after != nullptr ? after : before)->id,
+                  before != nullptr ? recordJson(formatOldPassportLine(before), oldPassportColumns) : "",
+                  after != nullptr ? recordJson(formatOldPassportLine(after), oldPassportColumns) : "");
+}
+// Prints the events after consumer `name`'s checkpoint and moves the
+// checkpoint past them. With `follow`, keeps polling for new events.
+void consumeChanges(const string& name, bool follow) {
+    string checkpointFile = "changes4." + name + ".checkpoint";
+    unsigned long long checkpointSeq = 0;
+    streamoff offset = 0;
+    {
+        ifstream in(checkpointFile);
+        in >> checkpointSeq >> offset;
+    }
+    do {
+        ifstream in(changeFeedFileName, ios::binary);
+        in.seekg(0, ios::end);
+        if (in && in.tellg() < offset) offset = 0; // The feed was replaced: rescan, skipping by sequence
+        in.seekg(offset);
+        string line;
+        bool advanced = false;
+        while (in && getline(in, line) && !in.eof()) { // A line without newline is still being written
+            offset = in.tellg();
+            size_t seqPos = line.find("\"seq\":");
+            unsigned long long seq = seqPos == string::npos ? 0 : strtoull(line.c_str() + seqPos + 6, nullptr, 10);
+            if (seq <= checkpointSeq) continue;
+            cout << line << "\n";
+            checkpointSeq = seq;
+            advanced = true;
+        }
+        if (advanced) {
+            cout.flush();
+            ofstream out(checkpointFile + ".tmp", ios::trunc);
+            out << checkpointSeq << " " << offset << "\n";
+            out.close();
+            rename((checkpointFile + ".tmp").c_str(), checkpointFile.c_str());
+        }
+        if (follow) this_thread::sleep_for(chrono::milliseconds(200));
+    } while (follow);
+}
+
+// --- Record Change Hooks ---
+// Every code path that adds, changes or removes a record reports it here so
+// the secondary structures and the storage stay in sync with the lists.
+// `keys` is the record as it was when indexed (differs from it on update).
+void indexNewPassport(NewPassport* record) {
+    newIdIndex.add(record);
+    newByName.insert(record);
+    newByType.insert(record);
+    newNameIndex.add(record);
+    newApplicants.add(record);
+    newColumns.add(record);
+    adjustNewReport(record, 1);
+}
+void unindexNewPassport(const NewPassport* record, const NewPassport* keys) {
+    newIdIndex.remove(keys->id, record);
+    newByName.erase(newByName.key(keys));
+    newByType.erase(newByType.key(keys));
+    newNameIndex.remove(record);
+    newApplicants.remove(keys, record);
+    newColumns.remove(record);
+    adjustNewReport(keys, -1);
+}
+void indexOldPassport(OldPassport* record) {
+    oldIdIndex.add(record);
+    oldByName.insert(record);
+    oldByType.insert(record);
+    oldNameIndex.add(record);
+    oldApplicants.add(record);
+    oldColumns.add(record);
+    adjustOldReport(record, 1);
+}
+void unindexOldPassport(const OldPassport* record, const OldPassport* keys) {
+    oldIdIndex.remove(keys->id, record);
+    oldByName.erase(oldByName.key(keys));
+    oldByType.erase(oldByType.key(keys));
+    oldNameIndex.remove(record);
+    oldApplicants.remove(keys, record);
+    oldColumns.remove(record);
+    adjustOldReport(keys, -1);
+}
+void onNewPassportInserted(NewPassport* record) {
+    logNewPassportChange('I', "", record);
+    publishNewPassportChange("insert", nullptr, record);
+    newVersions.reordered();
+    indexNewPassport(record);
+    bloomAdd(record->id);
+    if (slotStorageMode) newSlotFile.insert(record);
+}
+void onNewPassportUpdated(const NewPassport& before, NewPassport* record) {
+    logNewPassportChange('U', before.id, record);
+    publishNewPassportChange("update", &before, record);
+    newVersions.updated(before, record);
+    unindexNewPassport(record, &before);
+    indexNewPassport(record);
+    bloomAdd(record->id); // Old keys stay set; they only cost a false positive
+    if (slotStorageMode) newSlotFile.write(record);
+}
+void onNewPassportErased(const NewPassport* record) {
+    logNewPassportChange('D', record->id, nullptr);
+    publishNewPassportChange("delete", record, nullptr);
+    newVersions.preserve(record); // Freed next
+    newVersions.reordered();
+    unindexNewPassport(record, record);
+    if (slotStorageMode) newSlotFile.erase(record);
+}
+void onOldPassportInserted(OldPassport* record) {
+    logOldPassportChange('I', "", record);
+    publishOldPassportChange("insert", nullptr, record);
+    oldVersions.reordered();
+    indexOldPassport(record);
+    bloomAdd(record->id, record->passportNumber);
+    if (slotStorageMode) oldSlotFile.insert(record);
+}
+void onOldPassportUpdated(const OldPassport& before, OldPassport* record) {
+    logOldPassportChange('U', before.id, record);
+    publishOldPassportChange("update", &before, record);
+    oldVersions.updated(before, record);
+    unindexOldPassport(record, &before);
+    indexOldPassport(record);
+    bloomAdd(record->id, record->passportNumber);
+    if (slotStorageMode) oldSlotFile.write(record);
+}
+void onOldPassportErased(const OldPassport* record) {
+    logOldPassportChange('D', record->id, nullptr);
+    publishOldPassportChange("delete", record, nullptr);
+    oldVersions.preserve(record); // Freed next
+    oldVersions.reordered();
+    unindexOldPassport(record, record);
+    if (slotStorageMode) oldSlotFile.erase(record);
+}
+// Called after the list was replaced or reordered as a whole (load, sort)
+void rebuildNewPassportIndexes() {
+    newVersions.reordered();
+    newIdIndex.clear();
+    newNameIndex.clear();
+    newApplicants.clear();
+    newColumns.clear();
+    newReport = PassportReport();
+    newByName.clear();
+    newByType.clear();
+    for (NewPassport* temp = newHead; temp != nullptr; temp = temp->next) indexNewPassport(temp);
+    relinkNewPassports(); // Restore the saved sort order
+}
+void rebuildOldPassportIndexes() {
+    oldVersions.reordered();
+    oldIdIndex.clear();
+    oldNameIndex.clear();
+    oldApplicants.clear();
+    oldColumns.clear();
+    oldReport = PassportReport();
+    oldByName.clear();
+    oldByType.clear();
+    for (OldPassport* temp = oldHead; temp != nullptr; temp = temp->next) indexOldPassport(temp);
+    relinkOldPassports(); // Restore the saved sort order
+}
+
+string getFileNameForPassType(const string& passType) {
+    if (passType == "Regular") return regularFileName;
+    if (passType == "Urgent") return urgentFileName;
+    if (passType == "ExpiredRegular") return expiredRegularFileName;
+    if (passType == "ExpiredUrgent") return expiredUrgentFileName;
+    return "";
+}
+
+RecordWriter saveBuffers[2]; // One per data file of a list, reused by every save
+bool writeRecordFile(const string& fileName, const RecordWriter& buffer) {
+    ofstream out(fileName, ios::binary | ios::trunc);
+    if (!out || !out.write(buffer.data(), static_cast<streamsize>(buffer.size()))) {
+        cout << "Error opening file " << fileName << " for writing!\n";
+        return false;
+    }
+    return true;
+}
+// Writes saveBuffers to the two data files of a list through tmp files;
+// recording the checksums commits them (see finishInterruptedSave)
+void writeRecordFiles(const string& firstFileName, const string& secondFileName) {
+    vector<pair<string, string_view>> written;
+    const string* fileNames[] = {&firstFileName, &secondFileName};
+    for (int f = 0; f < 2; ++f) {
+        if (writeRecordFile(*fileNames[f] + ".tmp", saveBuffers[f])) {
+            written.push_back({*fileNames[f], string_view(saveBuffers[f].data(), saveBuffers[f].size())});
+        }
+    }
+    if (written.empty()) return;
+    recordChecksums(written);
+    for (const auto& file : written) {
+        if (rename((file.first + ".tmp").c_str(), file.first.c_str()) != 0) {
+            cout << "Error writing file " << file.first << "!\n";
+        }
+    }
+}
+void saveNewPassportsToFile() {
+    if (slotStorageMode) {
+        // Records were written to their slots by the change hooks; the Bloom
+        // filters are refreshed at the next startup instead of on every save
+        newSlotFile.flush();
+        return;
+    }
+    if (compactStorageMode) {
+        saveNewPassportsCompact();
+        refreshBloomFilters();
+        return;
+    }
+    mergeOutsideChangesBeforeSave(regularFileName);
+    mergeOutsideChangesBeforeSave(urgentFileName);
+    // Both files are built in memory and each written with a single call
+    RecordWriter& regular = saveBuffers[0].clear();
+    RecordWriter& urgent = saveBuffers[1].clear();
+    appendCsvHeader<NewPassport>(regular).put('\n');
+    appendCsvHeader<NewPassport>(urgent).put('\n');
+    for (NewPassport* temp = newHead; temp != nullptr; temp = temp->next) {
+        appendCsvLine(temp->passType == "Urgent" ? urgent : regular, temp).put('\n');
+    }
+    writeRecordFiles(regularFileName, urgentFileName);
+    refreshBloomFilters();
+}
+void saveOldPassportsToFile() {
+    if (slotStorageMode) {
+        oldSlotFile.flush();
+        return;
+    }
+    if (compactStorageMode) {
+        saveOldPassportsCompact();
+        refreshBloomFilters();
+        return;
+    }
+    mergeOutsideChangesBeforeSave(expiredRegularFileName);
+    mergeOutsideChangesBeforeSave(expiredUrgentFileName);
+    RecordWriter& expiredRegular = saveBuffers[0].clear();
+    RecordWriter& expiredUrgent = saveBuffers[1].clear();
+    appendCsvHeader<OldPassport>(expiredRegular).put('\n');
+    appendCsvHeader<OldPassport>(expiredUrgent).put('\n');
+    for (OldPassport* temp = oldHead; temp != nullptr; temp = temp->next) {
+        appendCsvLine(temp->passType == "ExpiredUrgent" ? expiredUrgent : expiredRegular, temp).put('\n');
+    }
+    writeRecordFiles(expiredRegularFileName, expiredUrgentFileName);
+    refreshBloomFilters();
+}
+string formatNewPassportLine(const NewPassport* temp) {
+    static thread_local RecordWriter line;
+    appendCsvLine(line.clear(), temp);
+    return string(line.data(), line.size());
+}
+string formatOldPassportLine(const OldPassport* temp) {
+    static thread_local RecordWriter line;
+    appendCsvLine(line.clear(), temp);
+    return string(line.data(), line.size());
+}
+// The loaders are called with storeMutex held
+void loadNewPassportsFromFile() {
+    if (slotStorageMode && loadNewPassportsSlots()) {
+        rebuildNewPassportIndexes();
+        return;
+    }
+    if (compactStorageMode && loadNewPassportsCompact()) { // Falls back to CSV on first run
+        rebuildNewPassportIndexes();
+        return;
+    }
+freeNewPassportList(); 
+    // Each file is read once: checksums are computed over the buffer the
+    // records are then parsed from
+    string fileNames[] = {regularFileName, urgentFileName};
+    string contents, line;
+    for (const string& fileName : fileNames) {
+        finishInterruptedSave(fileName);
+        if (!readWholeFile(fileName, contents)) continue;
+        // Rows appended outside are merged by mergeOutsideChanges, except on
+        // the first run in compact or slot mode, which imports the file as it is
+        size_t savedSize = contents.size();
+        if (!verifyChecksums(fileName, contents, compactStorageMode || slotStorageMode ? nullptr : &savedSize)) {
+            damagedDataFiles = true;
+            continue;
+        }
+        contents.resize(savedSize);
+        for (size_t pos = min(contents.find('\n'), contents.size()) + 1; pos < contents.size();) { // Skip the header
+            size_t end = min(contents.find('\n', pos), contents.size());
+            line.assign(contents, pos, end - pos);
+            pos = end + 1;
+            NewPassport* record = newPool.allocate();
+            if (!parseCsvLine(line, record)) {
+                newPool.release(record);
+                continue;
+            }
+            appendRecord(record); // Add to the end of the list
+        }
+    }
+    rebuildNewPassportIndexes();
+    if (slotStorageMode) importNewPassportsToSlots(); // First run in slot mode
+}
+void loadOldPassportsFromFile() {
+    if (slotStorageMode && loadOldPassportsSlots()) {
+        rebuildOldPassportIndexes();
+        return;
+    }
+    if (compactStorageMode && loadOldPassportsCompact()) { // Falls back to CSV on first run
+        rebuildOldPassportIndexes();
+        return;
+    }
+ freeOldPassportList(); // Clear existing list before loading
+    // Each file is read once: checksums are computed over the buffer the
+    // records are then parsed from
+    string fileNames[] = {expiredRegularFileName, expiredUrgentFileName};
+    string contents, line;
+    for (const string& fileName : fileNames) {
+        finishInterruptedSave(fileName);
+        if (!readWholeFile(fileName, contents)) continue; // File might not exist yet
+        // Rows appended outside are merged by mergeOutsideChanges, except on
+        // the first run in compact or slot mode, which imports the file as it is
+        size_t savedSize = contents.size();
+        if (!verifyChecksums(fileName, contents, compactStorageMode || slotStorageMode ? nullptr : &savedSize)) {
+            damagedDataFiles = true;
+            continue;
+        }
+        contents.resize(savedSize);
+        for (size_t pos = min(contents.find('\n'), contents.size()) + 1; pos < contents.size();) { // Skip the header
+            size_t end = min(contents.find('\n', pos), contents.size());
+            line.assign(contents, pos, end - pos);
+            pos = end + 1;
+            OldPassport* record = oldPool.allocate();
+            if (!parseCsvLine(line, record)) {
+                oldPool.release(record);
+                continue;
+            }
+            appendRecord(record); // Add to the end of the list
+        }
+    }
+    rebuildOldPassportIndexes();
+    if (slotStorageMode) importOldPassportsToSlots(); // First run in slot mode
+}
+// --- Log-Shipping Replication ---
+// A primary (--replicate) appends every change to replicationLogFileName in
+// its directory. On startup it rewrites the log as a new epoch that starts
+// with the full lists, so a follower can always rebuild from the log alone.
+// Line format: E,<epoch> once, then <seq>,<op>,<N|O>,<key>,<record line>
+// where op is I (insert), U (update, key = ID before), D (delete, key = ID),
+// S (sort, key = order) and B (end of the base records).
+// A follower (--follow DIR) tails the primary's log from a background thread,
+// applies complete lines through the change hooks and saves its copy in its
+// own directory. It serves searches, displays and reports only.
+const string replicationLogFileName = "replication4.log";
+const int REPLICATION_POLL_MS = 100;
+ofstream replicationLog;
+unsigned long long replicationSeq = 0;
+string followDirectory;
+atomic<bool> followerRunning(false);
+atomic<unsigned long long> replicaAppliedSeq(0);
+
+void writeReplicationLine(char op, char kind, const string& key, const string& line) {
+    if (!replicationLog.is_open()) return;
+    replicationLog << (op == 'B' || replicationSeq == 0 ? 0 : replicationSeq) << "," << op << "," << kind << ","
+                   << key << "," << line << "\n";
+    replicationLog.flush(); // Followers only apply complete lines
+}
+void logNewPassportChange(char op, const string& key, const NewPassport* record) {
+    if (!replicationLog.is_open()) return;
+    ++replicationSeq;
+    writeReplicationLine(op, 'N', key, record != nullptr ? formatNewPassportLine(record) : "");
+}
+void logOldPassportChange(char op, const string& key, const OldPassport* record) {
+    if (!replicationLog.is_open()) return;
+    ++replicationSeq;
+    writeReplicationLine(op, 'O', key, record != nullptr ? formatOldPassportLine(record) : "");
+}
+// Starts a new epoch with the current lists as its base
+bool startReplicationLog() {
+    replicationLog.open(replicationLogFileName, ios::trunc);
+    if (!replicationLog) {
+        cout << "Error opening file " << replicationLogFileName << " for writing!\n";
+        return false;
+    }
+    replicationLog << "E," << chrono::system_clock::now().time_since_epoch().count() << "\n";
+    replicationSeq = 0;
+    for (NewPassport* temp = newHead; temp != nullptr; temp = temp->next) {
+        writeReplicationLine('I', 'N', "", formatNewPassportLine(temp));
+    }
+    for (OldPassport* temp = oldHead; temp != nullptr; temp = temp->next) {
+        writeReplicationLine('I', 'O', "", formatOldPassportLine(temp));
+    }
+    writeReplicationLine('S', 'N', to_string(newSortOrder), "");
+    writeReplicationLine('S', 'O', to_string(oldSortOrder), "");
+    writeReplicationLine('B', 'N', "", "");
+    return true;
+}
+struct ReplicationEntry {
+    unsigned long long seq;
+    char op, kind;
+    string key, line;
+};
+bool parseReplicationEntry(const string& text, ReplicationEntry& entry) {
+    size_t fields[4];
+    size_t pos = 0;
+    for (size_t& comma : fields) {
+        comma = text.find(',', pos);
+        if (comma == string::npos) return false;
+        pos = comma + 1;
+    }
+    entry.seq = strtoull(text.c_str(), nullptr, 10);
+    entry.op = text[fields[0] + 1];
+    entry.kind = text[fields[1] + 1];
+    entry.key = text.substr(fields[2] + 1, fields[3] - fields[2] - 1);
+    entry.line = text.substr(fields[3] + 1);
+    return true;
+}
+// Applies one change after the base; called with storeMutex held
+void applyReplicationEntry(const ReplicationEntry& entry) {
+    if (entry.kind == 'N') {
+        if (entry.op == 'I') {
+            NewPassport* newPass = newPool.allocate();
+            if (!parseCsvLine(entry.line, newPass)) {
+                newPool.release(newPass);
+                return;
+            }
+            linkNewPassport(newPass);
+            onNewPassportInserted(newPass);
+        } else if (entry.op == 'U') {
+            NewPassport* current = newIdIndex.find(entry.key);
+            if (current == nullptr) return;
+            NewPassport before = beginRecordChange(current);
+            parseCsvLine(entry.line, current);
+            current->next = before.next;
+            repositionNewPassport(current);
+            onNewPassportUpdated(before, current);
+        } else if (entry.op == 'D') {
+            NewPassport* current = newIdIndex.find(entry.key);
+            if (current == nullptr) return;
+            onNewPassportErased(current);
+            eraseRecord(current);
+        } else if (entry.op == 'S') {
+            newSortOrder = atoi(entry.key.c_str());
+            relinkNewPassports();
+        }
+    } else {
+        if (entry.op == 'I') {
+            OldPassport* oldPass = oldPool.allocate();
+            if (!parseCsvLine(entry.line, oldPass)) {
+                oldPool.release(oldPass);
+                return;
+            }
+            linkOldPassport(oldPass);
+            onOldPassportInserted(oldPass);
+        } else if (entry.op == 'U') {
+            OldPassport* current = oldIdIndex.find(entry.key);
+            if (current == nullptr) return;
+            OldPassport before = beginRecordChange(current);
+            parseCsvLine(entry.line, current);
+            current->next = before.next;
+            repositionOldPassport(current);
+            onOldPassportUpdated(before, current);
+        } else if (entry.op == 'D') {
+            OldPassport* current = oldIdIndex.find(entry.key);
+            if (current == nullptr) return;
+            onOldPassportErased(current);
+            eraseRecord(current);
+        } else if (entry.op == 'S') {
+            oldSortOrder = atoi(entry.key.c_str());
+            relinkOldPassports();
+        }
+    }
+}
+// Replaces both lists with the base records of a new epoch
+void applyReplicationBase(const vector<ReplicationEntry>& base) {
+    freeNewPassportList();
+    freeOldPassportList();
+    for (const ReplicationEntry& entry : base) {
+        if (entry.op == 'S') {
+            (entry.kind == 'N' ? newSortOrder : oldSortOrder) = atoi(entry.key.c_str());
+        } else if (entry.kind == 'N') {
+            NewPassport* newPass = newPool.allocate();
+            if (!parseCsvLine(entry.line, newPass)) {
+                newPool.release(newPass);
+                continue;
+            }
+            appendRecord(newPass);
+        } else {
+            OldPassport* oldPass = oldPool.allocate();
+            if (!parseCsvLine(entry.line, oldPass)) {
+                oldPool.release(oldPass);
+                continue;
+            }
+            appendRecord(oldPass);
+        }
+    }
+    rebuildNewPassportIndexes();
+    rebuildOldPassportIndexes();
+}
+// Reads the complete lines added to the primary's log since the last poll
+void pollReplicationLog(string& epoch, streamoff& offset, bool& baseApplied) {
+    ifstream in(followDirectory + "/" + replicationLogFileName);
+    string header;
+    if (!in || !getline(in, header) || in.eof() || header.compare(0, 2, "E,") != 0) return;
+    if (header != epoch) { // The primary restarted: rebuild from the new base
+        epoch = header;
+        offset = in.tellg();
+        baseApplied = false;
+    }
+    in.seekg(offset);
+    vector<ReplicationEntry> entries;
+    vector<ReplicationEntry> base;
+    string text;
+    streamoff consumed = offset;
+    while (getline(in, text) && !in.eof()) { // A line without newline is still being written
+        ReplicationEntry entry;
+        if (!parseReplicationEntry(text, entry)) break;
+        consumed = in.tellg();
+        if (!baseApplied) {
+            if (entry.op == 'B') {
+                lock_guard<mutex> writeLock(storeMutex);
+                applyReplicationBase(base);
+                saveSortOrder();
+                saveNewPassportsToFile();
+                saveOldPassportsToFile();
+                baseApplied = true;
+                offset = consumed;
+            } else {
+                base.push_back(entry);
+            }
+            continue;
+        }
+        entries.push_back(entry);
+    }
+    if (!baseApplied || entries.empty()) return;
+    lock_guard<mutex> writeLock(storeMutex);
+    bool newChanged = false, oldChanged = false;
+    for (const ReplicationEntry& entry : entries) {
+        applyReplicationEntry(entry);
+        (entry.kind == 'N' ? newChanged : oldChanged) = true;
+        replicaAppliedSeq = entry.seq;
+    }
+    if (newChanged) saveNewPassportsToFile();
+    if (oldChanged) saveOldPassportsToFile();
+    saveSortOrder();
+    offset = consumed;
+}
+void followPrimary() {
+    string epoch;
+    streamoff offset = 0;
+    bool baseApplied = false;
+    while (followerRunning) {
+        pollReplicationLog(epoch, offset, baseApplied);
+        this_thread::sleep_for(chrono::milliseconds(REPLICATION_POLL_MS));
+    }
+}
+// --- Compact Storage Format ---
+// File layout: "PMS2", kind byte, then blocks of up to COMPACT_BLOCK_ROWS rows.
+// Each block is [rows][raw size][compressed size][crc][payload], where crc is
+// the CRC32C of the first three header fields and the payload, and stores
+// its rows column by column: low-cardinality columns as per-block dictionary
+// codes, dates as day deltas from the previous row, money as integer cents.
+// The column bytes are then compressed with lzCompress.
+const size_t COMPACT_BLOCK_ROWS = 4096;
+enum ColumnCoding { DictColumn, DateColumn, PlainColumn };
+template <typename T>
+struct CompactColumn {
+    string T::*field;
+    ColumnCoding coding;
+};
+const CompactColumn<NewPassport> newCompactColumns[] = {
+    {&NewPassport::passType, DictColumn}, {&NewPassport::id, PlainColumn},
+    {&NewPassport::name, PlainColumn}, {&NewPassport::dob, DateColumn},
+    {&NewPassport::nationality, DictColumn}, {&NewPassport::phoneNumber, PlainColumn},
+    {&NewPassport::createdDate, DateColumn}, {&NewPassport::appointmentDate, DateColumn},
+    {&NewPassport::payment, DictColumn}, {&NewPassport::paymentStatus, DictColumn},
+};
+const CompactColumn<OldPassport> oldCompactColumns[] = {
+    {&OldPassport::passType, DictColumn}, {&OldPassport::id, PlainColumn},
+    {&OldPassport::name, PlainColumn}, {&OldPassport::dob, DateColumn},
+    {&OldPassport::issueDate, DateColumn}, {&OldPassport::expiredDate, DateColumn},
+    {&OldPassport::passportNumber, PlainColumn}, {&OldPassport::accountNumber, PlainColumn},
+    {&OldPassport::createdDate, DateColumn}, {&OldPassport::appointmentDate, DateColumn},
+    {&OldPassport::payment, DictColumn}, {&OldPassport::paymentStatus, DictColumn},
+};
+
+struct ByteReader {
+    const unsigned char* pos;
+    const unsigned char* end;
+    bool ok;
+    ByteReader(const char* data, size_t size)
+        : pos(reinterpret_cast<const unsigned char*>(data)), end(pos + size), ok(true) {}
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (pos >= end) { ok = false; return 0; }
+            unsigned char b = *pos++;
+            value |= static_cast<uint64_t>(b & 0x7F) << shift;
+            if ((b & 0x80) == 0) return value;
+        }
+        ok = false;
+        return 0;
+    }
+    void bytes(string& out, size_t len) {
+        if (static_cast<size_t>(end - pos) < len) { ok = false; return; }
+        out.assign(reinterpret_cast<const char*>(pos), len);
+        pos += len;
+    }
+    uint32_t u32() {
+        if (end - pos < 4) { ok = false; return 0; }
+        uint32_t value = pos[0] | (pos[1] << 8) | (pos[2] << 16) | (static_cast<uint32_t>(pos[3]) << 24);
+        pos += 4;
+        return value;
+    }
+};
+void putVarint(string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+void putU32(string& out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+}
+uint64_t zigzag(int64_t value) { return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63); }
+int64_t unzigzag(uint64_t value) { return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1); }
+
+// Days since 1970-01-01 for a YYYY-MM-DD string (civil calendar arithmetic)
+bool dateToDays(const string& date, int64_t& days) {
+    if (date.size() != 10 || date[4] != '-' || date[7] != '-') return false;
+    for (int i : {0, 1, 2, 3, 5, 6, 8, 9}) {
+        if (date[i] < '0' || date[i] > '9') return false;
+    }
+    int64_t y = (date[0] - '0') * 1000 + (date[1] - '0') * 100 + (date[2] - '0') * 10 + (date[3] - '0');
+    unsigned m = (date[5] - '0') * 10 + (date[6] - '0');
+    unsigned d = (date[8] - '0') * 10 + (date[9] - '0');
+    if (m < 1 || m > 12 || d < 1 || d > 31) return false;
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    unsigned yoe = static_cast<unsigned>(y - era * 400);
+    unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    days = era * 146097 + static_cast<int64_t>(doe) - 719468;
+    return true;
+}
+string daysToDate(int64_t days) {
+    days += 719468;
+    int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    unsigned doe = static_cast<unsigned>(days - era * 146097);
+    unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int64_t y = static_cast<int64_t>(yoe) + era * 400;
+    unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    unsigned mp = (5 * doy + 2) / 153;
+    unsigned d = doy - (153 * mp + 2) / 5 + 1;
+    unsigned m = mp < 10 ? mp + 3 : mp - 9;
+    y += m <= 2;
+    char buf[11] = {
+        static_cast<char>('0' + y / 1000 % 10), static_cast<char>('0' + y / 100 % 10),
+        static_cast<char>('0' + y / 10 % 10), static_cast<char>('0' + y % 10), '-',
+        static_cast<char>('0' + m / 10), static_cast<char>('0' + m % 10), '-',
+        static_cast<char>('0' + d / 10), static_cast<char>('0' + d % 10), '\0'};
+    return string(buf, 10);
+}
+// dateToDays for text that reads back unchanged, so comparing the days
+// agrees with comparing the text; "2024-02-31" is not one
+bool exactDateToDays(const string& date, int64_t& days) {
+    return dateToDays(date, days) && daysToDate(days) == date;
+}
+
+// Small LZ77 codec in the spirit of LZ4: each sequence is a token byte
+// (literal length nibble, match length nibble), the literals, a 16-bit
+// back-reference offset and the match. The last sequence carries literals only.
+void putLzLength(string& out, size_t len) {
+    while (len >= 255) {
+        out.push_back(static_cast<char>(255));
+        len -= 255;
+    }
+    out.push_back(static_cast<char>(len));
+}
+void lzCompress(const string& in, string& out) {
+    const size_t MIN_MATCH = 4;
+    const unsigned char* src = reinterpret_cast<const unsigned char*>(in.data());
+    size_t n = in.size(), anchor = 0, i = 0;
+    vector<int64_t> table(1 << 14, -1);
+    while (i + MIN_MATCH <= n) {
+        uint32_t seq;
+        memcpy(&seq, src + i, 4);
+        uint32_t h = (seq * 2654435761u) >> 18;
+        int64_t candidate = table[h];
+        table[h] = static_cast<int64_t>(i);
+        if (candidate < 0 || i - candidate > 65535 || memcmp(src + candidate, src + i, MIN_MATCH) != 0) {
+            ++i;
+            continue;
+        }
+        size_t matchLen = MIN_MATCH;
+        while (i + matchLen < n && src[candidate + matchLen] == src[i + matchLen]) ++matchLen;
+        size_t litLen = i - anchor;
+        size_t extra = matchLen - MIN_MATCH;
+        out.push_back(static_cast<char>(((litLen < 15 ? litLen : 15) << 4) | (extra < 15 ? extra : 15)));
+        if (litLen >= 15) putLzLength(out, litLen - 15);
+        out.append(in, anchor, litLen);
+        size_t offset = i - candidate;
+        out.push_back(static_cast<char>(offset & 0xFF));
+        out.push_back(static_cast<char>(offset >> 8));
+        if (extra >= 15) putLzLength(out, extra - 15);
+        i += matchLen;
+        anchor = i;
+    }
+    size_t litLen = n - anchor;
+    out.push_back(static_cast<char>((litLen < 15 ? litLen : 15) << 4));
+    if (litLen >= 15) putLzLength(out, litLen - 15);
+    out.append(in, anchor, litLen);
+}
+bool lzDecompress(const char* data, size_t size, size_t rawSize, string& out) {
+    const unsigned char* ip = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* end = ip + size;
+    out.clear();
+    out.reserve(rawSize);
+    auto readLength = [&](size_t len) -> size_t {
+        if (len != 15) return len;
+        unsigned char b;
+        do {
+            if (ip >= end) return SIZE_MAX;
+            b = *ip++;
+            len += b;
+        } while (b == 255);
+        return len;
+    };
+    while (ip < end) {
+        unsigned char token = *ip++;
+        size_t litLen = readLength(token >> 4);
+        if (litLen == SIZE_MAX || static_cast<size_t>(end - ip) < litLen) return false;
+        out.append(reinterpret_cast<const char*>(ip), litLen);
+        ip += litLen;
+        if (ip == end) break; // Last sequence has no match
+        if (end - ip < 2) return false;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        size_t matchLen = readLength(token & 15);
+        if (matchLen == SIZE_MAX || offset == 0 || offset > out.size()) return false;
+        matchLen += 4;
+        if (out.size() + matchLen > rawSize) return false;
+        size_t from = out.size() - offset;
+        for (size_t k = 0; k < matchLen; ++k) out.push_back(out[from + k]); // May overlap
+    }
+    return out.size() == rawSize;
+}
+
+void encodeColumn(string& out, const vector<const string*>& values, ColumnCoding coding) {
+    if (coding == DictColumn) {
+        unordered_map<string, uint64_t> codes;
+        vector<const string*> dictionary;
+        string codeBytes;
+        for (const string* value : values) {
+            auto it = codes.find(*value);
+            if (it == codes.end()) {
+                it = codes.emplace(*value, dictionary.size()).first;
+                dictionary.push_back(value);
+            }
+            putVarint(codeBytes, it->second);
+        }
+        putVarint(out, dictionary.size());
+        for (const string* entry : dictionary) {
+            putVarint(out, entry->size());
+            out += *entry;
+        }
+        out += codeBytes;
+    } else if (coding == DateColumn) {
+        int64_t previous = 0;
+        for (const string* value : values) {
+            int64_t days;
+            // Only a date that decodes to the same text is delta encoded;
+            // "2024-02-31" would come back as 2024-03-02
+            if (exactDateToDays(*value, days)) {
+                putVarint(out, zigzag(days - previous) << 1);
+                previous = days;
+            } else { // Not a date, keep the raw text
+                putVarint(out, (static_cast<uint64_t>(value->size()) << 1) | 1);
+                out += *value;
+            }
+        }
+    } else {
+        for (const string* value : values) {
+            putVarint(out, value->size());
+            out += *value;
+        }
+    }
+}
+void decodeColumn(ByteReader& in, const vector<string*>& values, ColumnCoding coding) {
+    if (coding == DictColumn) {
+        uint64_t dictSize = in.varint();
+        if (!in.ok || dictSize > values.size()) { in.ok = false; return; }
+        vector<string> dictionary(dictSize);
+        for (string& entry : dictionary) in.bytes(entry, in.varint());
+        for (string* value : values) {
+            uint64_t code = in.varint();
+            if (!in.ok || code >= dictSize) { in.ok = false; return; }
+            *value = dictionary[code];
+        }
+    } else if (coding == DateColumn) {
+        int64_t previous = 0;
+        for (string* value : values) {
+            uint64_t v = in.varint();
+            if (v & 1) {
+                in.bytes(*value, v >> 1);
+            } else {
+                previous += unzigzag(v >> 1);
+                *value = daysToDate(previous);
+            }
+        }
+    } else {
+        for (string* value : values) in.bytes(*value, in.varint());
+    }
+}
+template <typename T, size_t N>
+void encodeBlock(string& raw, const vector<T*>& rows, const CompactColumn<T> (&columns)[N]) {
+    vector<const string*> values(rows.size());
+    for (const CompactColumn<T>& column : columns) {
+        for (size_t r = 0; r < rows.size(); ++r) values[r] = &(rows[r]->*column.field);
+        encodeColumn(raw, values, column.coding);
+    }
+}
+template <typename T, size_t N>
+bool decodeBlock(ByteReader& in, const vector<T*>& rows, const CompactColumn<T> (&columns)[N]) {
+    vector<string*> values(rows.size());
+    for (const CompactColumn<T>& column : columns) {
+        for (size_t r = 0; r < rows.size(); ++r) values[r] = &(rows[r]->*column.field);
+        decodeColumn(in, values, column.coding);
+        if (!in.ok) return false;
+    }
+    return true;
+}
+// Version 1 files ("PMS1") have no crc field; they are still read, and
+// blocks appended to one are written without it
+void appendCompactBlock(string& file, const string& raw, size_t rowCount, bool checksummed = true) {
+    string compressed;
+    lzCompress(raw, compressed);
+    size_t headerStart = file.size();
+    putU32(file, static_cast<uint32_t>(rowCount));
+    putU32(file, static_cast<uint32_t>(raw.size()));
+    putU32(file, static_cast<uint32_t>(compressed.size()));
+    if (checksummed) putU32(file, crc32c(compressed.data(), compressed.size(), crc32c(file.data() + headerStart, 12)));
+    file += compressed;
+}
+// `header` points at the block's first three fields and `payload` at its
+// compressed bytes
+bool compactBlockIntact(const void* header, const void* payload, size_t payloadSize, uint32_t crc) {
+    return crc32c(payload, payloadSize, crc32c(header, 12)) == crc;
+}
+// Rejects a header that would make the loader allocate more than the block
+// can hold: each row takes at least one byte per column, and lzDecompress
+// expands a byte to at most 255
+bool compactBlockSizesPlausible(uint32_t rowCount, uint32_t rawSize, uint32_t compressedSize) {
+    return rowCount <= rawSize && rawSize <= static_cast<uint64_t>(compressedSize) * 255 + 16;
+}
+bool isCompactMagic(const string& file, char kind, bool& checksummed) {
+    if (file.size() < 5 || file.compare(0, 3, "PMS") != 0 || file[4] != kind) return false;
+    checksummed = file[3] == '2';
+    return checksummed || file[3] == '1';
+}
+bool writeWholeFile(const string& fileName, const string& contents) {
+    ofstream out(fileName, ios::binary | ios::trunc);
+    if (!out) {
+        cout << "Error opening file " << fileName << " for writing!\n";
+        return false;
+    }
+    out.write(contents.data(), static_cast<streamsize>(contents.size()));
+    return static_cast<bool>(out);
+}
+bool readWholeFile(const string& fileName, string& contents) {
+    ifstream in(fileName, ios::binary);
+    if (!in) return false;
+    in.seekg(0, ios::end);
+    contents.resize(static_cast<size_t>(in.tellg()));
+    in.seekg(0, ios::beg);
+    in.read(&contents[0], static_cast<streamsize>(contents.size()));
+    return static_cast<bool>(in);
+}
+
+// Full record blocks, shared by the compact files and the archive tier
+void encodeRecordBlock(string& raw, const vector<NewPassport*>& rows) {
+    encodeBlock(raw, rows, newCompactColumns);
+}
+void encodeRecordBlock(string& raw, const vector<OldPassport*>& rows) {
+    encodeBlock(raw, rows, oldCompactColumns);
+    for (OldPassport* row : rows) putVarint(raw, zigzag(llround(row->balance * 100))); // Balance in cents
+}
+bool decodeRecordBlock(ByteReader& block, const vector<NewPassport*>& rows) {
+    return decodeBlock(block, rows, newCompactColumns);
+}
+bool decodeRecordBlock(ByteReader& block, const vector<OldPassport*>& rows) {
+    bool ok = decodeBlock(block, rows, oldCompactColumns);
+    for (OldPassport* row : rows) row->balance = unzigzag(block.varint()) / 100.0;
+    return ok && block.ok;
+}
+void saveNewPassportsCompact() {
+    string file = "PMS2N";
+    vector<NewPassport*> rows;
+    string raw;
+    for (NewPassport* temp = newHead; temp != nullptr; temp = temp->next) {
+        rows.push_back(temp);
+        if (rows.size() == COMPACT_BLOCK_ROWS || temp->next == nullptr) {
+            raw.clear();
+            encodeRecordBlock(raw, rows);
+            appendCompactBlock(file, raw, rows.size());
+            rows.clear();
+        }
+    }
+    if (writeWholeFile(compactNewFileName, file)) noteFileChecksums(compactNewFileName, blockChecksums(file));
+}
+void saveOldPassportsCompact() {
+    string file = "PMS2O";
+    vector<OldPassport*> rows;
+    string raw;
+    for (OldPassport* temp = oldHead; temp != nullptr; temp = temp->next) {
+        rows.push_back(temp);
+        if (rows.size() == COMPACT_BLOCK_ROWS || temp->next == nullptr) {
+            raw.clear();
+            encodeRecordBlock(raw, rows);
+            appendCompactBlock(file, raw, rows.size());
+            rows.clear();
+        }
+    }
+    if (writeWholeFile(compactOldFileName, file)) noteFileChecksums(compactOldFileName, blockChecksums(file));
+}
+// Returns false only when the file does not exist yet. A damaged block is
+// reported and leaves the list empty; damagedDataFiles then stops the startup
+// rather than letting a save write back part of the records.
+bool loadNewPassportsCompact() {
+    string file, raw;
+    if (!readWholeFile(compactNewFileName, file)) return false;
+    bool checksummed = false;
+    if (!isCompactMagic(file, 'N', checksummed)) {
+        cout << "Error: " << compactNewFileName << " is not a compact new passport file.\n";
+        return false;
+    }
+    freeNewPassportList();
+    auto stopOnDamagedBlock = [] {
+        freeNewPassportList(); // The blocks before it are dropped too
+        cout << "Error: damaged block in " << compactNewFileName << ".\n";
+        damagedDataFiles = true;
+        return true;
+    };
+    ByteReader in(file.data() + 5, file.size() - 5);
+    while (in.pos < in.end) {
+        const unsigned char* header = in.pos;
+        uint32_t rowCount = in.u32(), rawSize = in.u32(), compressedSize = in.u32();
+        uint32_t crc = checksummed ? in.u32() : 0;
+        if (!in.ok || static_cast<size_t>(in.end - in.pos) < compressedSize ||
+            !compactBlockSizesPlausible(rowCount, rawSize, compressedSize) ||
+            (checksummed && !compactBlockIntact(header, in.pos, compressedSize, crc)) ||
+            !lzDecompress(reinterpret_cast<const char*>(in.pos), compressedSize, rawSize, raw)) {
+            return stopOnDamagedBlock();
+        }
+        in.pos += compressedSize;
+        vector<NewPassport*> rows(rowCount);
+        for (NewPassport*& row : rows) row = newPool.allocate();
+        ByteReader block(raw.data(), raw.size());
+        if (!decodeRecordBlock(block, rows)) {
+            for (NewPassport* row : rows) newPool.release(row);
+            return stopOnDamagedBlock();
+        }
+        for (NewPassport* row : rows) appendRecord(row);
+    }
+    return true;
+}
+bool loadOldPassportsCompact() {
+    string file, raw;
+    if (!readWholeFile(compactOldFileName, file)) return false;
+    bool checksummed = false;
+    if (!isCompactMagic(file, 'O', checksummed)) {
+        cout << "Error: " << compactOldFileName << " is not a compact old passport file.\n";
+        return false;
+    }
+    freeOldPassportList();
+    auto stopOnDamagedBlock = [] {
+        freeOldPassportList(); // The blocks before it are dropped too
+        cout << "Error: damaged block in " << compactOldFileName << ".\n";
+        damagedDataFiles = true;
+        return true;
+    };
+    ByteReader in(file.data() + 5, file.size() - 5);
+    while (in.pos < in.end) {
+        const unsigned char* header = in.pos;
+        uint32_t rowCount = in.u32(), rawSize = in.u32(), compressedSize = in.u32();
+        uint32_t crc = checksummed ? in.u32() : 0;
+        if (!in.ok || static_cast<size_t>(in.end - in.pos) < compressedSize ||
+            !compactBlockSizesPlausible(rowCount, rawSize, compressedSize) ||
+            (checksummed && !compactBlockIntact(header, in.pos, compressedSize, crc)) ||
+            !lzDecompress(reinterpret_cast<const char*>(in.pos), compressedSize, rawSize, raw)) {
+            return stopOnDamagedBlock();
+        }
+        in.pos += compressedSize;
+        vector<OldPassport*> rows(rowCount);
+        for (OldPassport*& row : rows) row = oldPool.allocate();
+        ByteReader block(raw.data(), raw.size());
+        if (!decodeRecordBlock(block, rows)) {
+            for (OldPassport* row : rows) oldPool.release(row);
+            return stopOnDamagedBlock();
+        }
+        for (OldPassport* row : rows) appendRecord(row);
+    }
+    return true;
+}
+// --- Multi-Instance Coordination ---
+// Several instances may work on one data directory at the same time. Each
+// commit runs under an exclusive flock on instanceLockFileName, which holds
+// the generation: the sequence number of the last event in the change feed.
+// An instance that finds a newer generation there first replays the feed
+// events it has not seen through the change hooks, so it decides and saves
+// on the lists as they are on disk. --slots and --replicate keep state that
+// cannot be replayed and need the directory to themselves, which the owner
+// lock (exclusive for them, shared for everyone else) enforces.
+// An flock belongs to the open file, which all threads of the process share,
+// so instanceMutex keeps the threads apart in front of it. Locks are always
+// taken in the order storeMutex, then the instance lock.
+const string instanceLockFileName = "passport4.lock";
+const string instanceOwnerFileName = "passport4.owner";
+int instanceLockFd = -1, instanceOwnerFd = -1;
+mutex instanceMutex;
+thread_local int instanceLockDepth = 0; // A thread may nest lockInstance calls
+streamoff changeFeedReadOffset = 0; // Feed events before it are reflected in the lists
+
+bool openInstanceLocks(bool exclusiveOwner) {
+#ifdef HAVE_POSIX_IO
+    instanceOwnerFd = open(instanceOwnerFileName.c_str(), O_RDWR | O_CREAT, 0644);
+    instanceLockFd = open(instanceLockFileName.c_str(), O_RDWR | O_CREAT, 0644);
+    if (instanceOwnerFd < 0 || instanceLockFd < 0) {
+        cout << "Error opening file " << instanceLockFileName << " for writing!\n";
+        return false;
+    }
+    if (flock(instanceOwnerFd, (exclusiveOwner ? LOCK_EX : LOCK_SH) | LOCK_NB) != 0) {
+        cout << (exclusiveOwner ? "Error: --slots and --replicate need the data directory to themselves,"
+                                  " but another instance is using it.\n"
+                                : "Error: an instance with --slots or --replicate is using this data directory.\n");
+        return false;
+    }
+#else
+    (void)exclusiveOwner;
+#endif
+    return true;
+}
+void lockInstance() {
+    if (instanceLockDepth++ > 0) return;
+    instanceMutex.lock();
+#ifdef HAVE_POSIX_IO
+    if (instanceLockFd >= 0) flock(instanceLockFd, LOCK_EX);
+#endif
+}
+void unlockInstance() {
+    if (--instanceLockDepth > 0) return;
+#ifdef HAVE_POSIX_IO
+    if (instanceLockFd >= 0) flock(instanceLockFd, LOCK_UN);
+#endif
+    instanceMutex.unlock();
+}
+// The generation is stored as fixed-width text so a rewrite never leaves digits behind
+unsigned long long readGeneration() {
+#ifdef HAVE_POSIX_IO
+    char text[32] = {};
+    if (instanceLockFd >= 0 && pread(instanceLockFd, text, sizeof(text) - 1, 0) > 0) return strtoull(text, nullptr, 10);
+#endif
+    return 0;
+}
+void writeGeneration(unsigned long long generation) {
+#ifdef HAVE_POSIX_IO
+    char text[32];
+    int length = snprintf(text, sizeof(text), "%020llu\n", generation);
+    if (instanceLockFd >= 0 && pwrite(instanceLockFd, text, static_cast<size_t>(length), 0) != length) {
+        cout << "Error writing file " << instanceLockFileName << "!\n";
+    }
+#else
+    (void)generation;
+#endif
+}
+streamoff changeFeedSize() {
+    struct stat info;
+    return stat(changeFeedFileName.c_str(), &info) == 0 ? static_cast<streamoff>(info.st_size) : 0;
+}
+// Marks the whole feed as seen after the lists were read from the files;
+// called with the instance lock held
+void syncWithChangeFeed() {
+    changeFeedSeq = lastChangeSeq();
+    changeFeedReadOffset = changeFeedSize();
+    if (readGeneration() < changeFeedSeq) writeGeneration(changeFeedSeq);
+}
+bool readJsonString(const string& text, size_t& pos, string& out) {
+    if (pos >= text.size() || text[pos] != '"') return false;
+    out.clear();
+    for (++pos; pos < text.size(); ++pos) {
+        char c = text[pos];
+        if (c == '"') {
+            ++pos;
+            return true;
+        }
+        if (c == '\\' && pos + 1 < text.size()) {
+            c = text[++pos];
+            if (c == 'u' && pos + 4 < text.size()) {
+                c = static_cast<char>(strtol(text.substr(pos + 1, 4).c_str(), nullptr, 16));
+                pos += 4;
+            }
+        }
+        out += c;
+    }
+    return false;
+}
+// Reads a record object written by recordJson back into a data file line
+bool readRecordJson(const string& text, size_t& pos, string& line) {
+    line.clear();
+    if (text.compare(pos, 4, "null") == 0) {
+        pos += 4;
+        return true;
+    }
+    if (pos >= text.size() || text[pos] != '{') return false;
+    string column, value;
+    bool first = true;
+    for (++pos; pos < text.size() && text[pos] != '}'; first = false) {
+        if (!first && text[pos++] != ',') return false;
+        if (!readJsonString(text, pos, column) || pos >= text.size() || text[pos++] != ':' ||
+            !readJsonString(text, pos, value)) {
+            return false;
+        }
+        line += (first ? "" : ",") + value;
+    }
+    ++pos;
+    return true;
+}
+// Turns one feed event into the replication entry that replays it
+bool parseChangeEvent(const string& text, ReplicationEntry& entry) {
+    string op, list, id, before, after;
+    size_t pos = text.find("\"seq\":");
+    if (pos == string::npos) return false;
+    entry.seq = strtoull(text.c_str() + pos + 6, nullptr, 10);
+    // Fields are located in the order publishChange writes them, so text
+    // inside an earlier value is never taken for a later field name
+    auto seek = [&text, &pos](const char* name) {
+        pos = text.find(name, pos);
+        if (pos == string::npos) return false;
+        pos += strlen(name);
+        return true;
+    };
+    if (!seek("\"op\":") || !readJsonString(text, pos, op) || !seek("\"list\":") || !readJsonString(text, pos, list) ||
+        !seek("\"id\":") || !readJsonString(text, pos, id) || !seek("\"before\":") || !readRecordJson(text, pos, before) ||
+        !seek("\"after\":") || !readRecordJson(text, pos, after)) {
+        return false;
+    }
+    entry.kind = list == "new" ? 'N' : 'O';
+    if (op == "insert") {
+        entry.op = 'I';
+        entry.line = after;
+    } else if (op == "update") {
+        size_t idStart = before.find(',') + 1; // ID is the second column of both lists
+        entry.op = 'U';
+        entry.key = before.substr(idStart, before.find(',', idStart) - idStart);
+        entry.line = after;
+    } else { // delete or archive
+        entry.op = 'D';
+        entry.key = id;
+    }
+    return true;
+}
+// Replays the events other instances added to the feed; called with
+// storeMutex and the instance lock held. True if there were any.
+bool catchUpWithOtherInstances() {
+    if (instanceLockFd < 0 || readGeneration() <= changeFeedSeq) return false;
+    bool materialized = newListMaterialized && oldListMaterialized;
+    if (materialized) {
+        ifstream in(changeFeedFileName, ios::binary);
+        in.seekg(changeFeedReadOffset);
+        string line;
+        applyingRemoteChanges = true;
+        while (in && getline(in, line) && !in.eof()) {
+            ReplicationEntry entry;
+            if (!parseChangeEvent(line, entry) || entry.seq <= changeFeedSeq) continue;
+            applyReplicationEntry(entry);
+            changeFeedSeq = entry.seq;
+        }
+        applyingRemoteChanges = false;
+    } else { // Lazy mode: the files already hold the changes, so index them again
+        buildNewPassportIndex();
+        buildOldPassportIndex();
+    }
+    syncWithChangeFeed();
+    reloadArchiveIndexes(); // Another instance may have swept records into it
+    return true;
+}
+// Brings the lists up to date with the other instances between operations
+void refreshFromOtherInstances() {
+    if (instanceLockFd < 0) return;
+    lock_guard<mutex> writeLock(storeMutex);
+    lockInstance();
+    catchUpWithOtherInstances();
+    unlockInstance();
+}
+// Held from the point where a writer changes the lists until it has saved
+// them. If changedByOthers is set the writer must recheck what it validated
+// before, since the lists now include another instance's changes.
+struct InstanceCommit {
+    bool changedByOthers;
+    explicit InstanceCommit(bool mergeFiles = true) {
+        lockInstance();
+        changedByOthers = catchUpWithOtherInstances();
+        if (mergeFiles) mergeOutsideChanges(); // Rows other tools added to the CSV files
+    }
+    ~InstanceCommit() {
+        if (instanceLockFd >= 0) {
+            changeFeedReadOffset = changeFeedSize(); // Our own events are already applied
+            if (readGeneration() < changeFeedSeq) writeGeneration(changeFeedSeq);
+        }
+        unlockInstance();
+    }
+    InstanceCommit(const InstanceCommit&) = delete;
+    InstanceCommit& operator=(const InstanceCommit&) = delete;
+};
+
+// --- Archive Tier ---
+// With --archive-after DAYS, records whose appointment lies more than DAYS in
+// the past are moved out of the lists into an append-only archive file in the
+// compact block format. Each sweep appends one block. The archive keeps its
+// own ID, name and passport number index, built on the first lookup, and a
+// lookup decodes only the block that holds the record.
+const string archiveNewFileName = "archive_new4.pms";
+const string archiveOldFileName = "archive_old4.pms";
+int archiveAfterDays = 0;     // 0 disables archiving
+int sweepIntervalMinutes = 0; // 0 sweeps only when asked from the Tools menu
+atomic<bool> sweeperRunning(false);
+struct ArchiveLocation {
+    uint64_t blockOffset; // Offset of the block header in the archive file
+    uint32_t row;
+};
+string archivePassportNumber(const NewPassport*) { return ""; }
+string archivePassportNumber(const OldPassport* record) { return record->passportNumber; }
+template <typename T>
+class ArchiveTier {
+public:
+    ArchiveTier(const string& fileName, char kind) : fileName(fileName), kind(kind) {}
+    // Appends the records as one block; false if the file could not be written
+    bool append(const vector<T*>& rows) {
+        struct stat info;
+        uint64_t offset = stat(fileName.c_str(), &info) == 0 ? static_cast<uint64_t>(info.st_size) : 0;
+        string file;
+        if (offset == 0) {
+            file = string("PMS2") + kind;
+            checksummed = true;
+        } else if (!readMagic()) {
+            cout << "Error: " << fileName << " is not an archive file.\n";
+            return false;
+        }
+        uint64_t blockOffset = offset + file.size();
+        string raw;
+        encodeRecordBlock(raw, rows);
+        appendCompactBlock(file, raw, rows.size(), checksummed);
+        ofstream out(fileName, ios::binary | ios::app);
+        dataFileSignatures.erase(fileName); // Hashed again at the next save
+        if (!out || !out.write(file.data(), static_cast<streamsize>(file.size()))) {
+            cout << "Error opening file " << fileName << " for writing!\n";
+            return false;
+        }
+        if (indexed) {
+            for (uint32_t row = 0; row < rows.size(); ++row) addToIndex(rows[row], {blockOffset, row});
+        }
+        return true;
+    }
+    bool findById(const string& id, T& out) {
+        ensureIndexed();
+        auto it = byId.find(id);
+        return it != byId.end() && fetch(it->second, out);
+    }
+    bool findByName(const string& name, T& out) {
+        ensureIndexed();
+        auto it = byName.find(name);
+        return it != byName.end() && fetch(it->second, out);
+    }
+    bool hasId(const string& id) {
+        ensureIndexed();
+        return byId.count(id) != 0;
+    }
+    bool hasPassportNumber(const string& passportNumber) {
+        ensureIndexed();
+        return byPassportNumber.count(passportNumber) != 0;
+    }
+    template <typename F>
+    void forEachId(F visit) {
+        ensureIndexed();
+        for (const auto& entry : byId) visit(entry.first);
+    }
+    template <typename F>
+    void forEachPassportNumber(F visit) {
+        ensureIndexed();
+        for (const auto& entry : byPassportNumber) visit(entry.first);
+    }
+    size_t size() {
+        ensureIndexed();
+        return byId.size();
+    }
+    // Forgets the index so the next lookup reads blocks appended by others
+    void invalidate() {
+        indexed = false;
+        byId.clear();
+        byName.clear();
+        byPassportNumber.clear();
+    }
+private:
+    string fileName;
+    char kind;
+    bool indexed = false;
+    bool checksummed = true; // False for a version 1 archive, whose blocks have no crc
+    unordered_map<string, ArchiveLocation> byId, byName, byPassportNumber;
+
+    void addToIndex(const T* record, ArchiveLocation location) {
+        byId[record->id] = location;
+        byName.insert({record->name, location}); // Keeps the first record of a name
+        string passportNumber = archivePassportNumber(record);
+        if (!passportNumber.empty()) byPassportNumber[passportNumber] = location;
+    }
+    // Decodes one block at `offset`; false if the block is damaged
+    bool readBlock(ifstream& in, uint64_t offset, vector<T*>& rows, uint64_t& next) {
+        char header[16];
+        size_t headerSize = checksummed ? 16 : 12;
+        in.seekg(static_cast<streamoff>(offset));
+        if (!in.read(header, static_cast<streamsize>(headerSize))) return false;
+        ByteReader sizes(header, headerSize);
+        uint32_t rowCount = sizes.u32(), rawSize = sizes.u32(), compressedSize = sizes.u32();
+        uint32_t crc = checksummed ? sizes.u32() : 0;
+        if (!compactBlockSizesPlausible(rowCount, rawSize, compressedSize)) return false;
+        uint64_t payloadOffset = offset + headerSize;
+        in.seekg(0, ios::end);
+        if (static_cast<uint64_t>(in.tellg()) - payloadOffset < compressedSize) return false; // Cut short
+        in.seekg(static_cast<streamoff>(payloadOffset));
+        string compressed(compressedSize, '\0'), raw;
+        if (!in.read(&compressed[0], compressedSize) ||
+            (checksummed && !compactBlockIntact(header, compressed.data(), compressedSize, crc)) ||
+            !lzDecompress(compressed.data(), compressedSize, rawSize, raw)) {
+            return false;
+        }
+        rows.resize(rowCount);
+        for (T*& row : rows) row = new T();
+        ByteReader block(raw.data(), raw.size());
+        if (!decodeRecordBlock(block, rows)) {
+            for (T* row : rows) delete row;
+            rows.clear();
+            return false;
+        }
+        next = offset + headerSize + compressedSize;
+        return true;
+    }
+    // Reads the file's format version into `checksummed`
+    bool readMagic() {
+        ifstream in(fileName, ios::binary);
+        string fileMagic(5, '\0');
+        return in.read(&fileMagic[0], 5) && isCompactMagic(fileMagic, kind, checksummed);
+    }
+    void ensureIndexed() {
+        if (indexed) return;
+        indexed = true;
+        if (!readMagic()) return;
+        ifstream in(fileName, ios::binary);
+        in.seekg(0, ios::end);
+        uint64_t end = static_cast<uint64_t>(in.tellg()), offset = 5, next = 0;
+        while (offset < end) {
+            vector<T*> rows;
+            if (!readBlock(in, offset, rows, next)) {
+                cout << "Error: damaged block in " << fileName << ".\n";
+                return;
+            }
+            for (uint32_t row = 0; row < rows.size(); ++row) {
+                addToIndex(rows[row], {offset, row});
+                delete rows[row];
+            }
+            offset = next;
+        }
+    }
+    bool fetch(const ArchiveLocation& location, T& out) {
+        ifstream in(fileName, ios::binary);
+        vector<T*> rows;
+        uint64_t next;
+        if (!in || !readBlock(in, location.blockOffset, rows, next)) return false;
+        bool found = location.row < rows.size();
+        if (found) out = *rows[location.row];
+        for (T* row : rows) delete row;
+        return found;
+    }
+};
+ArchiveTier<NewPassport> newArchive(archiveNewFileName, 'N');
+ArchiveTier<OldPassport> oldArchive(archiveOldFileName, 'O');
+
+void reloadArchiveIndexes() {
+    newArchive.invalidate();
+    oldArchive.invalidate();
+}
+// Archive files written by earlier runs are searched whether or not this
+// run archives (--archive-after); without the files the indexes are empty
+bool archiveHasId(const string& id) {
+    return newArchive.hasId(id) || oldArchive.hasId(id);
+}
+bool archiveHasPassportNumber(const string& passportNumber) {
+    return oldArchive.hasPassportNumber(passportNumber);
+}
+// Moves every record with an appointment older than the cutoff from `head`
+// into `archive`; returns how many were moved
+template <typename T>
+size_t archiveAgedRecords(T* head, ArchiveTier<T>& archive, int64_t cutoffDays, void (*onErased)(const T*)) {
+    auto aged = [cutoffDays](const T* record) {
+        int64_t days;
+        return dateToDays(record->appointmentDate, days) && days < cutoffDays;
+    };
+    vector<T*> rows;
+    for (T* temp = head; temp != nullptr; temp = temp->next) {
+        if (aged(temp)) rows.push_back(temp);
+    }
+    if (rows.empty() || !archive.append(rows)) return 0; // Written before it leaves the list
+    for (T* record : rows) {
+        onErased(record);
+        eraseRecord(record);
+    }
+    return rows.size();
+}
+// Runs one sweep over both lists and saves the ones that changed
+size_t sweepToArchive() {
+    int64_t today;
+    if (archiveAfterDays <= 0 || !dateToDays(getCurrentDate(), today)) return 0;
+    lock_guard<mutex> writeLock(storeMutex);
+    InstanceCommit commit;
+    changeFeedArchiving = true; // Reported as "archive" rather than "delete"
+    size_t movedNew = archiveAgedRecords(newHead, newArchive, today - archiveAfterDays, onNewPassportErased);
+    size_t movedOld = archiveAgedRecords(oldHead, oldArchive, today - archiveAfterDays, onOldPassportErased);
+    changeFeedArchiving = false;
+    if (movedNew > 0) saveNewPassportsToFile();
+    if (movedOld > 0) saveOldPassportsToFile();
+    return movedNew + movedOld;
+}
+void sweepPeriodically() {
+    chrono::steady_clock::time_point nextSweep = chrono::steady_clock::now() + chrono::minutes(sweepIntervalMinutes);
+    while (sweeperRunning) {
+        this_thread::sleep_for(chrono::milliseconds(200));
+        if (chrono::steady_clock::now() < nextSweep) continue;
+        sweepToArchive();
+        nextSweep = chrono::steady_clock::now() + chrono::minutes(sweepIntervalMinutes);
+    }
+}
+void archiveNow() {
+    if (archiveAfterDays <= 0) {
+        cout << "Archiving is off. Start the program with --archive-after DAYS to enable it.\n";
+        return;
+    }
+    ensurePassportsLoaded();
+    size_t moved = sweepToArchive();
+    cout << moved << " record(s) with an appointment more than " << archiveAfterDays
+         << " days ago moved to the archive (" << newArchive.size() + oldArchive.size() << " archived in total).\n";
+}
+
+// --- Outside Changes to Data Files ---
+// Other tools sometimes append to or rewrite the CSV files. Every commit
+// compares the four files with their checksum entries once it has caught up
+// with the other instances, and every save checks its files again right
+// before it writes, so rows added outside are merged instead of overwritten:
+//  - a file that matches its entry was saved by an instance, whose changes
+//    arrive through the change feed, and is left alone;
+//  - a file whose saved bytes are intact but which has grown was appended
+//    to, and only the bytes after the saved size are parsed;
+//  - anything else was rewritten. At the start of a commit the lists hold
+//    what was last saved, so the file is compared row by row with the
+//    records kept in it. A file rewritten during a save is kept aside.
+// Changes go through the record hooks like any other. A row that cannot be
+// applied (its ID or passport number is taken, or an appended row reuses an
+// ID) is listed in outsideExceptionsFileName, and the file's checksums are
+// then left as they were; otherwise they are recorded, so the file loads
+// without a warning at the next start.
+const string outsideExceptionsFileName = "outside_exceptions4.csv";
+atomic<size_t> outsideChangesApplied(0);
+unordered_set<string> reportedOutsideRows;   // Exceptions already listed, as file name + '\n' + row
+bool reportedOutsideRowsRead = false;
+map<string, uint32_t> partlyAppliedFiles;    // CRC of the contents merged with exceptions, by file
+
+// Gives the data files that have no checksum entry yet (files from earlier
+// versions) one, so that outside changes to them are noticed. Called at
+// startup with the instance lock held.
+void recordMissingChecksums() {
+    map<string, vector<string>> entries = readChecksumFile();
+    string contents[4];
+    vector<pair<string, string_view>> files;
+    const string fileNames[] = {regularFileName, urgentFileName, expiredRegularFileName, expiredUrgentFileName};
+    for (int i = 0; i < 4; ++i) {
+        if (entries.count(fileNames[i]) == 0 && readWholeFile(fileNames[i], contents[i])) {
+            files.emplace_back(fileNames[i], contents[i]);
+        }
+    }
+    if (!files.empty()) recordChecksums(files);
+}
+template <typename T>
+struct OutsideRows {
+    vector<T> records;
+    vector<string> lines;
+};
+// One data file that differs from its checksum entry, read and parsed
+// before storeMutex is taken
+struct OutsideChange {
+    string fileName, contents;
+    vector<string> recorded; // The checksum entry it was compared with
+    bool appended = false;
+    OutsideRows<NewPassport> newRows;
+    OutsideRows<OldPassport> oldRows;
+};
+// Parses the lines from byte `from` on; the header is skipped when it is 0
+template <typename T>
+void parseOutsideRows(const string& contents, size_t from, OutsideRows<T>& rows) {
+    size_t pos = from;
+    if (pos == 0) pos = min(contents.find('\n'), contents.size()) + 1;
+    while (pos < contents.size()) {
+        size_t end = min(contents.find('\n', pos), contents.size());
+        string line = contents.substr(pos, end - pos);
+        T record{};
+        if (!line.empty() && parseCsvLine(line, &record)) {
+            rows.records.push_back(record);
+            rows.lines.push_back(line);
+        }
+        pos = end + 1;
+    }
+}
+// Reads a data file; false if it matches its checksum entry, has none or is missing
+bool readOutsideChange(const string& fileName, OutsideChange& change) {
+    change.fileName = fileName;
+    change.recorded = readChecksumFile()[fileName];
+    if (change.recorded.empty() || !readWholeFile(fileName, change.contents)) return false;
+    ChecksumState state = compareWithChecksums(change.contents, change.recorded);
+    if (state == CHECKSUM_MATCH) return false;
+    change.appended = state == CHECKSUM_APPENDED;
+    size_t from = change.appended ? static_cast<size_t>(strtoull(change.recorded[0].c_str(), nullptr, 10)) : 0;
+    if (fileName == regularFileName || fileName == urgentFileName) {
+        parseOutsideRows(change.contents, from, change.newRows);
+    } else {
+        parseOutsideRows(change.contents, from, change.oldRows);
+    }
+    return true;
+}
+bool outsideRowIsFree(const NewPassport& row) { return isUniqueNewID(row.id); }
+bool outsideRowIsFree(const OldPassport& row) {
+    return isUniqueOldID(row.id) && isUniquePassportNumber(row.passportNumber);
+}
+void addOutsideException(RecordWriter& out, const string& fileName, const char* reason, const string& line) {
+    if (!reportedOutsideRowsRead) { // Rows listed by earlier runs stay listed once
+        reportedOutsideRowsRead = true;
+        ifstream in(outsideExceptionsFileName);
+        string listed;
+        getline(in, listed); // Header
+        while (getline(in, listed)) {
+            size_t fileEnd = listed.find(','), reasonEnd = listed.find(',', fileEnd + 1);
+            if (reasonEnd != string::npos) reportedOutsideRows.insert(listed.substr(0, fileEnd) + '\n' + listed.substr(reasonEnd + 1));
+        }
+    }
+    if (!reportedOutsideRows.insert(fileName + '\n' + line).second) return; // Listed before
+    out.put(fileName).put(',').put(reason).put(',').put(line).put('\n');
+}
+// Inserts the rows with a new ID. An appended row whose ID is in use is an
+// exception; in a rewritten file it updates the record, and the records the
+// file no longer holds are deleted. Called with storeMutex and the instance
+// lock held; returns the number of rows listed as exceptions.
+template <typename T>
+size_t applyOutsideRows(const OutsideChange& change, const OutsideRows<T>& rows, char kind, RecordWriter& exceptions) {
+    RecordIdIndex<T>& index = recordIdIndex(static_cast<const T*>(nullptr));
+    size_t failed = 0;
+    unordered_set<string> present;
+    for (size_t i = 0; i < rows.records.size(); ++i) {
+        const T& row = rows.records[i];
+        present.insert(row.id);
+        T* current = index.find(row.id);
+        if (current != nullptr && sameFields(*current, row)) continue;
+        const char* reason = nullptr;
+        if (current == nullptr && !outsideRowIsFree(row)) reason = "ID or passport number already in use";
+        if (current != nullptr && change.appended) reason = "ID already used by another record";
+        if (reason != nullptr) {
+            addOutsideException(exceptions, change.fileName, reason, rows.lines[i]);
+            ++failed;
+            continue;
+        }
+        applyReplicationEntry({0, current == nullptr ? 'I' : 'U', kind, row.id, rows.lines[i]});
+        ++outsideChangesApplied;
+    }
+    if (change.appended) return failed;
+    vector<string> removed;
+    for (T* record = listHead(static_cast<const T*>(nullptr)); record != nullptr; record = record->next) {
+        if (getFileNameForPassType(record->passType) == change.fileName && present.count(record->id) == 0) {
+            removed.push_back(record->id);
+        }
+    }
+    for (const string& id : removed) applyReplicationEntry({0, 'D', kind, id, ""});
+    outsideChangesApplied += removed.size();
+    return failed;
+}
+void appendOutsideExceptions(const RecordWriter& exceptions) {
+    if (exceptions.size() == 0) return;
+    struct stat info;
+    bool exists = stat(outsideExceptionsFileName.c_str(), &info) == 0;
+    ofstream out(outsideExceptionsFileName, ios::binary | ios::app);
+    if (!exists) out << "File,Reason,Row\n"; // Row last: it holds commas
+    out.write(exceptions.data(), static_cast<streamsize>(exceptions.size()));
+    if (!out) cout << "Error writing file " << outsideExceptionsFileName << "!\n";
+}
+// Applies a change read by readOutsideChange. Called with storeMutex and the
+// instance lock held, and with the lists as last saved unless the file only
+// grew. True if every row was applied.
+bool applyOutsideChange(const OutsideChange& change) {
+    RecordWriter exceptions;
+    bool newList = change.fileName == regularFileName || change.fileName == urgentFileName;
+    size_t failed = newList ? applyOutsideRows(change, change.newRows, 'N', exceptions)
+                            : applyOutsideRows(change, change.oldRows, 'O', exceptions);
+    appendOutsideExceptions(exceptions);
+    if (failed == 0) {
+        partlyAppliedFiles.erase(change.fileName);
+        recordChecksums({{change.fileName, change.contents}});
+    } else {
+        partlyAppliedFiles[change.fileName] = crc32c(change.contents.data(), change.contents.size());
+    }
+    return failed == 0;
+}
+bool usesCsvFiles() { return !compactStorageMode && !slotStorageMode && newListMaterialized && oldListMaterialized; }
+// Called by InstanceCommit after catching up with the other instances
+void mergeOutsideChanges() {
+    if (!usesCsvFiles()) return;
+    for (const string& fileName : {regularFileName, urgentFileName, expiredRegularFileName, expiredUrgentFileName}) {
+        OutsideChange change;
+        if (readOutsideChange(fileName, change)) applyOutsideChange(change);
+    }
+}
+// Called by a save right before it replaces the file. Rows appended since the
+// commit began are merged; a file rewritten meanwhile cannot be compared with
+// lists that already hold this commit's changes, so it is kept aside.
+void mergeOutsideChangesBeforeSave(const string& fileName) {
+    OutsideChange change;
+    if (!readOutsideChange(fileName, change)) return;
+    auto merged = partlyAppliedFiles.find(fileName);
+    if (merged != partlyAppliedFiles.end() && merged->second == crc32c(change.contents.data(), change.contents.size())) {
+        return; // Merged at the start of this commit
+    }
+    if (change.appended) {
+        applyOutsideChange(change);
+        return;
+    }
+    string keptName = fileName + ".outside";
+    ofstream kept(keptName, ios::binary | ios::trunc);
+    kept.write(change.contents.data(), static_cast<streamsize>(change.contents.size()));
+    RecordWriter exceptions;
+    addOutsideException(exceptions, fileName, kept ? "rewritten while saving; kept as .outside" : "rewritten while saving; not kept",
+                        to_string(change.contents.size()) + " bytes");
+    appendOutsideExceptions(exceptions);
+    cout << "Warning: " << fileName << " was rewritten by another tool while it was saved; its contents were kept in "
+         << keptName << ".\n";
+}
+
+// --- Data File Watch ---
+// With --watch, an inotify watch on the data directory notices when another
+// tool changes one of the CSV files, and a background thread merges the
+// change (see Outside Changes to Data Files) without waiting for the next
+// commit. The file is read and parsed without storeMutex, which is only held
+// while the rows go through the record hooks.
+const chrono::milliseconds watchSettleTime(200); // Quiet time before a changed file is read
+const chrono::milliseconds watchMaxDelay(2000);  // Read even if a tool keeps writing
+bool watchDataFilesMode = false;
+atomic<bool> watcherRunning(false);
+
+bool isWatchedDataFile(const string& name) {
+    return name == regularFileName || name == urgentFileName || name == expiredRegularFileName ||
+           name == expiredUrgentFileName;
+}
+// Merges one changed data file. False if the file or its checksums changed
+// again while it was parsed, so it must be read again.
+bool reloadChangedFile(const string& fileName) {
+    OutsideChange change;
+    if (!readOutsideChange(fileName, change)) return true; // Saved by an instance, or removed
+    lock_guard<mutex> writeLock(storeMutex);
+    InstanceCommit commit(false); // This file is merged below from what was parsed
+    struct stat info;
+    if (readChecksumFile()[fileName] != change.recorded || stat(fileName.c_str(), &info) != 0 ||
+        static_cast<size_t>(info.st_size) != change.contents.size()) {
+        return false;
+    }
+    auto merged = partlyAppliedFiles.find(fileName);
+    if (merged != partlyAppliedFiles.end() && merged->second == crc32c(change.contents.data(), change.contents.size())) {
+        return true; // Its exceptions are listed already
+    }
+    applyOutsideChange(change);
+    return true;
+}
+#ifdef HAVE_INOTIFY
+int openDataFileWatch() {
+    int watchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watchFd < 0 || inotify_add_watch(watchFd, ".", IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE) < 0) {
+        cout << "Error: cannot watch the data directory for changes.\n";
+        if (watchFd >= 0) close(watchFd);
+        return -1;
+    }
+    return watchFd;
+}
+void watchDataFiles(int watchFd) {
+    set<string> changed;
+    chrono::steady_clock::time_point firstEvent, lastEvent;
+    alignas(inotify_event) char events[4096];
+    while (watcherRunning) {
+        pollfd ready = {watchFd, POLLIN, 0};
+        if (poll(&ready, 1, 100) > 0) {
+            ssize_t size = read(watchFd, events, sizeof(events));
+            for (ssize_t pos = 0; pos < size;) {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(events + pos);
+                pos += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+                bool overflow = (event->mask & IN_Q_OVERFLOW) != 0; // Events were lost: check every file
+                if (!overflow && (event->len == 0 || !isWatchedDataFile(event->name))) continue;
+                if (changed.empty()) firstEvent = chrono::steady_clock::now();
+                lastEvent = chrono::steady_clock::now();
+                if (overflow) {
+                    changed.insert({regularFileName, urgentFileName, expiredRegularFileName, expiredUrgentFileName});
+                } else {
+                    changed.insert(event->name);
+                }
+            }
+        }
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        if (changed.empty() || (now - lastEvent < watchSettleTime && now - firstEvent < watchMaxDelay)) continue;
+        set<string> files;
+        files.swap(changed);
+        for (const string& fileName : files) {
+            if (reloadChangedFile(fileName)) continue;
+            if (changed.empty()) firstEvent = chrono::steady_clock::now();
+            lastEvent = chrono::steady_clock::now();
+            changed.insert(fileName);
+        }
+    }
+    close(watchFd);
+}
+#endif
+
+// --- Bloom Filters for Uniqueness Checks ---
+// One filter over all IDs (new and old) and one over passport numbers,
+// persisted next to the data files. The file records a signature of the data
+// files it was built from, their sizes and the CRC32C of their block
+// checksums, and is only trusted when that signature matches. A file rewritten with the same
+// size within the same second therefore still invalidates the filters.
+struct BloomFilter {
+    vector<uint64_t> words;
+    uint64_t bitCount = 0;
+    uint32_t hashCount = 7; // About 1% false positives at 10 bits per key
+    uint64_t capacity = 0, keys = 0; // Keys sized for and keys added
+
+    void reset(size_t expectedKeys) {
+        bitCount = max<uint64_t>(1024, static_cast<uint64_t>(expectedKeys) * 10);
+        words.assign((bitCount + 63) / 64, 0);
+        capacity = bitCount / 10;
+        keys = 0;
+    }
+    static uint64_t hash(const string& key) { // FNV-1a
+        uint64_t h = 14695981039346656037ull;
+        for (unsigned char c : key) {
+            h ^= c;
+            h *= 1099511628211ull;
+        }
+        return h;
+    }
+    void add(const string& key) {
+        if (bitCount == 0) return;
+        ++keys;
+        uint64_t h = hash(key), step = (h >> 33) | 1;
+        for (uint32_t i = 0; i < hashCount; ++i, h += step) {
+            uint64_t bit = h % bitCount;
+            words[bit / 64] |= 1ull << (bit % 64);
+        }
+    }
+    bool mightContain(const string& key) const {
+        if (bitCount == 0) return true;
+        uint64_t h = hash(key), step = (h >> 33) | 1;
+        for (uint32_t i = 0; i < hashCount; ++i, h += step) {
+            uint64_t bit = h % bitCount;
+            if ((words[bit / 64] & (1ull << (bit % 64))) == 0) return false;
+        }
+        return true;
+    }
+};
+BloomFilter idFilter, passportNumberFilter;
+bool bloomFiltersValid = false; // False until built from or matched against the data
+
+// A save takes the parts of the files it wrote from their checksums and the
+// rest from dataFileSignatures; loading the filters reads every file, since
+// another instance or tool may have changed any of them
+string dataFilesSignature(bool fromDisk) {
+    const string files[] = {regularFileName, urgentFileName, expiredRegularFileName, expiredUrgentFileName,
+                            compactNewFileName, compactOldFileName, slotNewFileName, slotOldFileName,
+                            archiveNewFileName, archiveOldFileName};
+    stringstream ss;
+    string contents;
+    for (const string& fileName : files) {
+        auto part = dataFileSignatures.find(fileName);
+        if (fromDisk || part == dataFileSignatures.end()) {
+            dataFileSignatures.erase(fileName);
+            if (!readWholeFile(fileName, contents)) continue;
+            noteFileChecksums(fileName, blockChecksums(contents));
+            part = dataFileSignatures.find(fileName);
+        }
+        ss << fileName << ':' << part->second << ';';
+    }
+    return ss.str();
+}
+void saveBloomFilters() {
+    string file = "PMBF2";
+    string signature = dataFilesSignature(false);
+    putVarint(file, signature.size());
+    file += signature;
+    for (const BloomFilter* filter : {&idFilter, &passportNumberFilter}) {
+        putVarint(file, filter->bitCount);
+        putVarint(file, filter->hashCount);
+        for (uint64_t word : filter->words) {
+            putU32(file, static_cast<uint32_t>(word));
+            putU32(file, static_cast<uint32_t>(word >> 32));
+        }
+    }
+    writeWholeFile(bloomFileName, file);
+}
+// Built from every pool and archive at startup, or when the filters grew
+// past twice the keys they were sized for
+void rebuildBloomFilters() {
+    size_t idCount = newPool.size(), passportCount = oldPool.size();
+    size_t archivedCount = newArchive.size() + oldArchive.size();
+    idFilter.reset(idCount + passportCount + archivedCount);
+    passportNumberFilter.reset(passportCount + archivedCount);
+    // Archived keys stay taken
+    newArchive.forEachId([](const string& id) { idFilter.add(id); });
+    oldArchive.forEachId([](const string& id) { idFilter.add(id); });
+    oldArchive.forEachPassportNumber([](const string& number) { passportNumberFilter.add(number); });
+    // Order does not matter here, so walk the pools in memory order
+    newPool.forEach([](NewPassport* record) { idFilter.add(record->id); });
+    oldPool.forEach([](OldPassport* record) {
+        idFilter.add(record->id);
+        passportNumberFilter.add(record->passportNumber);
+    });
+    bloomFiltersValid = true;
+    saveBloomFilters();
+}
+// Called after every save. bloomAdd keeps the filters in memory current, so
+// only the persisted file is rewritten to match the new signature.
+void refreshBloomFilters() {
+    bool full = idFilter.keys > 2 * idFilter.capacity || passportNumberFilter.keys > 2 * passportNumberFilter.capacity;
+    if (!bloomFiltersValid || full) rebuildBloomFilters();
+    else saveBloomFilters();
+}
+bool loadBloomFilters() {
+    string file, signature;
+    if (!readWholeFile(bloomFileName, file) || file.compare(0, 5, "PMBF2") != 0) return false;
+    ByteReader in(file.data() + 5, file.size() - 5);
+    in.bytes(signature, in.varint());
+    if (!in.ok || signature != dataFilesSignature(true)) return false; // Data changed since the filters were built
+    for (BloomFilter* filter : {&idFilter, &passportNumberFilter}) {
+        filter->bitCount = in.varint();
+        filter->hashCount = static_cast<uint32_t>(in.varint());
+        if (!in.ok || static_cast<uint64_t>(in.end - in.pos) < (filter->bitCount + 63) / 64 * 8) return false;
+        filter->words.resize((filter->bitCount + 63) / 64);
+        filter->capacity = filter->keys = filter->bitCount / 10; // Taken as full
+        for (uint64_t& word : filter->words) {
+            word = in.u32();
+            word |= static_cast<uint64_t>(in.u32()) << 32;
+        }
+    }
+    bloomFiltersValid = true;
+    return true;
+}
+bool idMightExist(const string& id) {
+    return !bloomFiltersValid || idFilter.mightContain(id);
+}
+bool passportNumberMightExist(const string& passportNumber) {
+    return !bloomFiltersValid || passportNumberFilter.mightContain(passportNumber);
+}
+void bloomAdd(const string& id, const string& passportNumber) {
+    idFilter.add(id);
+    if (!passportNumber.empty()) passportNumberFilter.add(passportNumber);
+}
+
+// Open data files that fetchNewPassport/fetchOldPassport read records from.
+// A save replaces a file through a tmp file and rename, so the streams are
+// closed whenever the offsets are rebuilt and reopen on the current file.
+ifstream newRecordFiles[2], oldRecordFiles[2];
+// Scans the data files once and records where each line starts, keeping only the
+// key fields resident. Records themselves are parsed later by fetchNewPassport.
+void buildNewPassportIndex() {
+    for (ifstream& file : newRecordFiles) file.close();
+    newLocations.clear();
+    newLocationById.clear();
+    newRecordCache.clear();
+    string fileNames[] = {regularFileName, urgentFileName};
+    string contents, line;
+    for (int f = 0; f < 2; ++f) {
+        finishInterruptedSave(fileNames[f]);
+        if (!readWholeFile(fileNames[f], contents)) continue;
+        if (!verifyChecksums(fileNames[f], contents)) {
+            damagedDataFiles = true;
+            continue;
+        }
+        for (size_t pos = min(contents.find('\n'), contents.size()) + 1; pos < contents.size();) { // Skip the header
+            size_t end = min(contents.find('\n', pos), contents.size());
+            streamoff lineStart = static_cast<streamoff>(pos);
+            line.assign(contents, pos, end - pos);
+            pos = end + 1;
+            if (line.empty()) continue;
+            stringstream ss(line);
+            RecordLocation loc;
+            getline(ss, loc.passType, ',');
+            getline(ss, loc.id, ',');
+            getline(ss, loc.name, ',');
+            loc.fileIndex = f;
+            loc.offset = lineStart;
+            newLocationById[loc.id] = newLocations.size();
+            newLocations.push_back(loc);
+        }
+    }
+    newListMaterialized = false;
+}
+void buildOldPassportIndex() {
+    for (ifstream& file : oldRecordFiles) file.close();
+    oldLocations.clear();
+    oldLocationById.clear();
+    oldRecordCache.clear();
+    string fileNames[] = {expiredRegularFileName, expiredUrgentFileName};
+    string contents, line;
+    for (int f = 0; f < 2; ++f) {
+        finishInterruptedSave(fileNames[f]);
+        if (!readWholeFile(fileNames[f], contents)) continue;
+        if (!verifyChecksums(fileNames[f], contents)) {
+            damagedDataFiles = true;
+            continue;
+        }
+        for (size_t pos = min(contents.find('\n'), contents.size()) + 1; pos < contents.size();) { // Skip the header
+            size_t end = min(contents.find('\n', pos), contents.size());
+            streamoff lineStart = static_cast<streamoff>(pos);
+            line.assign(contents, pos, end - pos);
+            pos = end + 1;
+            if (line.empty()) continue;
+            stringstream ss(line);
+            RecordLocation loc;
+            getline(ss, loc.passType, ',');
+            getline(ss, loc.id, ',');
+            getline(ss, loc.name, ',');
+            loc.fileIndex = f;
+            loc.offset = lineStart;
+            oldLocationById[loc.id] = oldLocations.size();
+            oldLocations.push_back(loc);
+        }
+    }
+    oldListMaterialized = false;
+}
+bool fetchNewPassport(const RecordLocation& loc, NewPassport& out) {
+    NewPassport* cached = newRecordCache.get(loc.id);
+    if (cached != nullptr) {
+        out = *cached;
+        return true;
+    }
+    string fileNames[] = {regularFileName, urgentFileName};
+    ifstream& in = newRecordFiles[loc.fileIndex];
+    if (!in.is_open()) in.open(fileNames[loc.fileIndex]);
+    in.clear();
+    in.seekg(loc.offset);
+    string line;
+    if (!getline(in, line) || !parseCsvLine(line, &out) || out.id != loc.id) {
+        cout << "Error reading record " << loc.id << " from " << fileNames[loc.fileIndex] << "\n";
+        return false;
+    }
+    newRecordCache.put(loc.id, out);
+    return true;
+}
+bool fetchOldPassport(const RecordLocation& loc, OldPassport& out) {
+    OldPassport* cached = oldRecordCache.get(loc.id);
+    if (cached != nullptr) {
+        out = *cached;
+        return true;
+    }
+    string fileNames[] = {expiredRegularFileName, expiredUrgentFileName};
+    ifstream& in = oldRecordFiles[loc.fileIndex];
+    if (!in.is_open()) in.open(fileNames[loc.fileIndex]);
+    in.clear();
+    in.seekg(loc.offset);
+    string line;
+    if (!getline(in, line) || !parseCsvLine(line, &out) || out.id != loc.id) {
+        cout << "Error reading record " << loc.id << " from " << fileNames[loc.fileIndex] << "\n";
+        return false;
+    }
+    oldRecordCache.put(loc.id, out);
+    return true;
+}
+void ensurePassportsLoaded() {
+    // Mutations and uniqueness checks work on the full lists
+    lock_guard<mutex> writeLock(storeMutex);
+    if (newListMaterialized && oldListMaterialized) {
+        if (!bloomFiltersValid) rebuildBloomFilters();
+        return;
+    }
+    lockInstance(); // Other instances may be saving
+    if (!newListMaterialized) {
+        loadNewPassportsFromFile();
+        newLocations.clear();
+        newLocationById.clear();
+        newRecordCache.clear();
+        newListMaterialized = true;
+    }
+    if (!oldListMaterialized) {
+        loadOldPassportsFromFile();
+        oldLocations.clear();
+        oldLocationById.clear();
+        oldRecordCache.clear();
+        oldListMaterialized = true;
+    }
+    exitIfDataDamaged();
+    syncWithChangeFeed();
+    // The filters from startup miss what other instances added since
+    if (!loadBloomFilters()) rebuildBloomFilters();
+    unlockInstance();
+}
+// --- Duplicate Applicant Detection ---
+// Records are grouped into blocks by date of birth plus the Soundex code of
+// the first or last name token, and only records sharing a block are compared
+// with a bounded edit distance. That keeps a full scan close to linear.
+const int DUPLICATE_MAX_EDITS = 2;
+string normalizeName(const string& name) {
+    string normalized;
+    bool pendingSpace = false;
+    for (char c : name) {
+        if (isalpha(static_cast<unsigned char>(c))) {
+            if (pendingSpace && !normalized.empty()) normalized += ' ';
+            normalized += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+            pendingSpace = false;
+        } else if (c == ' ') {
+            pendingSpace = true;
+        }
+    }
+    return normalized;
+}
+string soundexCode(const string& word) {
+    //                     abcdefghijklmnopqrstuvwxyz
+    static const char codes[] = "01230120022455012623010202";
+    string code;
+    char last = 0;
+    for (char c : word) {
+        if (c < 'a' || c > 'z') continue;
+        char digit = codes[c - 'a'];
+        if (code.empty()) {
+            code += c;
+        } else if (digit != '0' && digit != last) {
+            code += digit;
+            if (code.size() == 4) break;
+        }
+        if (c != 'h' && c != 'w') last = digit; // h and w do not separate equal codes
+    }
+    while (!code.empty() && code.size() < 4) code += '0';
+    return code;
+}
+// Levenshtein distance restricted to a diagonal band; returns maxDistance + 1
+// as soon as the distance is known to exceed maxDistance.
+int boundedEditDistance(const string& a, const string& b, int maxDistance) {
+    const int n = static_cast<int>(a.size()), m = static_cast<int>(b.size());
+    const int INF = maxDistance + 1;
+    if (abs(n - m) > maxDistance) return INF;
+    static vector<int> prev, cur;
+    prev.assign(m + 2, INF);
+    cur.assign(m + 2, INF);
+    for (int j = 0; j <= min(m, maxDistance); ++j) prev[j] = j;
+    for (int i = 1; i <= n; ++i) {
+        int lo = max(1, i - maxDistance), hi = min(m, i + maxDistance);
+        cur[0] = i <= maxDistance ? i : INF;
+        cur[lo - 1] = lo == 1 ? cur[0] : INF;
+        int rowMin = cur[lo - 1];
+        for (int j = lo; j <= hi; ++j) {
+            int value = prev[j - 1] + (a[i - 1] != b[j - 1] ? 1 : 0);
+            value = min(value, prev[j] + 1);
+            value = min(value, cur[j - 1] + 1);
+            cur[j] = min(value, INF);
+            rowMin = min(rowMin, cur[j]);
+        }
+        cur[hi + 1] = INF;
+        if (rowMin >= INF) return INF;
+        swap(prev, cur);
+    }
+    return prev[m];
+}
+struct ApplicantKey {
+    const string* id;
+    const string* name;
+    const string* dob;
+    string normalizedName;
+    bool isOld;
+};
+void addBlockingKeys(unordered_map<string, vector<size_t>>& blocks, const ApplicantKey& applicant, size_t index) {
+    for (const string& key : applicantBlockingKeys(applicant.normalizedName, *applicant.dob)) blocks[key].push_back(index);
+}
+void collectApplicants(vector<ApplicantKey>& applicants) {
+    for (NewPassport* temp = newHead; temp != nullptr; temp = temp->next) {
+        applicants.push_back({&temp->id, &temp->name, &temp->dob, normalizeName(temp->name), false});
+    }
+    for (OldPassport* temp = oldHead; temp != nullptr; temp = temp->next) {
+        applicants.push_back({&temp->id, &temp->name, &temp->dob, normalizeName(temp->name), true});
+    }
+}
+void printApplicant(const ApplicantKey& applicant) {
+    cout << "  " << (applicant.isOld ? "Old" : "New") << " ID " << *applicant.id << ": "
+         << *applicant.name << ", DOB: " << *applicant.dob << "\n";
+}
+void findDuplicateApplicants() {
+    ensurePassportsLoaded();
+    lock_guard<mutex> readLock(storeMutex); // Walks the live lists
+    clock_t start = clock();
+    vector<ApplicantKey> applicants;
+    collectApplicants(applicants);
+    unordered_map<string, vector<size_t>> blocks;
+    blocks.reserve(applicants.size() * 2);
+    for (size_t i = 0; i < applicants.size(); ++i) addBlockingKeys(blocks, applicants[i], i);
+    unordered_set<uint64_t> reported;
+    for (const auto& block : blocks) {
+        const vector<size_t>& members = block.second;
+        for (size_t x = 0; x < members.size(); ++x) {
+            for (size_t y = x + 1; y < members.size(); ++y) {
+                const ApplicantKey& a = applicants[members[x]];
+                const ApplicantKey& b = applicants[members[y]];
+                int distance = boundedEditDistance(a.normalizedName, b.normalizedName, DUPLICATE_MAX_EDITS);
+                if (distance > DUPLICATE_MAX_EDITS) continue;
+                uint64_t pairKey = (static_cast<uint64_t>(members[x]) << 32) | members[y];
+                if (!reported.insert(pairKey).second) continue; // Same pair found through both name tokens
+                cout << "Possible duplicate (edit distance " << distance << "):\n";
+                printApplicant(a);
+                printApplicant(b);
+            }
+        }
+    }
+    double seconds = static_cast<double>(clock() - start) / CLOCKS_PER_SEC;
+    cout << reported.size() << " possible duplicate pair(s) among " << applicants.size()
+         << " records (" << fixed << setprecision(2) << seconds << "s).\n";
+}
+// On-create check: warns about similar applicants with the same date of birth
+// and lets the clerk cancel. Returns true when creation should continue. Only
+// the records in the applicant's blocks are compared (see newApplicants).
+bool confirmNotDuplicate(const string& name, const string& dob) {
+    string normalized = normalizeName(name);
+    bool found = false;
+    auto warnIfSimilar = [&](const char* list, const auto* record) {
+        if (boundedEditDistance(normalized, normalizeName(record->name), DUPLICATE_MAX_EDITS) > DUPLICATE_MAX_EDITS) return;
+        if (!found) cout << "Warning: similar applicant(s) with the same date of birth already exist:\n";
+        cout << "  " << list << " ID " << record->id << ": " << record->name << "\n";
+        found = true;
+    };
+    {
+        lock_guard<mutex> readLock(storeMutex); // Released before the clerk answers
+        newApplicants.forEachCandidate(normalized, dob, [&](const NewPassport* record) { warnIfSimilar("New", record); });
+        oldApplicants.forEachCandidate(normalized, dob, [&](const OldPassport* record) { warnIfSimilar("Old", record); });
+    }
+    if (!found) return true;
+    string answer;
+    do {
+        cout << "Continue anyway? (Yes/No): ";
+        getline(cin, answer);
+    } while (answer != "Yes" && answer != "No");
+    return answer == "Yes";
+}
+// --- External Merge Sort ---
+// Sorts the CSV files of one list into a single output file without loading
+// the records. Input is cut into runs of at most externalSortRunBytes, up to
+// one run per core is sorted and written in parallel, and the run files are
+// then k-way merged. Each run is held with its sort keys and line positions,
+// so memory use is about cores * 2 * run size for names of typical length;
+// the merge holds one line per run.
+size_t externalSortRunBytes = 64 << 20;
+struct SortLine {
+    string key;    // Sort fields joined by \x1f so plain string order matches field order
+    size_t offset; // Position of the line in the run buffer
+    size_t length;
+};
+string externalSortKey(const string& line, int sortOption) {
+    // Both record layouts start with PassType,ID,Name
+    size_t c1 = line.find(','), c2 = line.find(',', c1 + 1), c3 = line.find(',', c2 + 1);
+    if (c1 == string::npos || c2 == string::npos) return line;
+    string passType = line.substr(0, c1), id = line.substr(c1 + 1, c2 - c1 - 1);
+    string name = line.substr(c2 + 1, c3 == string::npos ? string::npos : c3 - c2 - 1);
+    return sortOption == 1 ? name + '\x1f' + passType + '\x1f' + id : passType + '\x1f' + name + '\x1f' + id;
+}
+void sortAndWriteRun(string* buffer, const string& runFileName, int sortOption, int* ok) {
+    vector<SortLine> lines;
+    size_t start = 0;
+    while (start < buffer->size()) {
+        size_t end = buffer->find('\n', start);
+        string line = buffer->substr(start, end - start);
+        lines.push_back({externalSortKey(line, sortOption), start, end - start});
+        start = end + 1;
+    }
+    sort(lines.begin(), lines.end(), [](const SortLine& a, const SortLine& b) { return a.key < b.key; });
+    ofstream out(runFileName, ios::binary | ios::trunc); // Written line by line, not as a second copy of the run
+    for (const SortLine& line : lines) {
+        out.write(buffer->data() + line.offset, static_cast<streamsize>(line.length)).put('\n');
+    }
+    out.close();
+    *ok = out ? 1 : 0;
+}
+// A new, empty run file whose name no other sort uses; "" if none can be made
+string createRunFile(size_t index) {
+#ifdef HAVE_POSIX_IO
+    (void)index;
+    char name[] = "extsort_run_XXXXXX";
+    int fd = mkstemp(name);
+    if (fd < 0) return "";
+    close(fd);
+    return name;
+#else
+    string name = "extsort_run" + to_string(index) + ".tmp";
+    return ofstream(name, ios::trunc) ? name : "";
+#endif
+}
+void externalSortPassports(bool oldList, int sortOption) {
+    const string newFiles[] = {regularFileName, urgentFileName};
+    const string oldFiles[] = {expiredRegularFileName, expiredUrgentFileName};
+    const string* inputs = oldList ? oldFiles : newFiles;
+    const string outputFileName = oldList ? "sorted_old4.csv" : "sorted_new4.csv";
+    size_t workers = max(1u, thread::hardware_concurrency());
+    auto started = chrono::steady_clock::now();
+
+    // Phase 1: cut the input into sorted runs, sorting up to `workers` at once
+    string header;
+    vector<string> runFiles;
+    vector<string> buffers(workers);
+    vector<int> results(workers, 0);
+    vector<thread> running;
+    size_t filled = 0, records = 0, inputBytes = 0;
+    bool ok = true;
+    auto flushBuffers = [&]() {
+        for (size_t i = 0; i < filled; ++i) {
+            string runFile = createRunFile(runFiles.size());
+            if (runFile.empty()) {
+                results[i] = 0;
+                continue;
+            }
+            runFiles.push_back(runFile);
+            running.emplace_back(sortAndWriteRun, &buffers[i], runFile, sortOption, &results[i]);
+        }
+        for (thread& t : running) t.join();
+        running.clear();
+        for (size_t i = 0; i < filled; ++i) {
+            ok = ok && results[i] != 0;
+            buffers[i].clear();
+        }
+        filled = 0;
+    };
+    for (int f = 0; f < 2; ++f) {
+        ifstream in(inputs[f]);
+        if (!in) continue;
+        string line;
+        getline(in, line);
+        if (header.empty()) header = line;
+        while (getline(in, line)) {
+            if (line.empty()) continue;
+            inputBytes += line.size() + 1;
+            ++records;
+            if (buffers[filled].size() + line.size() + 1 > externalSortRunBytes && !buffers[filled].empty()) {
+                if (++filled == workers) flushBuffers();
+            }
+            buffers[filled] += line;
+            buffers[filled] += '\n';
+        }
+    }
+    if (!buffers[filled].empty()) ++filled;
+    flushBuffers();
+    if (!ok) {
+        cout << "Error writing sort runs.\n";
+        for (const string& run : runFiles) remove(run.c_str());
+        return;
+    }
+
+    // Phase 2: k-way merge of the runs
+    struct RunReader {
+        ifstream in;
+        string line, key;
+    };
+    vector<RunReader> readers(runFiles.size());
+    typedef pair<string, size_t> HeapEntry; // (key, run index)
+    priority_queue<HeapEntry, vector<HeapEntry>, greater<HeapEntry>> heap;
+    for (size_t i = 0; i < runFiles.size(); ++i) {
+        readers[i].in.open(runFiles[i]);
+        if (getline(readers[i].in, readers[i].line)) heap.push(HeapEntry(externalSortKey(readers[i].line, sortOption), i));
+    }
+    ofstream out(outputFileName, ios::trunc);
+    if (!out) {
+        cout << "Error opening file " << outputFileName << " for writing!\n";
+        for (size_t i = 0; i < runFiles.size(); ++i) {
+            readers[i].in.close();
+            remove(runFiles[i].c_str());
+        }
+        return;
+    }
+    string outBuffer = header + "\n";
+    while (!heap.empty()) {
+        size_t i = heap.top().second;
+        heap.pop();
+        outBuffer += readers[i].line;
+        outBuffer += '\n';
+        if (outBuffer.size() >= (1 << 20)) {
+            out << outBuffer;
+            outBuffer.clear();
+        }
+        if (getline(readers[i].in, readers[i].line)) heap.push(HeapEntry(externalSortKey(readers[i].line, sortOption), i));
+    }
+    out << outBuffer;
+    out.close();
+    for (size_t i = 0; i < runFiles.size(); ++i) {
+        readers[i].in.close();
+        remove(runFiles[i].c_str());
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    cout << "Sorted " << records << " records by " << (sortOption == 1 ? "name" : "passport type")
+         << " into " << outputFileName << " using " << runFiles.size() << " run(s) in "
+         << fixed << setprecision(2) << seconds << "s (" << (seconds > 0 ? inputBytes / 1048576.0 / seconds : 0.0)
+         << " MB/s).\n";
+}
+void externalSortMenu() {
+    int listChoice, sortOption;
+    cout << "Sort which list to file?\n1. New Passports\n2. Old Passports\nEnter choice (1 or 2): ";
+    cin >> listChoice;
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    if (listChoice != 1 && listChoice != 2) {
+        cout << "Invalid choice.\n";
+        return;
+    }
+    cout << "1. Sort by Name\n2. Sort by Passport Type\nEnter choice (1 or 2): ";
+    cin >> sortOption;
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    if (sortOption != 1 && sortOption != 2) {
+        cout << "Invalid sort option.\n";
+        return;
+    }
+    externalSortPassports(listChoice == 2, sortOption);
+}
+void createNewPassport() {
+string id, name, dob, nationality, phoneNumber, payment, paymentStatus, passType;
+    int passportTypeChoice;
+    cout << "Select Passport Type:\n1. Regular\n2. Urgent\nEnter choice (1 or 2): ";
+    cin >> passportTypeChoice;
+    cin.ignore(numeric_limits<streamsize>::max(), '\n'); // Clear buffer
+    const int MAX_ID_LEN = 10;
+    bool idFree = false;
+    do {
+        cout << "Enter ID (max " << MAX_ID_LEN << " chars, alphanumeric): ";
+        getline(cin, id);
+        if (id.length() > MAX_ID_LEN) {
+            cout << "your size is limit pls try again (max " << MAX_ID_LEN << " chars).\n";
+            continue; // Ask for input again
+        }
+        if (!isAlphanumeric(id)) {
+            cout << "Invalid ID: Must be alphanumeric.\n";
+            continue;
+        }
+        idFree = underStoreMutex([&] { return isUniqueNewID(id); });
+        if (!idFree) {
+            cout << (ownsShardKey(id) ? "Error: This ID already exists.\n" : "Error: This ID belongs to another shard.\n");
+        }
+    } while (!idFree);
+    ensurePassportsLoaded(); // Only once the ID is known to be free
+    const int MAX_NAME_LEN = 25;
+    do {
+        cout << "Enter Full Name (max " << MAX_NAME_LEN << " chars, letters only): ";
+        getline(cin, name);
+        if (name.length() > MAX_NAME_LEN) {
+            cout << "your size is limit pls try again (max " << MAX_NAME_LEN << " chars).\n";
+            continue;
+        }
+        if (!isLettersOnly(name)) cout << "Invalid name: Must contain letters only.\n";
+    } while (name.length() > MAX_NAME_LEN || !isLettersOnly(name));
+    do {
+        cout << "Enter Date of Birth (YYYY-MM-DD): ";
+        getline(cin, dob);
+        if (!isValidDate(dob)) cout << "Invalid format. Try again.\n";
+        else if (!isOver18(dob)) cout << "Error: Applicant must be 18 or older.\n";
+    } while (!isValidDate(dob) || !isOver18(dob));
+    if (!confirmNotDuplicate(name, dob)) {
+        cout << "Passport creation cancelled.\n";
+        return;
+    }
+    const int MAX_NATIONALITY_LEN = 15;
+    do {
+        cout << "Enter Nationality (max " << MAX_NATIONALITY_LEN << " chars, letters only): ";
+        getline(cin, nationality);
+        if (nationality.length() > MAX_NATIONALITY_LEN) {
+            cout << "your size is limit pls try again (max " << MAX_NATIONALITY_LEN << " chars).\n";
+            continue;
+        }
+        if (!isLettersOnly(nationality)) cout << "Invalid nationality: Must contain letters only.\n";
+    } while (nationality.length() > MAX_NATIONALITY_LEN || !isLettersOnly(nationality));
+    const int MAX_PHONE_LEN = 12;
+    do {
+        cout << "Enter Phone Number (max " << MAX_PHONE_LEN << " chars, numbers only): ";
+        getline(cin, phoneNumber);
+        if (phoneNumber.length() > MAX_PHONE_LEN) {
+            cout << "your size is limit pls try again (max " << MAX_PHONE_LEN << " chars).\n";
+            continue;
+        }
+        if (!isNumbersOnly(phoneNumber)) cout << "Invalid phone number: Must contain numbers only.\n";
+    } while (phoneNumber.length() > MAX_PHONE_LEN || !isNumbersOnly(phoneNumber));
+    if (passportTypeChoice == 1) {
+        payment = to_string(regularPassportFee);
+        passType = "Regular";
+        cout << "Payment Amount: $" << payment << " (Regular Passport)\n";
+    } else if (passportTypeChoice == 2) {
+        payment = to_string(urgentPassportFee);
+        passType = "Urgent";
+        cout << "Payment Amount: $" << payment << " (Urgent Passport)\n";
+    } else {
+        cout << "Invalid passport type choice. Passport creation cancelled.\n";
+        return;
+    }
+    do {
+        cout << "Is payment confirmed? (Yes/No): ";
+        getline(cin, paymentStatus);
+        if (paymentStatus != "Yes" && paymentStatus != "No") {
+            cout << "Invalid status: Must be Yes or No.\n";
+        }
+    } while (paymentStatus != "Yes" && paymentStatus != "No");
+    if (paymentStatus != "Yes") {
+        cout << "Error: Passport cannot be created until payment is confirmed.\n";
+        return;
+    }
+    string createdDate = getCurrentDate();
+    cout << "Created Date (auto-set): " << createdDate << "\n";
+    string appointmentDate;
+    if (passType == "Regular") {
+        appointmentDate = getDateOneMonthLater(createdDate);
+        cout << "Appointment Date (auto-set, 1 month from creation): " << appointmentDate << "\n";
+    } else {
+        appointmentDate = getDateTwoDaysLater(createdDate);
+        cout << "Appointment Date (auto-set, 2 days from creation): " << appointmentDate << "\n";
+    }
+    if (!isValidDate(appointmentDate)) {
+        cout << "Error: Invalid appointment date generated. Passport creation cancelled.\n";
+        return;
+    }
+    lock_guard<mutex> writeLock(storeMutex);
+    InstanceCommit commit;
+    if (!isUniqueNewID(id)) { // Another terminal, the watcher or the sweeper may have changed the lists
+        cout << "Error: a passport with this ID was created meanwhile. Passport creation cancelled.\n";
+        return;
+    }
+  // Create a new node and add to the end of the list
+    NewPassport* newPass = newPool.allocate();
+    newPass->passType = passType;
+    newPass->id = id;
+    newPass->name = name;
+    newPass->dob = dob;
+    newPass->nationality = nationality;
+    newPass->phoneNumber = phoneNumber;
+    newPass->createdDate = createdDate;
+    newPass->appointmentDate = appointmentDate;
+    newPass->payment = payment;
+    newPass->paymentStatus = paymentStatus;
+    linkNewPassport(newPass);
+    onNewPassportInserted(newPass);
+    saveNewPassportsToFile();
+    cout << "New passport added successfully!\n";
+}
+const string sampleOldPassports[5][8] = {
+    {"001", "Abebea", "1990-05-15", "2015-06-01", "2020-06-01", "P123", "ACC1001", "20000.00"},
+    {"002", "Aster", "1985-08-22", "2014-09-10", "2019-09-10", "P234", "ACC1002", "3000.00"},
+    {"003", "abdi", "1992-03-10", "2016-04-15", "2021-04-15", "P345", "ACC1003", "35000.00"},
+    {"004", "Lami", "1988-11-30", "2013-12-05", "2018-12-05", "P456", "ACC1004", "10000.00"},
+    {"005", "Robel", "1995-07-20", "2017-08-25", "2022-08-25", "P567", "ACC1005", "40000.00"},
+};
+// Asks which sample record to create and returns its row, or -1
+int chooseSampleOldPassport() {
+    int searchOption;
+    string searchValue;
+    int index = -1;
+    cout << "Search Old Record By:\n";
+    cout << "1. ID\n2. Name\n3. Passport Number\nEnter choice: ";
+    cin >> searchOption;
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    switch (searchOption) {
+        case 1:
+            cout << "Enter ID (or ## to cancel): ";
+            getline(cin, searchValue);
+            if (searchValue == "##") return -1;
+            for (int i = 0; i < 5; ++i) {
+                if (sampleOldPassports[i][0] == searchValue) {
+                    index = i;
+                    break;
+                }
+            }
+            break;
+        case 2:
+            cout << "Enter Name: ";
+            getline(cin, searchValue);
+            for (int i = 0; i < 5; ++i) {
+                if (sampleOldPassports[i][1] == searchValue) {
+                    index = i;
+                    break;
+                }
+            }
+            break;
+        case 3:
+            cout << "Enter Passport Number: ";
+            getline(cin, searchValue);
+            for (int i = 0; i < 5; ++i) {
+                if (sampleOldPassports[i][5] == searchValue) {
+                    index = i;
+                    break;
+                }
+            }
+            break;
+        default:
+            cout << "Invalid search option.\n";
+            return -1;
+    }
+    if (index == -1) cout << "No matching record found.\n";
+    return index;
+}
+void createOldPassports() {
+    cout << "--- Create Old Passport ---\n";
+    int index = chooseSampleOldPassport();
+    if (index == -1) return;
+    int typeChoice;
+    string passType="expired";
+    cout << "Select Passport Type:\n1. Expired Regular\n2. Expired Urgent\nEnter choice (1 or 2): ";
+    cin >> typeChoice;
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    if (typeChoice == 1) passType = "ExpiredRegular";
+    else if (typeChoice == 2) passType = "ExpiredUrgent";
+    else {
+        cout << "Invalid passport type choice. Operation cancelled.\n";
+        return;
+    }
+    string enteredId = sampleOldPassports[index][0];
+    string enteredPassportNumber = sampleOldPassports[index][5];
+    if (!isAlphanumeric(enteredId)) {
+        cout << "Invalid ID: Must be alphanumeric.\n";
+        return;
+    }
+    if (!underStoreMutex([&] { return isUniqueOldID(enteredId); })) {
+        cout << "Error: This ID already exists in the system.\n";
+        return;
+    }
+    ensurePassportsLoaded(); // Passport numbers are only indexed in the loaded list
+    if (!underStoreMutex([&] { return isUniquePassportNumber(enteredPassportNumber); })) {
+        cout << "Error: Passport number already exists in the system.\n";
+        return;
+    }
+    if (!confirmNotDuplicate(sampleOldPassports[index][1], sampleOldPassports[index][2])) {
+        cout << "Operation cancelled.\n";
+        return;
+    }
+    lock_guard<mutex> writeLock(storeMutex);
+    InstanceCommit commit;
+    if (!isUniqueOldID(enteredId) || !isUniquePassportNumber(enteredPassportNumber)) {
+        cout << "Error: a passport with this ID or passport number was created meanwhile."
+             << " Passport creation cancelled.\n";
+        return;
+    }
+    // Create and fill old passport object
+    OldPassport* oldPass = oldPool.allocate();
+    oldPass->passType = passType;
+    oldPass->id = enteredId;
+    oldPass->name = sampleOldPassports[index][1];
+    oldPass->dob = sampleOldPassports[index][2];
+    oldPass->issueDate = sampleOldPassports[index][3];
+    oldPass->expiredDate = sampleOldPassports[index][4];
+    oldPass->passportNumber = enteredPassportNumber;
+    oldPass->accountNumber = sampleOldPassports[index][6];
+    oldPass->balance = stod(sampleOldPassports[index][7]);
+    oldPass->createdDate = getCurrentDate();
+    oldPass->appointmentDate = (passType == "ExpiredRegular")
+                                ? getDateOneMonthLater(oldPass->createdDate)
+                                : getDateTwoDaysLater(oldPass->createdDate);
+    oldPass->payment = "0.0";
+    oldPass->paymentStatus = "Pending";
+    linkOldPassport(oldPass);
+    onOldPassportInserted(oldPass);
+    cout << "Old Passport Created:\n";
+    cout << "ID: " << oldPass->id
+         << " | Name: " << oldPass->name
+         << " | DOB: " << oldPass->dob
+         << " | Issue Date: " << oldPass->issueDate
+         << " | Expired Date: " << oldPass->expiredDate
+         << " | Passport No.: " << oldPass->passportNumber
+         << " | Balance: $" << fixed << setprecision(2) << oldPass->balance
+         << " | Type: " << oldPass->passType
+         << " | Created: " << oldPass->createdDate
+         << " | Appointment: " << oldPass->appointmentDate
+         << " | Payment: " << oldPass->payment
+         << " | Status: " << oldPass->paymentStatus << "\n";
+    saveOldPassportsToFile();
+    cout << "--- Passport creation completed ---\n";
+}
+void updateNewPassport() {
+    ensurePassportsLoaded();
+string idToUpdate;
+    cout << "Enter New Passport ID to update: ";
+    getline(cin, idToUpdate);
+
+    NewPassport original{}; // Prompts show this copy; the commit checks the record still matches it
+    bool found = underStoreMutex([&] {
+        NewPassport* record = newIdIndex.find(idToUpdate);
+        if (record != nullptr) original = *record;
+        return record != nullptr;
+    });
+
+    if (found) {
+
+        string newId, newName, newDob, newNationality, newPhoneNumber, newPayment, paymentStatus, newPassType;
+        int passportTypeChoice;
+
+        cout << "Select New Passport Type:\n1. Regular\n2. Urgent\nEnter choice (1 or 2): ";
+        cin >> passportTypeChoice;
+        cin.ignore(numeric_limits<streamsize>::max(), '\n'); // Clear buffer
+
+        const int MAX_ID_LEN = 10;
+        bool idFree = false;
+        do {
+            cout << "Enter New ID (max " << MAX_ID_LEN << " chars, alphanumeric, current: " << original.id << "): ";
+            getline(cin, newId);
+            if (newId.length() > MAX_ID_LEN) {
+                cout << "your size is limit pls try again (max " << MAX_ID_LEN << " chars).\n";
+                continue;
+            }
+            if (!isAlphanumeric(newId)) {
+                cout << "Invalid ID: Must be alphanumeric.\n";
+                continue;
+            }
+            idFree = underStoreMutex([&] { return isUniqueNewID(newId, original.id); });
+            if (!idFree) {
+                cout << (ownsShardKey(newId) ? "Error: This ID already exists.\n"
+                                             : "Error: This ID belongs to another shard; keep the current ID.\n");
+            }
+        } while (!idFree);
+
+        const int MAX_NAME_LEN = 25;
+        do {
+            cout << "Enter New Full Name (max " << MAX_NAME_LEN << " chars, letters only, current: " << original.name << "): ";
+            getline(cin, newName);
+            if (newName.length() > MAX_NAME_LEN) {
+                cout << "your size is limit pls try again (max " << MAX_NAME_LEN << " chars).\n";
+                continue;
+            }
+            if (!isLettersOnly(newName)) cout << "Invalid name: Must contain letters only.\n";
+        } while (newName.length() > MAX_NAME_LEN || !isLettersOnly(newName));
+
+        do {
+            cout << "Enter New Date of Birth (YYYY-MM-DD, current: " << original.dob << "): ";
+            getline(cin, newDob);
+            if (!isValidDate(newDob)) cout << "Invalid format. Try again.\n";
+            else if (!isOver18(newDob)) cout << "Error: Applicant must be 18 or older.\n";
+        } while (!isValidDate(newDob) || !isOver18(newDob));
+
+
+        const int MAX_NATIONALITY_LEN = 15;
+        do {
+            cout << "Enter New Nationality (max " << MAX_NATIONALITY_LEN << " chars, letters only, current: " << original.nationality << "): ";
+            getline(cin, newNationality);
+            if (newNationality.length() > MAX_NATIONALITY_LEN) {
+                cout << "your size is limit pls try again (max " << MAX_NATIONALITY_LEN << " chars).\n";
+                continue;
+            }
+            if (!isLettersOnly(newNationality)) cout << "Invalid nationality: Must contain letters only.\n";
+        } while (newNationality.length() > MAX_NATIONALITY_LEN || !isLettersOnly(newNationality));
+
+        const int MAX_PHONE_LEN = 12;
+        do {
+            cout << "Enter New Phone Number (max " << MAX_PHONE_LEN << " chars, numbers only, current: " << original.phoneNumber << "): ";
+            getline(cin, newPhoneNumber);
+            if (newPhoneNumber.length() > MAX_PHONE_LEN) {
+                cout << "your size is limit pls try again (max " << MAX_PHONE_LEN << " chars).\n";
+                continue;
+            }
+            if (!isNumbersOnly(newPhoneNumber)) cout << "Invalid phone number: Must contain numbers only.\n";
+        } while (newPhoneNumber.length() > MAX_PHONE_LEN || !isNumbersOnly(newPhoneNumber));
+
+        if (passportTypeChoice == 1) {
+            newPayment = to_string(regularPassportFee);
+            newPassType = "Regular";
+            cout << "Payment Amount: $" << newPayment << " (Regular Passport)\n";
+        } else if (passportTypeChoice == 2) {
+            newPayment = to_string(urgentPassportFee);
+            newPassType = "Urgent";
+            cout << "Payment Amount: $" << newPayment << " (Urgent Passport)\n";
+        } else {
+            cout << "Invalid passport type choice. Update cancelled.\n";
+            return;
+        }
+
+        do {
+            cout << "Is payment confirmed? (Yes/No): ";
+            getline(cin, paymentStatus);
+            if (paymentStatus != "Yes" && paymentStatus != "No") {
+                cout << "Invalid status: Must be Yes or No.\n";
+            }
+        } while (paymentStatus != "Yes" && paymentStatus != "No");
+
+        if (paymentStatus != "Yes") {
+            cout << "Error: Passport cannot be updated until payment is confirmed.\n";
+            return;
+        }
+
+        string createdDate = getCurrentDate();
+        cout << "Created Date (auto-set): " << createdDate << "\n";
+
+        string appointmentDate;
+        if (newPassType == "Regular") {
+            appointmentDate = getDateOneMonthLater(createdDate);
+            cout << "Appointment Date (auto-set, 1 month from creation): " << appointmentDate << "\n";
+        } else {
+            appointmentDate = getDateTwoDaysLater(createdDate);
+            cout << "Appointment Date (auto-set, 2 days from creation): " << appointmentDate << "\n";
+        }
+        if (!isValidDate(appointmentDate)) {
+            cout << "Error: Invalid appointment date generated. Passport creation cancelled.\n";
+            return;
+        }
+        lock_guard<mutex> writeLock(storeMutex);
+        InstanceCommit commit;
+        NewPassport* current = newIdIndex.find(idToUpdate);
+        if (current == nullptr || !sameFields(*current, original) || !isUniqueNewID(newId, idToUpdate)) {
+            cout << "Error: this passport was changed meanwhile. Update cancelled.\n";
+            return;
+        }
+        // Update the struct fields of the found node
+        NewPassport before = beginRecordChange(current);
+        current->passType = newPassType;
+        current->id = newId;
+        current->name = newName;
+        current->dob = newDob;
+        current->nationality = newNationality;
+        current->phoneNumber = newPhoneNumber;
+        current->createdDate = createdDate;
+        current->appointmentDate = appointmentDate;
+        current->payment = newPayment;
+        current->paymentStatus = paymentStatus;
+        repositionNewPassport(current);
+        onNewPassportUpdated(before, current);
+
+        saveNewPassportsToFile();
+        cout << "New passport updated successfully!\n";
+    } else {
+        cout << "New passport ID not found.\n";
+    }
+
+}
+void updateOldPassport() {
+    ensurePassportsLoaded();
+ string idToUpdate;
+    cout << "Enter Old Passport ID to update: ";
+    getline(cin, idToUpdate);
+
+    OldPassport original{}; // Prompts show this copy; the commit checks the record still matches it
+    bool found = underStoreMutex([&] {
+        OldPassport* record = oldIdIndex.find(idToUpdate);
+        if (record != nullptr) original = *record;
+        return record != nullptr;
+    });
+
+    if (found) {
+
+        string newId, newName, newDob, enteredPassportNumber, enteredAccountNumber, newPayment, newPaymentStatus, newPassType;
+        double enteredBalance;
+        int urgencyChoice;
+        cout << "Select Urgency:\n1. Regular\n2. Urgent\nEnter choice (1 or 2): ";
+        cin >> urgencyChoice;
+        cin.ignore(numeric_limits<streamsize>::max(), '\n'); // Clear buffer
+
+        newPassType = std::string("Expired") + (urgencyChoice == 1 ? "Regular" : "Urgent");
+        const int MAX_ID_LEN = 10;
+        bool idFree = false;
+        do {
+            cout << "Enter New ID (max " << MAX_ID_LEN << " chars, alphanumeric, current: " << original.id << "): ";
+            getline(cin, newId);
+            if (newId.length() > MAX_ID_LEN) {
+                cout << "your size is limit pls try again (max " << MAX_ID_LEN << " chars).\n";
+                continue;
+            }
+            if (!isAlphanumeric(newId)) {
+                cout << "Invalid ID: Must be alphanumeric.\n";
+                continue;
+            }
+            idFree = underStoreMutex([&] { return isUniqueOldID(newId, original.id); });
+            if (!idFree) {
+                cout << (ownsShardKey(newId) ? "Error: This ID already exists.\n"
+                                             : "Error: This ID belongs to another shard; keep the current ID.\n");
+            }
+        } while (!idFree);
+
+        const int MAX_NAME_LEN = 25;
+        do {
+            cout << "Enter New Full Name (max " << MAX_NAME_LEN << " chars, letters only, current: " << original.name << "): ";
+            getline(cin, newName);
+            if (newName.length() > MAX_NAME_LEN) {
+                cout << "your size is limit pls try again (max " << MAX_NAME_LEN << " chars).\n";
+                continue;
+            }
+            if (!isLettersOnly(newName)) cout << "Invalid name: Must contain letters only.\n";
+        } while (newName.length() > MAX_NAME_LEN || !isLettersOnly(newName));
+
+        do {
+            cout << "Enter New Date of Birth (YYYY-MM-DD, current: " << original.dob << "): ";
+            getline(cin, newDob);
+            if (!isValidDate(newDob)) cout << "Invalid format. Try again.\n";
+        } while (!isValidDate(newDob));
+
+        const int MAX_PASSPORT_NUM_LEN = 8; 
+        do {
+            cout << "Confirm Passport Number (current: " << original.passportNumber << ", max " << MAX_PASSPORT_NUM_LEN << " chars): ";
+            getline(cin, enteredPassportNumber);
+            if (enteredPassportNumber.length() > MAX_PASSPORT_NUM_LEN) {
+                cout << "your size is limit pls try again (max " << MAX_PASSPORT_NUM_LEN << " chars).\n";
+                continue;
+            }
+            if (enteredPassportNumber != original.passportNumber) {
+                cout << "Your passport number is incorrect. Please enter the correct passport number.\n";
+            }
+        } while (enteredPassportNumber.length() > MAX_PASSPORT_NUM_LEN || enteredPassportNumber != original.passportNumber);
+         do {
+            cout << "Confirm your Balance (current: $" << fixed << setprecision(2) << original.balance << "): ";
+            cin >> enteredBalance;
+            cin.ignore(numeric_limits<streamsize>::max(), '\n'); // Clear buffer
+
+            if (enteredBalance != original.balance) { // New check: balance must match current
+                cout << "Your entered balance is incorrect. Please enter the current balance.\n";
+            }
+        } while ( enteredBalance != original.balance); // Loop until valid and matching balance
+
+        double paymentAmount = 0.0; // Declare and initialize paymentAmount as double
+        if (urgencyChoice == 1) {
+            newPayment = to_string(regularPassportFee);
+            paymentAmount = regularPassportFee;
+            cout << "Payment Amount: $" << newPayment << " (Regular Passport)\n";
+        } else if (urgencyChoice == 2) {
+            newPayment = to_string(urgentPassportFee);
+            paymentAmount = urgentPassportFee;
+            cout << "Payment Amount: $" << newPayment << " (Urgent Passport)\n";
+        } else {
+            cout << "Invalid urgency choice. Update cancelled.\n";
+            return;
+        }
+        if (enteredBalance < paymentAmount) {
+            cout << "Your balance is minimum. Passport cannot be updated.\n";
+            return;
+        } else {
+            enteredBalance -= paymentAmount;
+            cout << "Payment successful. New balance: $" << fixed << setprecision(2) << enteredBalance << "\n";
+        }
+
+        do {
+            cout << "Is payment confirmed? (Yes/No): ";
+            getline(cin, newPaymentStatus);
+            if (newPaymentStatus != "Yes" && newPaymentStatus != "No") {
+                cout << "Invalid status: Must be Yes or No.\n";
+            }
+        } while (newPaymentStatus != "Yes" && newPaymentStatus != "No");
+
+        if (newPaymentStatus != "Yes") {
+            cout << "Error: Passport cannot be updated until payment is confirmed.\n";
+            return;
+        }
+
+        string createdDate = getCurrentDate();
+        cout << "Created Date (auto-set): " << createdDate << "\n";
+
+        string appointmentDate;
+        if (newPassType == "ExpiredRegular") {
+            appointmentDate = getDateOneMonthLater(createdDate);
+            cout << "Appointment Date (auto-set, 1 month from creation): " << appointmentDate << "\n";
+        } else { // ExpiredUrgent
+            appointmentDate = getDateTwoDaysLater(createdDate);
+            cout << "Appointment Date (auto-set, 2 days from creation): " << appointmentDate << "\n";
+        }
+        if (!isValidDate(appointmentDate)) {
+            cout << "Error: Invalid appointment date generated. Passport update cancelled.\n";
+            return;
+        }
+        lock_guard<mutex> writeLock(storeMutex);
+        InstanceCommit commit;
+        OldPassport* current = oldIdIndex.find(idToUpdate);
+        if (current == nullptr || !sameFields(*current, original) || !isUniqueOldID(newId, idToUpdate)) {
+            cout << "Error: this passport was changed meanwhile. Update cancelled.\n";
+            return;
+        }
+        OldPassport before = beginRecordChange(current);
+        current->passType = newPassType;
+        current->id = newId;
+        current->name = newName;
         current->dob = newDob;
-        current->nationality = newNationality;
-        current->phoneNumber = newPhoneNumber;
+        current->passportNumber = enteredPassportNumber;
+        current->accountNumber = enteredAccountNumber;
+        current->balance = enteredBalance;
         current->createdDate = createdDate;
         current->appointmentDate = appointmentDate;
         current->payment = newPayment;
-        current->paymentStatus = paymentStatus;
-
-        saveNewPassportsToFile();
-        cout << "New passport updated successfully!\n";
+        current->paymentStatus = newPaymentStatus;
+        repositionOldPassport(current);
+        onOldPassportUpdated(before, current);
+        saveOldPassportsToFile();
+        cout << "Old passport updated successfully!\n";
     } else {
+        cout << "Old passport ID not found.\n";
+    }
+}
+void deleteNewPassport() {
+    ensurePassportsLoaded();
+ string idToDelete;
+    cout << "Enter New Passport ID to delete: ";
+    getline(cin, idToDelete);
+    lock_guard<mutex> writeLock(storeMutex);
+    InstanceCommit commit;
+    NewPassport* current = newIdIndex.find(idToDelete);
+    if (current == nullptr) {
         cout << "New passport ID not found.\n";
+        return;
+    }
+    onNewPassportErased(current);
+    eraseRecord(current); // Unlink and free the memory
+    saveNewPassportsToFile();
+    cout << "New passport deleted successfully!\n";
+}
+void deleteOldPassport() {
+    ensurePassportsLoaded();
+string idToDelete;
+    cout << "Enter Old Passport ID to delete: ";
+    getline(cin, idToDelete);
+    lock_guard<mutex> writeLock(storeMutex);
+    InstanceCommit commit;
+    OldPassport* current = oldIdIndex.find(idToDelete);
+    if (current == nullptr) {
+        cout << "Old passport ID not found.\n";
+        return;
+    }
+    onOldPassportErased(current);
+    eraseRecord(current); // Unlink and free the memory
+    saveOldPassportsToFile();
+    cout << "Old passport deleted successfully!\n";
+}
+// --- Query Engine ---
+// Filter expressions such as
+//   type=Urgent AND status=Yes AND appointment>=2026-10-01
+// are compiled once into a list of typed predicates, most selective first.
+// An equality on name or type walks the matching range of an ordered index;
+// anything else is a scan over the read snapshot. Operators are
+// = != < <= > >= and ~ (contains). Dates compare as text, which orders them
+// because they are stored as YYYY-MM-DD.
+enum QueryOp { QUERY_EQ, QUERY_NE, QUERY_LT, QUERY_LE, QUERY_GT, QUERY_GE, QUERY_CONTAINS };
+template <typename T>
+struct CompiledQuery {
+    struct ColumnTerm {
+        size_t field;
+        int64_t lo, hi; // Inclusive range of column values
+        bool negate;
+        string code;    // Dictionary value, resolved when the query runs
+        function<bool(const T*)> text; // Days: the term's text predicate, for rows that are not exact dates
+    };
+    vector<function<bool(const T*)>> predicates; // Every term
+    vector<function<bool(const T*)>> residual;   // Terms the columns cannot answer
+    vector<ColumnTerm> columnTerms;
+    string indexField; // "name" or "type" when an equality can drive an ordered index
+    string indexValue;
+    static bool all(const vector<function<bool(const T*)>>& list, const T* record) {
+        for (const auto& predicate : list) {
+            if (!predicate(record)) return false;
+        }
+        return true;
+    }
+    bool matches(const T* record) const { return all(predicates, record); }
+};
+string trimmed(const string& text) {
+    size_t first = text.find_first_not_of(" \t");
+    if (first == string::npos) return "";
+    return text.substr(first, text.find_last_not_of(" \t") - first + 1);
+}
+string lowercase(string text) {
+    for (char& c : text) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    return text;
+}
+template <typename T>
+function<bool(const T*)> textPredicate(string T::*member, QueryOp op, const string& value) {
+    switch (op) {
+        case QUERY_EQ: return [member, value](const T* r) { return r->*member == value; };
+        case QUERY_NE: return [member, value](const T* r) { return r->*member != value; };
+        case QUERY_LT: return [member, value](const T* r) { return r->*member < value; };
+        case QUERY_LE: return [member, value](const T* r) { return r->*member <= value; };
+        case QUERY_GT: return [member, value](const T* r) { return r->*member > value; };
+        case QUERY_GE: return [member, value](const T* r) { return r->*member >= value; };
+        default: return [member, value](const T* r) { return (r->*member).find(value) != string::npos; };
+    }
+}
+template <typename T>
+function<bool(const T*)> numberPredicate(double (*number)(const T*), QueryOp op, double value) {
+    switch (op) {
+        case QUERY_EQ: return [number, value](const T* r) { return number(r) == value; };
+        case QUERY_NE: return [number, value](const T* r) { return number(r) != value; };
+        case QUERY_LT: return [number, value](const T* r) { return number(r) < value; };
+        case QUERY_LE: return [number, value](const T* r) { return number(r) <= value; };
+        case QUERY_GT: return [number, value](const T* r) { return number(r) > value; };
+        default: return [number, value](const T* r) { return number(r) >= value; };
+    }
+}
+// Maps a comparison against `scaled` (days or cents) to an integer range.
+// A fractional bound is rounded toward the values the comparison admits.
+template <typename Term>
+void setColumnRange(Term& term, QueryOp op, double scaled) {
+    if (fabs(scaled - llround(scaled)) < 1e-6) scaled = static_cast<double>(llround(scaled));
+    bool integral = scaled == floor(scaled);
+    term.lo = INT64_MIN;
+    term.hi = INT64_MAX;
+    term.negate = op == QUERY_NE;
+    switch (op) {
+        case QUERY_EQ:
+        case QUERY_NE:
+            term.lo = integral ? static_cast<int64_t>(scaled) : 1;
+            term.hi = integral ? static_cast<int64_t>(scaled) : 0;
+            break;
+        case QUERY_LT: term.hi = static_cast<int64_t>(ceil(scaled)) - 1; break;
+        case QUERY_LE: term.hi = static_cast<int64_t>(floor(scaled)); break;
+        case QUERY_GT: term.lo = static_cast<int64_t>(floor(scaled)) + 1; break;
+        default: term.lo = static_cast<int64_t>(ceil(scaled)); break;
+    }
+}
+// Compiles `text` into `query`; returns an error message, empty on success
+template <typename T, size_t N>
+string compileQuery(const string& text, const QueryField<T> (&fields)[N], CompiledQuery<T>& query) {
+    struct Term {
+        const QueryField<T>* field;
+        QueryOp op;
+        string value;
+    };
+    vector<Term> terms;
+    string upper = text;
+    for (char& c : upper) c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t split = upper.find(" AND ", start);
+        string termText = trimmed(text.substr(start, split == string::npos ? string::npos : split - start));
+        start = split == string::npos ? text.size() + 1 : split + 5;
+        size_t opPos = termText.find_first_of("=!<>~");
+        if (opPos == string::npos) return "expected field, operator and value in '" + termText + "'";
+        string fieldName = lowercase(trimmed(termText.substr(0, opPos)));
+        const QueryField<T>* field = nullptr;
+        for (const QueryField<T>& candidate : fields) {
+            if (fieldName == candidate.name || fieldName == candidate.alias) field = &candidate;
+        }
+        if (field == nullptr) return "unknown field '" + fieldName + "'";
+        static const pair<const char*, QueryOp> operators[] = {
+            {"!=", QUERY_NE}, {"<=", QUERY_LE}, {">=", QUERY_GE}, {"=", QUERY_EQ},
+            {"<", QUERY_LT}, {">", QUERY_GT}, {"~", QUERY_CONTAINS}};
+        Term term = {field, QUERY_EQ, ""};
+        size_t opLength = 0;
+        for (const auto& candidate : operators) {
+            if (termText.compare(opPos, strlen(candidate.first), candidate.first) == 0) {
+                term.op = candidate.second;
+                opLength = strlen(candidate.first);
+                break;
+            }
+        }
+        if (opLength == 0) return "unknown operator in '" + termText + "'";
+        term.value = trimmed(termText.substr(opPos + opLength));
+        if (field->number != nullptr && term.op == QUERY_CONTAINS) return "'~' needs a text field";
+        terms.push_back(term);
+    }
+    // Equalities first, then ranges, then substring tests
+    stable_sort(terms.begin(), terms.end(), [](const Term& a, const Term& b) {
+        return (a.op == QUERY_EQ ? 0 : a.op == QUERY_CONTAINS ? 2 : 1) < (b.op == QUERY_EQ ? 0 : b.op == QUERY_CONTAINS ? 2 : 1);
+    });
+    for (const Term& term : terms) {
+        if (term.field->number != nullptr) {
+            char* end = nullptr;
+            double value = strtod(term.value.c_str(), &end);
+            if (term.value.empty() || *end != '\0') return "'" + string(term.field->name) + "' needs a number";
+            query.predicates.push_back(numberPredicate(term.field->number, term.op, value));
+            typename CompiledQuery<T>::ColumnTerm columnTerm = {static_cast<size_t>(term.field - fields), 0, 0, false, "", nullptr};
+            setColumnRange(columnTerm, term.op, value * 100);
+            query.columnTerms.push_back(columnTerm);
+            continue;
+        }
+        query.predicates.push_back(textPredicate(term.field->text, term.op, term.value));
+        typename CompiledQuery<T>::ColumnTerm columnTerm = {static_cast<size_t>(term.field - fields), 0, 0, false, term.value, nullptr};
+        int64_t days;
+        if (term.field->column == COLUMN_DAYS && term.op != QUERY_CONTAINS && exactDateToDays(term.value, days)) {
+            setColumnRange(columnTerm, term.op, static_cast<double>(days));
+            columnTerm.text = query.predicates.back();
+            query.columnTerms.push_back(columnTerm);
+        } else if (term.field->column == COLUMN_CODE && (term.op == QUERY_EQ || term.op == QUERY_NE)) {
+            columnTerm.negate = term.op == QUERY_NE;
+            query.columnTerms.push_back(columnTerm);
+        } else {
+            query.residual.push_back(query.predicates.back());
+        }
+        bool indexable = term.op == QUERY_EQ && (string(term.field->name) == "name" || string(term.field->name) == "type");
+        if (indexable && query.indexField != "name") { // A name range is narrower than a type range
+            query.indexField = term.field->name;
+            query.indexValue = term.value;
+        }
+    }
+    return "";
+}
+int32_t clampToInt32(int64_t value) {
+    return static_cast<int32_t>(max<int64_t>(INT32_MIN, min<int64_t>(INT32_MAX, value)));
+}
+// Filters the columns with the SIMD kernels, then checks the remaining terms
+// on the surviving rows only and hands each match to `visit`. Called with
+// storeMutex held, which keeps the records alive while they are visited.
+// A row whose date is not exact keeps its bit through the date filter and
+// gets that term's text predicate instead, so both paths agree.
+template <typename T, typename F>
+int64_t scanColumns(const CompiledQuery<T>& query, const ColumnStore<T>& columns, size_t paymentField, F visit) {
+    size_t rows = columns.size();
+    vector<uint64_t> bits((rows + 63) / 64, ~0ull), inexact(bits.size(), 0), before;
+    vector<const function<bool(const T*)>*> dateTerms;
+    if (rows % 64 != 0) bits.back() = (1ull << (rows % 64)) - 1;
+    for (const auto& term : query.columnTerms) {
+        const typename ColumnStore<T>::Column& column = columns.column(term.field);
+        int64_t lo = term.lo, hi = term.hi;
+        if (column.kind == COLUMN_CODE) {
+            auto code = column.codes.find(term.code);
+            lo = code == column.codes.end() ? 1 : code->second; // Unknown value: empty range
+            hi = code == column.codes.end() ? 0 : code->second;
+        }
+        if (column.kind == COLUMN_DAYS) before = bits;
+        if (column.kind == COLUMN_CENTS) filterColumn(column.wide.data(), rows, lo, hi, term.negate, bits.data());
+        else filterColumn(column.narrow.data(), rows, clampToInt32(lo), clampToInt32(hi), term.negate, bits.data());
+        if (column.kind == COLUMN_DAYS) {
+            for (size_t w = 0; w < bits.size(); ++w) {
+                uint64_t pending = before[w] & ~column.exact[w];
+                bits[w] = (bits[w] & column.exact[w]) | pending;
+                inexact[w] |= pending;
+            }
+            dateTerms.push_back(&term.text);
+        }
+    }
+    for (size_t w = 0; w < bits.size(); ++w) {
+        for (uint64_t word = bits[w]; word != 0; word &= word - 1) {
+            size_t row = w * 64 + lowestBit(word);
+            const T* record = columns.record(row);
+            bool dates = true;
+            if (inexact[w] >> (row & 63) & 1) {
+                for (const function<bool(const T*)>* text : dateTerms) dates = dates && (*text)(record);
+            }
+            if (dates && CompiledQuery<T>::all(query.residual, record)) visit(record);
+            else bits[w] &= ~(1ull << (row & 63));
+        }
+    }
+    return sumSelected(columns.column(paymentField).wide.data(), rows, bits.data());
+}
+template <typename T>
+size_t runQuery(const CompiledQuery<T>& query, VersionedList<T>& versions, const ColumnStore<T>& columns,
+                size_t paymentField, const OrderedIndex<T>& byName, const OrderedIndex<T>& byType,
+                void (*print)(const T*)) {
+    size_t count = 0;
+    int64_t paymentCents = 0;
+    if (query.indexField != "name" && !query.columnTerms.empty()) {
+        size_t rows;
+        {
+            // The columns follow the live records; matches are printed as
+            // the scan finds them rather than copied out first
+            lock_guard<mutex> readLock(storeMutex);
+            rows = columns.size();
+            paymentCents = scanColumns(query, columns, paymentField, [&](const T* record) {
+                print(record);
+                ++count;
+            });
+        }
+        cout << count << " match(es) from a column scan of " << rows << " records, payments "
+             << formatCents(paymentCents) << ".\n";
+        return count;
+    }
+    if (!query.indexField.empty()) {
+        const OrderedIndex<T>& index = query.indexField == "name" ? byName : byType;
+        {
+            // Matches are printed as the walk reaches them, so nothing is
+            // copied; the walk covers one key's records
+            lock_guard<mutex> readLock(storeMutex);
+            index.forEachFrom(OrderKey(query.indexValue, "", ""), [&](const T* record) {
+                if (get<0>(index.key(record)) != query.indexValue) return false;
+                if (query.matches(record)) {
+                    print(record);
+                    paymentCents += llround(paymentAmount(record) * 100);
+                    ++count;
+                }
+                return true;
+            });
+        }
+        cout << count << " match(es) using the " << query.indexField << " index, payments "
+             << formatCents(paymentCents) << ".\n";
+        return count;
+    }
+    shared_ptr<const ListSnapshot<T>> snapshot = versions.pin();
+    snapshot->forEach([&](const T* record) {
+        if (query.matches(record)) {
+            print(record);
+            paymentCents += llround(paymentAmount(record) * 100);
+            ++count;
+        }
+        return true;
+    });
+    cout << count << " match(es) from a scan of " << snapshot->size() << " records, payments "
+         << formatCents(paymentCents) << ".\n";
+    return count;
+}
+string promptQueryText(bool oldList) {
+    cout << "Fields: " << (oldList ? "type, id, name, dob, issue, expiry, passport, account, created, appointment, status, payment, balance"
+                                   : "type, id, name, dob, nationality, phone, created, appointment, status, payment")
+         << "\nOperators: = != < <= > >= ~ (contains), joined with AND\n";
+    cout << "Enter query: ";
+    string text;
+    getline(cin, text);
+    return text;
+}
+void queryPassports(bool oldList) {
+    ensurePassportsLoaded();
+    string text = promptQueryText(oldList);
+    string error;
+    if (oldList) {
+        CompiledQuery<OldPassport> query;
+        error = compileQuery(text, oldQueryFields, query);
+        if (error.empty()) runQuery(query, oldVersions, oldColumns, OLD_PAYMENT_FIELD, oldByName, oldByType, printRecordSummary<OldPassport>);
+    } else {
+        CompiledQuery<NewPassport> query;
+        error = compileQuery(text, newQueryFields, query);
+        if (error.empty()) runQuery(query, newVersions, newColumns, NEW_PAYMENT_FIELD, newByName, newByType, printRecordSummary<NewPassport>);
+    }
+    if (!error.empty()) cout << "Invalid query: " << error << "\n";
+}
+// --- Bulk Operations ---
+// Deletes, sets the payment status of, or reschedules every record matching
+// a query in one pass over the list. Each record goes through the change
+// hooks as usual, but the list is saved once at the end instead of once per
+// record.
+enum BulkAction { BULK_DELETE = 1, BULK_SET_STATUS, BULK_RESCHEDULE };
+// Applies `action` to the matches; called with storeMutex held. Returns the
+// number of records changed.
+template <typename T>
+size_t bulkChange(T* head, const CompiledQuery<T>& query, BulkAction action, const string& value,
+                  void (*onUpdated)(const T&, T*), void (*onErased)(const T*)) {
+    size_t affected = 0;
+    T* next;
+    for (T* record = head; record != nullptr; record = next) {
+        next = record->next;
+        if (!query.matches(record)) continue;
+        ++affected;
+        if (action == BULK_DELETE) {
+            onErased(record);
+            eraseRecord(record);
+            continue;
+        }
+        // Neither field is a sort key, so the record keeps its place in the list
+        T before = beginRecordChange(record);
+        (action == BULK_SET_STATUS ? record->paymentStatus : record->appointmentDate) = value;
+        onUpdated(before, record);
+    }
+    return affected;
+}
+template <typename T>
+size_t countMatches(const T* head, const CompiledQuery<T>& query) {
+    size_t count = 0;
+    for (const T* temp = head; temp != nullptr; temp = temp->next) {
+        if (query.matches(temp)) ++count;
+    }
+    return count;
+}
+void bulkChangePassports() {
+    if (!followDirectory.empty()) {
+        cout << "This is a read-only replica. Make changes on the primary.\n";
+        return;
+    }
+    ensurePassportsLoaded();
+    int listChoice, actionChoice;
+    cout << "1. New Passports\n2. Old Passports\nEnter choice (1 or 2): ";
+    cin >> listChoice;
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    if (listChoice != 1 && listChoice != 2) {
+        cout << "Invalid choice.\n";
+        return;
+    }
+    bool oldList = listChoice == 2;
+    cout << "Operators: = != < <= > >= ~ (contains), joined with AND\n";
+    cout << "Enter query selecting the passports: ";
+    string text;
+    getline(cin, text);
+    CompiledQuery<NewPassport> newQuery;
+    CompiledQuery<OldPassport> oldQuery;
+    string error = oldList ? compileQuery(text, oldQueryFields, oldQuery) : compileQuery(text, newQueryFields, newQuery);
+    if (!error.empty()) {
+        cout << "Invalid query: " << error << "\n";
+        return;
+    }
+    cout << "1. Delete Matching Passports\n2. Set Payment Status\n3. Reschedule Appointments\nEnter choice: ";
+    cin >> actionChoice;
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    string value;
+    if (actionChoice == BULK_SET_STATUS) {
+        cout << "Enter new payment status (" << (oldList ? "Yes/No/Pending" : "Yes/No") << "): ";
+        getline(cin, value);
+        if (value != "Yes" && value != "No" && !(oldList && value == "Pending")) {
+            cout << "Invalid status.\n";
+            return;
+        }
+    } else if (actionChoice == BULK_RESCHEDULE) {
+        cout << "Enter new appointment date (YYYY-MM-DD): ";
+        getline(cin, value);
+        if (!isValidDate(value)) {
+            cout << "Invalid date format.\n";
+            return;
+        }
+    } else if (actionChoice != BULK_DELETE) {
+        cout << "Invalid choice.\n";
+        return;
+    }
+    size_t matching;
+    {
+        lock_guard<mutex> readLock(storeMutex);
+        matching = oldList ? countMatches(oldHead, oldQuery) : countMatches(newHead, newQuery);
+    }
+    if (matching == 0) {
+        cout << "No passports match the query.\n";
+        return;
+    }
+    string confirm;
+    cout << matching << " passport(s) match. Apply the change to all of them? (Yes/No): ";
+    getline(cin, confirm);
+    if (confirm != "Yes") {
+        cout << "Operation cancelled.\n";
+        return;
+    }
+    BulkAction action = static_cast<BulkAction>(actionChoice);
+    size_t affected;
+    {
+        lock_guard<mutex> writeLock(storeMutex);
+        InstanceCommit commit; // Matches are taken again, after other terminals' changes
+        if (oldList) {
+            affected = bulkChange(oldHead, oldQuery, action, value, onOldPassportUpdated, onOldPassportErased);
+            if (affected > 0) saveOldPassportsToFile();
+        } else {
+            affected = bulkChange(newHead, newQuery, action, value, onNewPassportUpdated, onNewPassportErased);
+            if (affected > 0) saveNewPassportsToFile();
+        }
+    }
+    cout << affected << " passport(s) " << (action == BULK_DELETE ? "deleted" : "updated") << ".\n";
+}
+// --- Payment Reconciliation ---
+// Settles pending payments from a bank statement: a CSV file of
+// key,amount,reference rows, where the key is a passport ID or the account
+// number of an old passport. The pending records (payment status other than
+// Yes) are put in one hash table keyed both ways, and the statement is joined
+// against it in a single pass:
+//  - a new passport is paid when the amount equals its payment;
+//  - an old passport's balance is credited (debited for a negative amount,
+//    unless that leaves it below zero), and once it covers the passport fee
+//    the fee is deducted and the passport is paid and given its dates, as
+//    updateOldPassport does.
+// A key that names more than one passport (an ID that is also an account
+// number, or an account number of two old passports) settles nothing. Rows
+// that settle nothing are written to reconcileExceptionsFileName. Each change
+// goes through the change hooks and each list is saved once.
+const string reconcileExceptionsFileName = "reconcile_exceptions4.csv";
+struct ReconcileTarget {
+    NewPassport* newRecord;
+    OldPassport* oldRecord;
+};
+struct ReconcileSummary {
+    size_t rows = 0, newPaid = 0, oldPaid = 0, oldCredited = 0, exceptions = 0;
+};
+long long passportFeeCents(const string& passType) {
+    return (passType == "Urgent" || passType == "ExpiredUrgent" ? urgentPassportFee : regularPassportFee) * 100LL;
+}
+void addReconcileException(RecordWriter& out, size_t line, string_view key, string_view amount,
+                           string_view reference, const char* reason) {
+    out.number(static_cast<long long>(line)).put(',').put(key.data(), key.size()).put(',');
+    out.put(amount.data(), amount.size()).put(',').put(reason, strlen(reason)).put(',');
+    out.put(reference.data(), reference.size()).put('\n'); // Last, as it may hold commas
+}
+// Joins the statement against the lists; called with storeMutex held
+void reconcileStatement(const string& statement, RecordWriter& exceptions, ReconcileSummary& summary) {
+    unordered_map<string, ReconcileTarget> pending;
+    unordered_set<string> ambiguous;
+    pending.reserve(newPool.size() + 2 * oldPool.size());
+    auto addKey = [&](const string& key, ReconcileTarget target) {
+        auto added = pending.emplace(key, target);
+        if (!added.second && (added.first->second.newRecord != target.newRecord || added.first->second.oldRecord != target.oldRecord)) {
+            ambiguous.insert(key);
+        }
+    };
+    for (NewPassport* record = newHead; record != nullptr; record = record->next) {
+        if (record->paymentStatus != "Yes") addKey(record->id, ReconcileTarget{record, nullptr});
+    }
+    unordered_map<string, size_t> accountHolders; // Old passports per account number, paid or not
+    for (OldPassport* record = oldHead; record != nullptr; record = record->next) {
+        if (!record->accountNumber.empty()) ++accountHolders[record->accountNumber];
+        if (record->paymentStatus == "Yes") continue;
+        addKey(record->id, ReconcileTarget{nullptr, record});
+        if (!record->accountNumber.empty()) addKey(record->accountNumber, ReconcileTarget{nullptr, record});
+    }
+    for (const auto& holders : accountHolders) {
+        const OldPassport* sameId = oldIdIndex.find(holders.first);
+        if (holders.second > 1 || newIdIndex.find(holders.first) != nullptr
+            || (sameId != nullptr && sameId->accountNumber != holders.first)) {
+            ambiguous.insert(holders.first);
+        }
+    }
+    string key, amountText, today = getCurrentDate();
+    size_t lineNumber = 0;
+    for (size_t pos = 0; pos < statement.size();) {
+        size_t end = min(statement.find('\n', pos), statement.size());
+        string_view line(statement.data() + pos, end - pos);
+        pos = end + 1;
+        ++lineNumber;
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        if (line.empty()) continue;
+        size_t firstComma = line.find(','), secondComma = line.find(',', firstComma + 1);
+        string_view keyField = line.substr(0, firstComma);
+        string_view amountField = firstComma == string_view::npos ? string_view()
+                                : line.substr(firstComma + 1, secondComma - firstComma - 1);
+        string_view reference = secondComma == string_view::npos ? string_view() : line.substr(secondComma + 1);
+        key.assign(keyField.data(), keyField.size());
+        amountText.assign(amountField.data(), amountField.size());
+        double amount;
+        if (!parseFieldNumber(amountText, amount)) {
+            if (lineNumber == 1) continue; // Header row
+            addReconcileException(exceptions, lineNumber, keyField, amountField, reference, "Unreadable amount");
+            ++summary.exceptions;
+            continue;
+        }
+        ++summary.rows;
+        long long cents = llround(amount * 100);
+        auto it = pending.find(key);
+        const char* problem = nullptr;
+        if (ambiguous.count(key) > 0) {
+            problem = "Key matches more than one passport";
+        } else if (it == pending.end()) {
+            problem = newIdIndex.find(key) != nullptr || oldIdIndex.find(key) != nullptr
+                    ? "Already paid" : "No pending passport";
+        } else if (it->second.newRecord != nullptr) {
+            NewPassport* record = it->second.newRecord;
+            if (record->paymentStatus == "Yes") {
+                problem = "Already paid"; // Settled by an earlier row
+            } else if (cents != moneyToCents(record->payment)) {
+                problem = "Amount does not match the payment due";
+            } else {
+                NewPassport before = beginRecordChange(record);
+                record->paymentStatus = "Yes";
+                onNewPassportUpdated(before, record);
+                ++summary.newPaid;
+            }
+        } else {
+            OldPassport* record = it->second.oldRecord;
+            if (record->paymentStatus == "Yes") {
+                problem = "Already paid";
+            } else {
+                long long balanceCents = llround(record->balance * 100) + cents;
+                long long feeCents = passportFeeCents(record->passType);
+                if (balanceCents < 0) {
+                    problem = "Debit would leave a negative balance";
+                } else {
+                    OldPassport before = beginRecordChange(record);
+                    if (balanceCents >= feeCents) {
+                        balanceCents -= feeCents;
+                        record->payment = to_string(feeCents / 100);
+                        record->paymentStatus = "Yes";
+                        record->createdDate = today;
+                        record->appointmentDate = record->passType == "ExpiredRegular" ? getDateOneMonthLater(today)
+                                                                                        : getDateTwoDaysLater(today);
+                        ++summary.oldPaid;
+                    } else {
+                        problem = "Balance credited but below the passport fee";
+                        ++summary.oldCredited;
+                    }
+                    record->balance = balanceCents / 100.0;
+                    onOldPassportUpdated(before, record);
+                }
+            }
+        }
+        if (problem != nullptr) {
+            addReconcileException(exceptions, lineNumber, keyField, amountField, reference, problem);
+            ++summary.exceptions;
+        }
+    }
+}
+bool reconcilePayments(const string& statementFileName) {
+    if (!followDirectory.empty()) {
+        cout << "This is a read-only replica. Make changes on the primary.\n";
+        return false;
+    }
+    string statement;
+    if (!readWholeFile(statementFileName, statement)) {
+        cout << "Error opening file " << statementFileName << " for reading!\n";
+        return false;
+    }
+    ensurePassportsLoaded();
+    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+    RecordWriter exceptions;
+    exceptions.put("Line,Key,Amount,Reason,Reference\n");
+    ReconcileSummary summary;
+    {
+        lock_guard<mutex> writeLock(storeMutex);
+        InstanceCommit commit;
+        reconcileStatement(statement, exceptions, summary);
+        if (summary.newPaid > 0) saveNewPassportsToFile();
+        if (summary.oldPaid + summary.oldCredited > 0) saveOldPassportsToFile();
+    }
+    bool written = writeRecordFile(reconcileExceptionsFileName, exceptions);
+    cout << summary.rows << " statement row(s) read in "
+         << fixed << setprecision(3) << chrono::duration<double>(chrono::steady_clock::now() - started).count()
+         << " s.\n";
+    cout << summary.newPaid << " new passport(s) paid, " << summary.oldPaid << " old passport(s) paid, "
+         << summary.oldCredited << " old passport balance(s) credited.\n";
+    if (summary.exceptions > 0) {
+        cout << summary.exceptions << " exception(s) written to " << reconcileExceptionsFileName << ".\n";
+    }
+    return written;
+}
+void reconcilePaymentsMenu() {
+    string statementFileName;
+    cout << "Enter bank statement file (ID or account number,amount,reference per line): ";
+    getline(cin, statementFileName);
+    reconcilePayments(statementFileName);
+}
+// Falls back to the archive when a search misses the active records
+bool printArchivedNewPassport(bool byId, const string& input) {
+    NewPassport record;
+    {
+        lock_guard<mutex> readLock(storeMutex);
+        if (!(byId ? newArchive.findById(input, record) : newArchive.findByName(input, record))) return false;
+    }
+    cout << "New Passport Found (archived):\n";
+    printRecordSummary(&record);
+    return true;
+}
+bool printArchivedOldPassport(bool byId, const string& input) {
+    OldPassport record;
+    {
+        lock_guard<mutex> readLock(storeMutex);
+        if (!(byId ? oldArchive.findById(input, record) : oldArchive.findByName(input, record))) return false;
+    }
+    cout << "Old Passport Found (archived):\n";
+    printRecordSummary(&record);
+    return true;
+}
+void searchNewPassport() {
+   int choice;
+    cout << "Search New Passport By:\n1. ID\n2. Name\n3. Name (partial or misspelled)\nEnter choice: ";
+    cin >> choice;
+    cin.ignore();
+    string input;
+    if (choice == 1) {
+        cout << "Enter  ID to search: ";
+    } else if (choice == 2 || choice == 3) {
+        cout << "Enter  Name to search: ";
+    } else {
+        cout << "Invalid choice.\n";
+        return;
+    }
+    getline(cin, input);
+    if (choice == 3) {
+        ensurePassportsLoaded(); // The name index covers the loaded list
+        vector<pair<NewPassport, double>> matches;
+        {
+            lock_guard<mutex> readLock(storeMutex); // Held for the index probe only
+            for (const auto& match : newNameIndex.search(input, 20)) matches.push_back({*match.first, match.second});
+        }
+        if (matches.empty()) {
+            cout << "New passport not found.\n";
+            return;
+        }
+        cout << matches.size() << " match(es), best first:\n";
+        for (const auto& match : matches) {
+            cout << "[" << fixed << setprecision(2) << match.second << "] ";
+            printRecordSummary(&match.first);
+        }
+        return;
+    }
+    if (!newListMaterialized) { // Lazy mode: resolve through the location index
+        const RecordLocation* found = nullptr;
+        if (choice == 1) {
+            auto it = newLocationById.find(input);
+            if (it != newLocationById.end()) found = &newLocations[it->second];
+        } else {
+            for (const RecordLocation& loc : newLocations) {
+                if (loc.name == input) { found = &loc; break; }
+            }
+        }
+        NewPassport record;
+        if (found != nullptr && fetchNewPassport(*found, record)) {
+            cout << "New Passport Found:\n";
+            printRecordSummary(&record);
+            return;
+        }
+        if (!printArchivedNewPassport(choice == 1, input)) cout << "New passport not found.\n";
+        return;
+    }
+    shared_ptr<const ListSnapshot<NewPassport>> snapshot = newVersions.pin();
+    bool found = false;
+    snapshot->forEach([&](const NewPassport* record) {
+        found = (choice == 1 && record->id == input) || (choice == 2 && record->name == input);
+        if (found) {
+            cout << "New Passport Found:\n";
+            printRecordSummary(record);
+        }
+        return !found;
+    });
+    if (found) return;
+    if (!printArchivedNewPassport(choice == 1, input)) cout << "New passport not found.\n";
+}
+void searchOldPassport() {
+    int choice;
+    cout << "Search Old Passport By:\n1. ID\n2. Name\n3. Name (partial or misspelled)\nEnter choice: ";
+    cin >> choice;
+    cin.ignore();  
+    string input;
+    if (choice == 1) {
+        cout << "Enter Old Passport ID to search: ";
+    } else if (choice == 2 || choice == 3) {
+        cout << "Enter Old Passport Name to search: ";
+    } else {
+        cout << "Invalid choice.\n";
+        return;
+    }
+    getline(cin, input);
+    if (choice == 3) {
+        ensurePassportsLoaded(); // The name index covers the loaded list
+        vector<pair<OldPassport, double>> matches;
+        {
+            lock_guard<mutex> readLock(storeMutex); // Held for the index probe only
+            for (const auto& match : oldNameIndex.search(input, 20)) matches.push_back({*match.first, match.second});
+        }
+        if (matches.empty()) {
+            cout << "Old passport not found.\n";
+            return;
+        }
+        cout << matches.size() << " match(es), best first:\n";
+        for (const auto& match : matches) {
+            cout << "[" << fixed << setprecision(2) << match.second << "] ";
+            printRecordSummary(&match.first);
+        }
+        return;
+    }
+    if (!oldListMaterialized) { // Lazy mode: resolve through the location index
+        const RecordLocation* found = nullptr;
+        if (choice == 1) {
+            auto it = oldLocationById.find(input);
+            if (it != oldLocationById.end()) found = &oldLocations[it->second];
+        } else {
+            for (const RecordLocation& loc : oldLocations) {
+                if (loc.name == input) { found = &loc; break; }
+            }
+        }
+        OldPassport record;
+        if (found != nullptr && fetchOldPassport(*found, record)) {
+            cout << "Old Passport Found:\n";
+            printRecordSummary(&record);
+            return;
+        }
+        if (!printArchivedOldPassport(choice == 1, input)) cout << "Old passport not found.\n";
+        return;
+    }
+    shared_ptr<const ListSnapshot<OldPassport>> snapshot = oldVersions.pin();
+    bool found = false;
+    snapshot->forEach([&](const OldPassport* record) {
+        found = (choice == 1 && record->id == input) || (choice == 2 && record->name == input);
+        if (found) {
+            cout << "Old Passport Found:\n";
+            printRecordSummary(record);
+        }
+        return !found;
+    });
+    if (found) return;
+    if (!printArchivedOldPassport(choice == 1, input)) cout << "Old passport not found.\n";
+}
+// The ordered indexes are always current, so sorting is a relink of the
+// list. Called with storeMutex held.
+void applyNewSortOrder(int sortOption) {
+    InstanceCommit commit;
+    newSortOrder = sortOption;
+    relinkNewPassports();
+    logNewPassportChange('S', to_string(sortOption), nullptr);
+    saveSortOrder();
+    saveNewPassportsToFile();
+}
+void applyOldSortOrder(int sortOption) {
+    InstanceCommit commit;
+    oldSortOrder = sortOption;
+    relinkOldPassports();
+    logOldPassportChange('S', to_string(sortOption), nullptr);
+    saveSortOrder();
+    saveOldPassportsToFile();
+}
+void sortNewPassports() {
+    ensurePassportsLoaded();
+    if (underStoreMutex([] { return newHead == nullptr || newHead->next == nullptr; })) {
+        cout << "No new passports to sort or only one passport exists.\n";
+        return;
+    }
+    int sortOption;
+    cout << "Sort New Passports Options:\n1. Sort by Name\n2. Sort by Passport Type\nEnter choice (1 or 2): ";
+    cin >> sortOption;
+    cin.ignore(numeric_limits<streamsize>::max(), '\n'); 
+    if (sortOption != 1 && sortOption != 2) {
+        cout << "Invalid sort option.\n";
+        return;
+    }
+    {
+        lock_guard<mutex> writeLock(storeMutex);
+        applyNewSortOrder(sortOption);
+    }
+    cout << "New passports sorted by " << (sortOption == 1 ? "name" : "passport type") << ".\n";
+}
+void sortOldPassports() {
+    ensurePassportsLoaded();
+    if (underStoreMutex([] { return oldHead == nullptr || oldHead->next == nullptr; })) {
+        cout << "No old passports to sort or only one passport exists.\n";
+        return;
+    }
+    int sortOption;
+    cout << "Sort Old Passports Options:\n1. Sort by Name\n2. Sort by Passport Type\nEnter choice (1 or 2): ";
+    cin >> sortOption;
+    cin.ignore(numeric_limits<streamsize>::max(), '\n'); 
+    if (sortOption != 1 && sortOption != 2) {
+        cout << "Invalid sort option.\n";
+        return;
     }
-
+    {
+        lock_guard<mutex> writeLock(storeMutex);
+        applyOldSortOrder(sortOption);
+    }
+    cout << "Old passports sorted by " << (sortOption == 1 ? "name" : "passport type") << ".\n";
 }
-void updateOldPassport() {
- string idToUpdate;
-    cout << "Enter Old Passport ID to update: ";
-    getline(cin, idToUpdate);
-
-    OldPassport* current = oldHead;
-    while (current != nullptr && current->id != idToUpdate) {
-        current = current->next;
+void displayNewPassports() {
+    cout << "\n--- New Passports ---\n";
+    if (!newListMaterialized) { // Lazy mode: stream records through the cache
+        if (newLocations.empty()) {
+            cout << "No new passports to display.\n";
+            return;
+        }
+        NewPassport record;
+        for (const RecordLocation& loc : newLocations) {
+            if (fetchNewPassport(loc, record)) printRecordBlock(&record);
+        }
+        cout << "--------------------------------\n";
+        return;
     }
+    shared_ptr<const ListSnapshot<NewPassport>> snapshot = newVersions.pin();
+    if (snapshot->empty()) {
+        cout << "No new passports to display.\n";
+        return;
+    }
+    snapshot->forEach([](const NewPassport* record) {
+        printRecordBlock(record);
+        return true;
+    });
+    cout << "--------------------------------\n";
+}
+void displayOldPassports() {
+    if (!oldListMaterialized) { // Lazy mode: stream records through the cache
+        if (oldLocations.empty()) {
+            cout << "No old passports found.\n";
+            return;
+        }
+        cout << "\n-- List of Old Passports --\n";
+        OldPassport record;
+        for (const RecordLocation& loc : oldLocations) {
+            if (fetchOldPassport(loc, record)) printRecordSummary(&record);
+        }
+        return;
+    }
+    shared_ptr<const ListSnapshot<OldPassport>> snapshot = oldVersions.pin();
+    if (snapshot->empty()) {
+        cout << "No old passports found.\n";
+        return;
+    }
+    cout << "\n-- List of Old Passports --\n";
+    snapshot->forEach([](const OldPassport* record) {
+        printRecordSummary(record);
+        return true;
+    });
+}
+void freeNewPassportList() {
+    newVersions.preserveAll();
+    newPool.clear(); // Every node lives in the pool
+    newHead = newTail = nullptr;
+}
+void freeOldPassportList() {
+    oldVersions.preserveAll();
+    oldPool.clear();
+    oldHead = oldTail = nullptr;
 
-    if (current != nullptr) {
-
-        string newId, newName, newDob, enteredPassportNumber, enteredAccountNumber, newPayment, newPaymentStatus, newPassType;
-        double enteredBalance;
-        int urgencyChoice;
-        cout << "Select Urgency:\n1. Regular\n2. Urgent\nEnter choice (1 or 2): ";
-        cin >> urgencyChoice;
-        cin.ignore(numeric_limits<streamsize>::max(), '\n'); // Clear buffer
+}
+// --- Session Record and Replay ---
+// --record FILE copies every line typed at the prompts into FILE. --replay
+// FILE feeds such a transcript to the menu loop at full speed with the
+// prompts discarded, then reports operations per second and the latency of
+// each menu path (4.1 is Search > Search New Passport). --generate FILE OPS
+// writes a synthetic transcript for the current data with the operation mix
+// given by --mix, so the menu loop can also be measured at load. A replay
+// runs against a scratch copy of the data directory, which is removed at exit.
+const char* const transcriptOperations[] = {"search", "query", "create", "update", "delete", "display", "report"};
+const char* const defaultTranscriptMix = "search=50,query=10,create=15,update=15,delete=5,display=3,report=2";
+bool replayMode = false;
+string replayDirectory; // The scratch copy a replay changes instead of the data directory
+string menuPath; // Choices made in the current menu operation, e.g. "2.1"
+map<string, vector<double>> menuPathLatencies; // Microseconds per operation
 
-        newPassType = std::string("Expired") + (urgencyChoice == 1 ? "Regular" : "Urgent");
-        const int MAX_ID_LEN = 10;
+// Passes input through while copying it to `copy`
+class TeeInputBuffer : public streambuf {
+public:
+    TeeInputBuffer(streambuf* source, ostream& copy) : source(source), copy(copy) {}
+protected:
+    int_type underflow() override {
+        int_type c = source->sbumpc();
+        if (traits_type::eq_int_type(c, traits_type::eof())) return c;
+        current = traits_type::to_char_type(c);
+        copy.put(current);
+        if (current == '\n') copy.flush(); // A session that ends abruptly keeps its complete lines
+        setg(&current, &current, &current + 1);
+        return c;
+    }
+private:
+    streambuf* source;
+    ostream& copy;
+    char current;
+};
+class NullOutputBuffer : public streambuf {
+protected:
+    int_type overflow(int_type c) override { return traits_type::not_eof(c); }
+    streamsize xsputn(const char*, streamsize count) override { return count; }
+};
+void removeReplayDirectory() {
+    error_code ec;
+    filesystem::remove_all(replayDirectory, ec);
+}
+// Copies the files of the data directory into a new scratch directory and
+// makes it the working directory, so a replay goes through the real save path
+// without changing the data it was started on
+bool enterReplayDirectory() {
+#ifdef HAVE_POSIX_IO
+    error_code ec;
+    string scratch = (filesystem::temp_directory_path(ec) / "passport-replay-XXXXXX").string();
+    if (ec || mkdtemp(&scratch[0]) == nullptr) {
+        cout << "Error: cannot create a scratch directory for the replay.\n";
+        return false;
+    }
+    replayDirectory = scratch;
+    atexit(removeReplayDirectory);
+    for (const filesystem::directory_entry& entry : filesystem::directory_iterator(".", ec)) {
+        if (!entry.is_regular_file(ec)) continue; // Shard and previous-shard directories are not used
+        filesystem::copy_file(entry.path(), replayDirectory / entry.path().filename(), ec);
+        if (ec) break;
+    }
+    if (ec || chdir(replayDirectory.c_str()) != 0) {
+        cout << "Error: cannot copy the data directory to " << replayDirectory << " for the replay.\n";
+        return false;
+    }
+    cout << "Replaying against a copy of the data in " << replayDirectory << "; the data directory is not changed.\n";
+    return true;
+#else
+    cout << "Error: --replay is not supported on this platform.\n";
+    return false;
+#endif
+}
+void noteMenuChoice(int choice) {
+    menuPath += "." + to_string(choice);
+}
+string menuPathName(const string& path) {
+    static const map<string, string> names = {
+        {"1.1", "Create New Passport"}, {"1.2", "Create Old Passport"}, {"2.1", "Update New Passport"},
+        {"2.2", "Update Old Passport"}, {"3.1", "Delete New Passport"}, {"3.2", "Delete Old Passport"},
+        {"4.1", "Search New Passport"}, {"4.2", "Search Old Passport"}, {"4.3", "Query New Passports"},
+        {"4.4", "Query Old Passports"}, {"5.1", "Display New Passports"}, {"5.2", "Display Old Passports"},
+        {"6.1", "Sort New Passports"}, {"6.2", "Sort Old Passports"}, {"7.1", "Find Duplicate Applicants"},
+        {"7.2", "Sort Data Files"}, {"7.3", "Archive Aged Records"}, {"7.4", "Bulk Update or Delete"},
+        {"8", "Reports"}};
+    auto it = names.find(path);
+    return it == names.end() ? "(invalid choice)" : it->second;
+}
+void printReplayReport(double seconds) {
+    size_t operations = 0;
+    for (const auto& path : menuPathLatencies) operations += path.second.size();
+    cout << "Replayed " << operations << " operation(s) in " << fixed << setprecision(3) << seconds << " s: "
+         << setprecision(1) << (seconds > 0 ? operations / seconds : 0.0) << " operations/s\n";
+    cout << left << setw(7) << "Path" << setw(28) << "Operation" << right << setw(8) << "Count" << setw(12) << "Mean us"
+         << setw(12) << "p50 us" << setw(12) << "p99 us" << setw(12) << "Max us" << "\n";
+    for (auto& path : menuPathLatencies) {
+        vector<double>& micros = path.second;
+        sort(micros.begin(), micros.end());
+        double total = 0;
+        for (double value : micros) total += value;
+        cout << left << setw(7) << path.first << setw(28) << menuPathName(path.first) << right << setw(8) << micros.size()
+             << setprecision(1) << setw(12) << total / micros.size() << setw(12) << micros[micros.size() / 2]
+             << setw(12) << micros[min(micros.size() - 1, micros.size() * 99 / 100)] << setw(12) << micros.back() << "\n";
+    }
+}
+// Writes `operations` menu operations drawn from `mix` (name=weight pairs)
+// as they would be typed against the current lists. Generated names are
+// kept clear of the duplicate-applicant warning, whose extra prompt would
+// shift the rest of the transcript.
+bool generateTranscript(const string& fileName, size_t operations, const string& mix) {
+    const size_t OPERATION_COUNT = sizeof(transcriptOperations) / sizeof(transcriptOperations[0]);
+    vector<double> weights(OPERATION_COUNT, 0.0);
+    stringstream items(mix);
+    string item;
+    while (getline(items, item, ',')) {
+        size_t equals = item.find('=');
+        string name = lowercase(trimmed(item.substr(0, equals)));
+        size_t op = find(begin(transcriptOperations), end(transcriptOperations), name) - begin(transcriptOperations);
+        if (equals == string::npos || op == OPERATION_COUNT) {
+            cout << "Error: unknown operation '" << name << "' in --mix (use search, query, create, update,"
+                 << " delete, display and report with a weight each).\n";
+            return false;
+        }
+        char* end;
+        weights[op] = strtod(item.c_str() + equals + 1, &end);
+        if (end == item.c_str() + equals + 1 || *end != '\0' || !(weights[op] >= 0) || !isfinite(weights[op])) {
+            cout << "Error: the weight of '" << name << "' in --mix must be a number of 0 or more.\n";
+            return false;
+        }
+    }
+    double totalWeight = 0;
+    for (double weight : weights) totalWeight += weight;
+    if (totalWeight <= 0) {
+        cout << "Error: --mix needs at least one operation with a weight above 0.\n";
+        return false;
+    }
+    ensurePassportsLoaded();
+    vector<string> liveIds, oldIds; // New passport IDs that exist at that point of the transcript
+    unordered_map<string, vector<string>> namesByDob;
+    for (NewPassport* temp = newHead; temp != nullptr; temp = temp->next) {
+        liveIds.push_back(temp->id);
+        namesByDob[temp->dob].push_back(normalizeName(temp->name));
+    }
+    for (OldPassport* temp = oldHead; temp != nullptr; temp = temp->next) {
+        oldIds.push_back(temp->id);
+        namesByDob[temp->dob].push_back(normalizeName(temp->name));
+    }
+    static const char* const givenNames[] = {"Abebe", "Almaz", "Bekele", "Chaltu", "Dawit", "Eden", "Fikru", "Genet",
+                                             "Hana", "Kebede", "Lensa", "Meron", "Nahom", "Rahel", "Selam", "Yonas"};
+    static const char* const nationalities[] = {"Ethiopian", "Kenyan", "Somali", "Sudanese", "Eritrean"};
+    string today = getCurrentDate();
+    string queries[] = {"type=Urgent AND status=Yes", "appointment>=" + today, "nationality=Kenyan AND payment>=10000",
+                        "phone~0911"};
+    mt19937 random(42); // Fixed seed: the same arguments give the same transcript
+    discrete_distribution<size_t> pickOperation(weights.begin(), weights.end());
+    auto pick = [&random](size_t count) { return uniform_int_distribution<size_t>(0, count - 1)(random); };
+    auto person = [&]() { // Name, date of birth, nationality and phone lines
+        string name, dob;
+        bool similar;
         do {
-            cout << "Enter New ID (max " << MAX_ID_LEN << " chars, alphanumeric, current: " << current->id << "): ";
-            getline(cin, newId);
-            if (newId.length() > MAX_ID_LEN) {
-                cout << "your size is limit pls try again (max " << MAX_ID_LEN << " chars).\n";
-                continue;
+            name = string(givenNames[pick(16)]) + " " + givenNames[pick(16)] + " " + givenNames[pick(16)];
+            ostringstream date;
+            date << 1950 + pick(50) << "-" << setfill('0') << setw(2) << 1 + pick(12) << "-" << setw(2) << 1 + pick(28);
+            dob = date.str();
+            similar = false;
+            for (const string& other : namesByDob[dob]) {
+                similar = similar || boundedEditDistance(normalizeName(name), other, DUPLICATE_MAX_EDITS) <= DUPLICATE_MAX_EDITS;
             }
-            if (!isAlphanumeric(newId)) {
-                cout << "Invalid ID: Must be alphanumeric.\n";
-            } else if (!isUniqueOldID(newId, current->id)) {
-                cout << "Error: This ID already exists.\n";
+        } while (similar);
+        namesByDob[dob].push_back(normalizeName(name));
+        return name + "\n" + dob + "\n" + nationalities[pick(5)] + "\n09" + to_string(10000000 + pick(90000000)) + "\n";
+    };
+    ofstream out(fileName);
+    if (!out) {
+        cout << "Error opening file " << fileName << " for writing!\n";
+        return false;
+    }
+    size_t nextId = 0;
+    for (size_t i = 0; i < operations; ++i) {
+        string op = transcriptOperations[pickOperation(random)];
+        if ((op == "update" || op == "delete") && liveIds.empty()) op = "create";
+        if (op == "search") {
+            bool old = !oldIds.empty() && pick(5) == 0;
+            out << "4\n" << (old ? "2" : "1") << "\n1\n"
+                << (old ? oldIds[pick(oldIds.size())] : liveIds.empty() ? "G0" : liveIds[pick(liveIds.size())]) << "\n";
+        } else if (op == "query") {
+            out << "4\n3\n" << queries[pick(4)] << "\n";
+        } else if (op == "create") {
+            string id;
+            do {
+                id = "G" + to_string(nextId++);
+            } while (!isUniqueNewID(id));
+            out << "1\n1\n" << 1 + pick(2) << "\n" << id << "\n" << person() << "Yes\n";
+            liveIds.push_back(id);
+        } else if (op == "update") {
+            const string& id = liveIds[pick(liveIds.size())];
+            out << "2\n1\n" << id << "\n" << 1 + pick(2) << "\n" << id << "\n" << person() << "Yes\n";
+        } else if (op == "delete") {
+            size_t victim = pick(liveIds.size());
+            out << "3\n1\n" << liveIds[victim] << "\n";
+            liveIds[victim] = liveIds.back();
+            liveIds.pop_back();
+        } else if (op == "display") {
+            out << "5\n1\n";
+        } else {
+            out << "8\n";
+        }
+    }
+    out << "0\n";
+    cout << "Wrote " << operations << " operation(s) to " << fileName << ".\n";
+    return true;
+}
+// --- Sharded Deployment ---
+// --shards N spreads the records over N worker processes by a hash of their
+// ID. Worker k keeps its records in the directory shardk under the data
+// directory and is an ordinary instance of the program there: loading,
+// saving, the change hooks and the change feed all work per shard, so writes
+// to different shards run on different cores. The process that was started
+// becomes the router. It keeps no records and talks to each worker over a
+// socketpair:
+//  - an operation on one record runs on the shard that owns its ID, with the
+//    shard's prompts and the user's answers relayed through the router;
+//  - display, name search, queries, sorts and reports go to every shard at
+//    once, and the router merges the rows they send back.
+// The shard count is kept in shards4.cfg. Starting with a different N first
+// moves every CSV row into new shard directories; the old files are kept in
+// shards4.previous.
+const string shardConfigFileName = "shards4.cfg";
+const string shardLockFileName = "shards4.lock";
+const string previousShardsDirectory = "shards4.previous";
+const string shardSwitchFileName = "shards4.switch"; // Present while the directories are being replaced
+int shardCount = 0;   // Number of shards, 0 when not sharded
+int shardIndex = -1;  // This worker's shard; -1 in the router and unsharded instances
+int shardSocket = -1; // A worker's end of its socketpair
+size_t shardOf(const string& id) {
+    return static_cast<size_t>(BloomFilter::hash(id) % static_cast<uint64_t>(shardCount));
+}
+bool ownsShardKey(const string& id) {
+    return shardIndex < 0 || shardOf(id) == static_cast<size_t>(shardIndex);
+}
+string shardDirectory(int index) { return "shard" + to_string(index); }
+#ifdef HAVE_POSIX_IO
+const char SHARD_INPUT = '\x05'; // A worker waits for a line typed at the router
+const char SHARD_DONE = '\x06';  // A worker finished the request
+const char SHARD_ASK = '\x07';   // A worker needs an answer from the other shards
+bool sendAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        data += sent;
+        size -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+// Tabs separate the fields of a request and a newline ends it
+string shardField(string text) {
+    replace(text.begin(), text.end(), '\t', ' ');
+    replace(text.begin(), text.end(), '\n', ' ');
+    return text;
+}
+void writeShardConfig(const string& fileName, const string& text) {
+    {
+        ofstream out(fileName + ".tmp", ios::trunc);
+        out << text;
+    }
+    rename((fileName + ".tmp").c_str(), fileName.c_str());
+}
+// Completes a switch to new shard directories that a crash interrupted. The
+// switch file, written once every shardk.new is complete, holds the old and
+// new shard counts; the renames below are each done at most once, so running
+// them again from any point ends in the same state.
+bool finishShardSwitch() {
+    int current = -1, count = -1;
+    {
+        ifstream in(shardSwitchFileName);
+        if (!in) return true; // No switch in progress
+        in >> current >> count;
+    }
+    if (current < 0 || count <= 0) {
+        cout << "Error: " << shardSwitchFileName << " is damaged; the previous files are in " << previousShardsDirectory << ".\n";
+        return false;
+    }
+    const string fileNames[] = {regularFileName, urgentFileName, expiredRegularFileName, expiredUrgentFileName, checksumFileName};
+    error_code ec;
+    if (current == 0) {
+        for (const string& fileName : fileNames) {
+            if (filesystem::exists(fileName)) filesystem::rename(fileName, previousShardsDirectory + "/" + fileName, ec);
+        }
+    }
+    for (int k = 0; k < current && !ec; ++k) {
+        // An old shard is still in place if it has no replacement yet or none is coming
+        bool replaced = k >= count || filesystem::exists(shardDirectory(k) + ".new");
+        if (replaced && filesystem::exists(shardDirectory(k))) {
+            filesystem::rename(shardDirectory(k), previousShardsDirectory + "/" + shardDirectory(k), ec);
+        }
+    }
+    for (int k = 0; k < count && !ec; ++k) {
+        if (filesystem::exists(shardDirectory(k) + ".new")) filesystem::rename(shardDirectory(k) + ".new", shardDirectory(k), ec);
+    }
+    if (ec) {
+        cout << "Error: resharding could not replace the old files: " << ec.message()
+             << ". The previous files are in " << previousShardsDirectory << ".\n";
+        return false;
+    }
+    writeShardConfig(shardConfigFileName, to_string(count) + "\n");
+    filesystem::remove(shardSwitchFileName, ec);
+    return true;
+}
+// Moves every CSV row to the shard that owns its ID when the data directory
+// holds another number of shards, or was not sharded yet. The new shards are
+// written next to the old ones before anything is moved, and the switch is
+// recorded so that a crash part way through is completed on the next start.
+// Returns false when the directory cannot be used.
+bool prepareShardDirectories(int count) {
+    int lockFile = open(shardLockFileName.c_str(), O_RDWR | O_CREAT, 0644);
+    if (lockFile < 0 || flock(lockFile, LOCK_SH) != 0) { // Held by the router and its workers
+        cout << "Error: cannot lock " << shardLockFileName << "\n";
+        return false;
+    }
+    if (filesystem::exists(shardSwitchFileName)) {
+        if (flock(lockFile, LOCK_EX | LOCK_NB) != 0) {
+            cout << "Error: another session is changing the number of shards.\n";
+            return false;
+        }
+        if (!finishShardSwitch()) return false;
+        cout << "Completed an interrupted change of the number of shards.\n";
+        flock(lockFile, LOCK_SH);
+    }
+    int current = 0;
+    {
+        ifstream in(shardConfigFileName);
+        in >> current;
+    }
+    if (current == count) return true;
+    if (flock(lockFile, LOCK_EX | LOCK_NB) != 0) {
+        cout << "Error: other sessions use the shards. Close them before changing the number of shards.\n";
+        return false;
+    }
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) == nullptr) return false;
+    string base = cwd;
+    vector<string> sources;
+    for (int k = 0; k < current; ++k) sources.push_back(shardDirectory(k));
+    if (current == 0) sources.push_back(".");
+    const string fileNames[] = {regularFileName, urgentFileName, expiredRegularFileName, expiredUrgentFileName};
+    vector<vector<RecordWriter>> outputs(count, vector<RecordWriter>(4));
+    for (vector<RecordWriter>& files : outputs) {
+        appendCsvHeader<NewPassport>(files[0]).put('\n');
+        appendCsvHeader<NewPassport>(files[1]).put('\n');
+        appendCsvHeader<OldPassport>(files[2]).put('\n');
+        appendCsvHeader<OldPassport>(files[3]).put('\n');
+    }
+    size_t moved = 0;
+    string contents;
+    for (const string& source : sources) {
+        if (chdir(source.c_str()) != 0) {
+            cout << "Error: cannot read shard directory " << source << "\n";
+            return false;
+        }
+        for (int f = 0; f < 4; ++f) {
+            finishInterruptedSave(fileNames[f]);
+            if (!readWholeFile(fileNames[f], contents)) continue; // No such file
+            if (!verifyChecksums(fileNames[f], contents)) {
+                cout << "Resharding stopped; nothing was changed.\n";
+                return false;
             }
-        } while (newId.length() > MAX_ID_LEN || !isAlphanumeric(newId) || !isUniqueOldID(newId, current->id));
-
-        const int MAX_NAME_LEN = 25;
-        do {
-            cout << "Enter New Full Name (max " << MAX_NAME_LEN << " chars, letters only, current: " << current->name << "): ";
-            getline(cin, newName);
-            if (newName.length() > MAX_NAME_LEN) {
-                cout << "your size is limit pls try again (max " << MAX_NAME_LEN << " chars).\n";
-                continue;
+            for (size_t pos = min(contents.find('\n'), contents.size()) + 1; pos < contents.size();) { // Skip the header
+                size_t end = min(contents.find('\n', pos), contents.size());
+                string_view line(contents.data() + pos, end - pos);
+                pos = end + 1;
+                if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+                size_t idStart = line.find(',');
+                if (idStart == string_view::npos) continue;
+                string id(line.substr(idStart + 1, line.find(',', idStart + 1) - idStart - 1));
+                outputs[shardOf(id)][f].put(line.data(), line.size()).put('\n');
+                ++moved;
             }
-            if (!isLettersOnly(newName)) cout << "Invalid name: Must contain letters only.\n";
-        } while (newName.length() > MAX_NAME_LEN || !isLettersOnly(newName));
-
-        do {
-            cout << "Enter New Date of Birth (YYYY-MM-DD, current: " << current->dob << "): ";
-            getline(cin, newDob);
-            if (!isValidDate(newDob)) cout << "Invalid format. Try again.\n";
-        } while (!isValidDate(newDob));
+        }
+        if (chdir(base.c_str()) != 0) return false;
+    }
+    error_code ec;
+    for (int k = 0; k < count; ++k) {
+        string directory = shardDirectory(k) + ".new";
+        filesystem::remove_all(directory, ec);
+        if (!filesystem::create_directory(directory, ec) || chdir(directory.c_str()) != 0) {
+            cout << "Error: cannot create shard directory " << directory << "\n";
+            return false;
+        }
+        vector<pair<string, string_view>> written;
+        for (int f = 0; f < 4; ++f) {
+            if (!writeRecordFile(fileNames[f], outputs[k][f])) return false;
+            written.push_back({fileNames[f], string_view(outputs[k][f].data(), outputs[k][f].size())});
+        }
+        recordChecksums(written);
+        saveSortOrder(); // The shards start in the router's order
+        if (chdir(base.c_str()) != 0) return false;
+    }
+    // Switch over, keeping the previous files for recovery
+    filesystem::remove_all(previousShardsDirectory, ec);
+    filesystem::create_directory(previousShardsDirectory, ec);
+    writeShardConfig(shardSwitchFileName, to_string(current) + " " + to_string(count) + "\n");
+    if (!finishShardSwitch()) return false;
+    flock(lockFile, LOCK_SH);
+    cout << "Moved " << moved << " records from " << (current == 0 ? string("the unsharded files") : to_string(current) + " shard(s)")
+         << " into " << count << " shard(s); the previous files are in " << previousShardsDirectory << ".\n";
+    return true;
+}
 
-        const int MAX_PASSPORT_NUM_LEN = 8; 
+// A worker's cin and cout while it serves the router. The answers the router
+// already collected (such as the ID that chose the shard) are read first, and
+// output is dropped until they are used up, so prompts the user has seen are
+// not repeated. After that, each read asks the router for a line of input.
+class ShardStreamBuffer : public streambuf {
+public:
+    explicit ShardStreamBuffer(int fd) : fd(fd) {}
+    void begin(const string& answers) {
+        preset = answers;
+        setg(&preset[0], &preset[0], &preset[0] + preset.size());
+        muted = !preset.empty();
+        serving = true;
+    }
+    void allowQuestions() { questions = true; }
+    // Sends the router a request for the other shards and returns their
+    // answer, or "" when the router is not waiting on this worker. The router
+    // only writes to this socket when asked, so the answer is the next line.
+    string ask(const string& question) {
+        if (!questions) return "";
+        pending += SHARD_ASK;
+        pending += question + "\n";
+        if (!flush()) return "";
+        string answer;
+        char ch;
+        for (;;) {
+            ssize_t count = read(fd, &ch, 1);
+            if (count < 0 && errno == EINTR) continue;
+            if (count <= 0 || ch == '\n') return answer;
+            answer += ch;
+        }
+    }
+    void finish() {
+        setg(incoming, incoming, incoming); // Drops answers that were not asked for
+        muted = serving = questions = false;
+        pending += SHARD_DONE;
+        flush();
+    }
+    void setQuiet(bool value) { quiet = value; }
+    // Raw reply data, bypassing cout
+    void send(const char* data, size_t size) {
+        pending.append(data, size);
+        if (pending.size() >= 65536) flush();
+    }
+protected:
+    int_type underflow() override {
+        muted = false;
+        if (serving) pending += SHARD_INPUT;
+        if (!flush()) return traits_type::eof();
+        ssize_t count;
         do {
-            cout << "Confirm Passport Number (current: " << current->passportNumber << ", max " << MAX_PASSPORT_NUM_LEN << " chars): ";
-            getline(cin, enteredPassportNumber);
-            if (enteredPassportNumber.length() > MAX_PASSPORT_NUM_LEN) {
-                cout << "your size is limit pls try again (max " << MAX_PASSPORT_NUM_LEN << " chars).\n";
-                continue;
-            }
-            if (enteredPassportNumber != current->passportNumber) {
-                cout << "Your passport number is incorrect. Please enter the correct passport number.\n";
-            }
-        } while (enteredPassportNumber.length() > MAX_PASSPORT_NUM_LEN || enteredPassportNumber != current->passportNumber);
-         do {
-            cout << "Confirm your Balance (current: $" << fixed << setprecision(2) << current->balance << "): ";
-            cin >> enteredBalance;
-            cin.ignore(numeric_limits<streamsize>::max(), '\n'); // Clear buffer
+            count = read(fd, incoming, sizeof(incoming));
+        } while (count < 0 && errno == EINTR);
+        if (count <= 0) return traits_type::eof();
+        setg(incoming, incoming, incoming + count);
+        return traits_type::to_int_type(*gptr());
+    }
+    streamsize xsputn(const char* text, streamsize count) override {
+        if (muted && gptr() == egptr()) muted = false;
+        if (!muted && !quiet) send(text, static_cast<size_t>(count));
+        return count;
+    }
+    int_type overflow(int_type c) override {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            char ch = traits_type::to_char_type(c);
+            xsputn(&ch, 1);
+        }
+        return traits_type::not_eof(c);
+    }
+private:
+    int fd;
+    string preset, pending;
+    char incoming[4096];
+    bool muted = false, serving = false, quiet = false, questions = false;
 
-            if (enteredBalance != current->balance) { // New check: balance must match current
-                cout << "Your entered balance is incorrect. Please enter the current balance.\n";
+    bool flush() {
+        bool sent = sendAll(fd, pending.data(), pending.size());
+        pending.clear();
+        return sent;
+    }
+};
+ShardStreamBuffer* shardChannel = nullptr;
+// Passport numbers are unique over all shards, but the ID picks the shard,
+// so a worker running an operation asks the others through the router
+bool passportNumberOnOtherShards(const string& passportNumber) {
+    return shardChannel != nullptr && shardChannel->ask("NUMBER\t" + shardField(passportNumber)) == "1";
+}
+template <typename T>
+void sendShardRow(const T* record) {
+    printBuffer.clear();
+    appendCsvLine(printBuffer, record).put('\n');
+    shardChannel->send(printBuffer.data(), printBuffer.size());
+}
+template <typename T>
+void sendShardRows(VersionedList<T>& versions) {
+    shared_ptr<const ListSnapshot<T>> snapshot = versions.pin();
+    snapshot->forEach([](const T* record) {
+        sendShardRow(record);
+        return true;
+    });
+}
+template <typename T>
+void sendShardNameMatch(VersionedList<T>& versions, const string& name) {
+    shared_ptr<const ListSnapshot<T>> snapshot = versions.pin();
+    snapshot->forEach([&name](const T* record) {
+        if (record->name != name) return true;
+        sendShardRow(record);
+        return false;
+    });
+}
+// A report as text: the totals on the first line, then one line per count
+// as "map<TAB>count<TAB>key" with the maps numbered as in reportCounts
+unordered_map<string, long long> PassportReport::* const reportCounts[] = {
+    &PassportReport::byPassType, &PassportReport::byPaymentStatus, &PassportReport::byNationality,
+    &PassportReport::appointmentsPerDay,
+};
+void sendShardReport(const PassportReport& report) {
+    string text = to_string(report.records) + "\t" + to_string(report.collectedCents) + "\t" +
+                  to_string(report.outstandingCents) + "\t" + to_string(report.balanceCents) + "\n";
+    for (size_t map = 0; map < size(reportCounts); ++map) {
+        for (const auto& count : report.*reportCounts[map]) {
+            text += to_string(map) + "\t" + to_string(count.second) + "\t" + count.first + "\n";
+        }
+    }
+    shardChannel->send(text.data(), text.size());
+}
+template <typename T, typename Index>
+void sendShardSimilarNames(const Index& nameIndex, const string& name) {
+    lock_guard<mutex> readLock(storeMutex);
+    for (const auto& match : nameIndex.search(name, 20)) {
+        char score[32];
+        int length = snprintf(score, sizeof(score), "%.6f\t", match.second);
+        shardChannel->send(score, static_cast<size_t>(length));
+        sendShardRow(match.first);
+    }
+}
+// Menu operations a worker runs for the router, by menu path
+const map<string, void (*)()> shardOperations = {
+    {"1.1", createNewPassport}, {"1.2", createOldPassports},
+    {"2.1", updateNewPassport}, {"2.2", updateOldPassport},
+    {"3.1", deleteNewPassport}, {"3.2", deleteOldPassport},
+    {"4.1", searchNewPassport}, {"4.2", searchOldPassport},
+};
+// Requests are one line of tab-separated fields:
+//   RUN path answers...   run a menu operation, relaying its prompts
+//   ROWS new|old          every record as a CSV line, in list order
+//   REPORT new|old        the list's report totals
+//   FIND new|old name     the first record with this name
+//   MATCH new|old name    up to 20 similar names, as score<TAB>CSV line
+//   QUERY new|old text    the records matching a query
+//   SORT new|old 1|2      sort the list by name or by passport type
+//   HAS id                1 if the ID is taken, else 0
+//   NUMBER passport       1 if this shard holds the passport number, else 0
+//   PING                  nothing; answers once the shard is loaded
+void handleShardRequest(const vector<string>& fields, ShardStreamBuffer& channel) {
+    const string& command = fields[0];
+    bool oldList = fields.size() > 1 && fields[1] == "old";
+    string argument = fields.size() > 2 ? fields[2] : "";
+    if (command == "RUN" && fields.size() > 1) {
+        string answers;
+        for (size_t i = 2; i < fields.size(); ++i) answers += fields[i] + "\n";
+        channel.begin(answers);
+        channel.allowQuestions(); // The router waits on this shard and can ask the others
+        auto operation = shardOperations.find(fields[1]);
+        if (operation != shardOperations.end()) operation->second();
+        return;
+    }
+    channel.begin("");
+    if (command == "ROWS") {
+        if (oldList) sendShardRows(oldVersions);
+        else sendShardRows(newVersions);
+    } else if (command == "REPORT") {
+        sendShardReport(oldList ? oldVersions.pin()->report : newVersions.pin()->report);
+    } else if (command == "FIND") {
+        if (oldList) sendShardNameMatch(oldVersions, argument);
+        else sendShardNameMatch(newVersions, argument);
+    } else if (command == "MATCH") {
+        if (oldList) sendShardSimilarNames<OldPassport>(oldNameIndex, argument);
+        else sendShardSimilarNames<NewPassport>(newNameIndex, argument);
+    } else if (command == "QUERY") {
+        channel.setQuiet(true); // Only the rows go back; the router prints the totals
+        if (oldList) {
+            CompiledQuery<OldPassport> query;
+            if (compileQuery(argument, oldQueryFields, query).empty()) {
+                runQuery(query, oldVersions, oldColumns, OLD_PAYMENT_FIELD, oldByName, oldByType, sendShardRow<OldPassport>);
             }
-        } while ( enteredBalance != current->balance); // Loop until valid and matching balance
-
-        double paymentAmount = 0.0; // Declare and initialize paymentAmount as double
-        if (urgencyChoice == 1) {
-            newPayment = "5000";
-            paymentAmount = 5000.0; // Assign double value
-            cout << "Payment Amount: $" << newPayment << " (Regular Passport)\n";
-        } else if (urgencyChoice == 2) {
-            newPayment = "25000";
-            paymentAmount = 25000.0; // Assign double value
-            cout << "Payment Amount: $" << newPayment << " (Urgent Passport)\n";
         } else {
-            cout << "Invalid urgency choice. Update cancelled.\n";
-            return;
+            CompiledQuery<NewPassport> query;
+            if (compileQuery(argument, newQueryFields, query).empty()) {
+                runQuery(query, newVersions, newColumns, NEW_PAYMENT_FIELD, newByName, newByType, sendShardRow<NewPassport>);
+            }
         }
-        if (enteredBalance < paymentAmount) {
-            cout << "Your balance is minimum. Passport cannot be updated.\n";
-            return;
-        } else {
-            enteredBalance -= paymentAmount;
-            cout << "Payment successful. New balance: $" << fixed << setprecision(2) << enteredBalance << "\n";
+        channel.setQuiet(false);
+    } else if (command == "SORT") {
+        int sortOption = atoi(argument.c_str());
+        lock_guard<mutex> writeLock(storeMutex);
+        if (sortOption == 1 || sortOption == 2) {
+            if (oldList) applyOldSortOrder(sortOption);
+            else applyNewSortOrder(sortOption);
         }
+    } else if (command == "HAS" && fields.size() > 1) {
+        lock_guard<mutex> readLock(storeMutex);
+        cout << (isUniqueNewID(fields[1]) ? "0" : "1");
+    } else if (command == "NUMBER" && fields.size() > 1) {
+        lock_guard<mutex> readLock(storeMutex);
+        cout << (passportNumberFreeInShard(fields[1], "") ? "0" : "1");
+    }
+}
+void serveShard() {
+    ShardStreamBuffer channel(shardSocket);
+    shardChannel = &channel;
+    streambuf* consoleInput = cin.rdbuf(&channel);
+    streambuf* consoleOutput = cout.rdbuf(&channel);
+    string request;
+    vector<string> fields;
+    while (getline(cin, request)) { // Ends when the router closes the socket
+        fields.clear();
+        for (size_t pos = 0;;) {
+            size_t end = request.find('\t', pos);
+            fields.push_back(request.substr(pos, end - pos));
+            if (end == string::npos) break;
+            pos = end + 1;
+        }
+        refreshFromOtherInstances();
+        handleShardRequest(fields, channel);
+        channel.finish();
+    }
+    cin.rdbuf(consoleInput);
+    cout.rdbuf(consoleOutput);
+    shardChannel = nullptr;
+    close(shardSocket);
+}
 
-        do {
-            cout << "Is payment confirmed? (Yes/No): ";
-            getline(cin, newPaymentStatus);
-            if (newPaymentStatus != "Yes" && newPaymentStatus != "No") {
-                cout << "Invalid status: Must be Yes or No.\n";
+struct ShardWorker {
+    pid_t pid;
+    int socket;
+};
+vector<ShardWorker> shardWorkers;
+// Forks one worker per shard. Returns true in the router; a worker returns
+// false from inside its shard directory and goes on with the normal startup.
+bool startShardWorkers(int count) {
+    cout.flush(); // Or the children print it again
+    for (int k = 0; k < count; ++k) {
+        int sockets[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+            cout << "Error: cannot connect shard " << k << "\n";
+            exit(1);
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+            cout << "Error: cannot start shard " << k << "\n";
+            exit(1);
+        }
+        if (pid == 0) {
+            close(sockets[0]);
+            for (const ShardWorker& worker : shardWorkers) close(worker.socket);
+            shardWorkers.clear();
+            if (chdir(shardDirectory(k).c_str()) != 0) {
+                cout << "Error: cannot use shard directory " << shardDirectory(k) << "\n";
+                _exit(1);
             }
-        } while (newPaymentStatus != "Yes" && newPaymentStatus != "No");
-
-        if (newPaymentStatus != "Yes") {
-            cout << "Error: Passport cannot be updated until payment is confirmed.\n";
-            return;
+            shardIndex = k;
+            shardSocket = sockets[1];
+            newSortOrder = oldSortOrder = 0;
+            loadSortOrder();
+            return false;
         }
-
-        string createdDate = getCurrentDate();
-        cout << "Created Date (auto-set): " << createdDate << "\n";
-
-        string appointmentDate;
-        if (newPassType == "ExpiredRegular") {
-            appointmentDate = getDateOneMonthLater(createdDate);
-            cout << "Appointment Date (auto-set, 1 month from creation): " << appointmentDate << "\n";
-        } else { // ExpiredUrgent
-            appointmentDate = getDateTwoDaysLater(createdDate);
-            cout << "Appointment Date (auto-set, 2 days from creation): " << appointmentDate << "\n";
+        close(sockets[1]);
+        shardWorkers.push_back({pid, sockets[0]});
+    }
+    return true;
+}
+// Closes the sockets, which ends the workers' loops, and waits for them.
+// `force` also signals them, for a session that ended mid-operation.
+void stopShardWorkers(bool force) {
+    for (const ShardWorker& worker : shardWorkers) {
+        close(worker.socket);
+        if (force) kill(worker.pid, SIGTERM);
+    }
+    for (const ShardWorker& worker : shardWorkers) waitpid(worker.pid, nullptr, 0);
+    shardWorkers.clear();
+}
+bool sendShardRequest(size_t shard, const string& request) {
+    string line = request + "\n";
+    if (sendAll(shardWorkers[shard].socket, line.data(), line.size())) return true;
+    cout << "Error: shard " << shard << " stopped.\n";
+    return false;
+}
+// Reads a reply up to SHARD_DONE; false if the worker stopped
+bool readShardReply(size_t shard, string& reply) {
+    char buffer[65536];
+    reply.clear();
+    for (;;) {
+        ssize_t count = read(shardWorkers[shard].socket, buffer, sizeof(buffer));
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) {
+            cout << "Error: shard " << shard << " stopped.\n";
+            return false;
         }
-        if (!isValidDate(appointmentDate)) {
-            cout << "Error: Invalid appointment date generated. Passport update cancelled.\n";
-            return;
+        reply.append(buffer, static_cast<size_t>(count));
+        if (reply.back() == SHARD_DONE) {
+            reply.pop_back();
+            return true;
         }
-        current->passType = newPassType;
-        current->id = newId;
-        current->name = newName;
-        current->dob = newDob;
-        current->passportNumber = enteredPassportNumber;
-        current->accountNumber = enteredAccountNumber;
-        current->balance = enteredBalance;
-        current->createdDate = createdDate;
-        current->appointmentDate = appointmentDate;
-        current->payment = newPayment;
-        current->paymentStatus = newPaymentStatus;
-        saveOldPassportsToFile();
-        cout << "Old passport updated successfully!\n";
-    } else {
-        cout << "Old passport ID not found.\n";
     }
 }
-void deleteNewPassport() {
- string idToDelete;
-    cout << "Enter New Passport ID to delete: ";
-    getline(cin, idToDelete);
-    NewPassport* current = newHead;
-    NewPassport* prev = nullptr;
-    while (current != nullptr && current->id != idToDelete) {
-        prev = current;
-        current = current->next;
+// Sends the request to every shard before reading any reply, so the shards
+// work on it in parallel
+bool fanOutShardRequest(const string& request, vector<string>& replies) {
+    replies.assign(shardWorkers.size(), string());
+    for (size_t shard = 0; shard < shardWorkers.size(); ++shard) {
+        if (!sendShardRequest(shard, request)) return false;
+    }
+    for (size_t shard = 0; shard < shardWorkers.size(); ++shard) {
+        if (!readShardReply(shard, replies[shard])) return false;
+    }
+    return true;
+}
+// Sends a yes/no request to every shard except `asker`; true if one says yes.
+// Those shards are idle while the router waits on the asking one.
+bool askOtherShards(size_t asker, const string& request) {
+    string reply;
+    for (size_t shard = 0; shard < shardWorkers.size(); ++shard) {
+        if (shard == asker) continue;
+        if (!sendShardRequest(shard, request) || !readShardReply(shard, reply)) return true; // Unknown counts as taken
+        if (reply == "1") return true;
+    }
+    return false;
+}
+// Runs a menu operation on one shard, showing its output and passing it the
+// lines typed at its prompts until it finishes
+bool runOnShard(size_t shard, const string& path, const vector<string>& answers) {
+    string request = "RUN\t" + path;
+    for (const string& answer : answers) request += "\t" + shardField(answer);
+    if (!sendShardRequest(shard, request)) return false;
+    char buffer[4096];
+    string line, question;
+    bool asking = false; // Inside a SHARD_ASK line
+    for (;;) {
+        ssize_t count = read(shardWorkers[shard].socket, buffer, sizeof(buffer));
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) {
+            cout << "Error: shard " << shard << " stopped.\n";
+            return false;
+        }
+        size_t start = 0;
+        for (size_t i = 0; i < static_cast<size_t>(count); ++i) {
+            if (asking) {
+                if (buffer[i] != '\n') {
+                    question += buffer[i];
+                } else {
+                    asking = false;
+                    start = i + 1;
+                    if (!sendShardRequest(shard, askOtherShards(shard, question) ? "1" : "0")) return false;
+                }
+                continue;
+            }
+            if (buffer[i] != SHARD_INPUT && buffer[i] != SHARD_DONE && buffer[i] != SHARD_ASK) continue;
+            cout.write(buffer + start, static_cast<streamsize>(i - start));
+            start = i + 1;
+            if (buffer[i] == SHARD_DONE) return true;
+            if (buffer[i] == SHARD_ASK) {
+                asking = true;
+                question.clear();
+                continue;
+            }
+            if (!getline(cin, line)) return false; // The input ended mid-operation
+            if (!sendShardRequest(shard, shardField(line))) return false;
+        }
+        if (!asking) cout.write(buffer + start, static_cast<streamsize>(count - static_cast<ssize_t>(start)));
+    }
+}
+template <typename T>
+vector<T> parseShardRows(const string& reply) {
+    vector<T> rows;
+    string line;
+    for (size_t pos = 0; pos < reply.size();) {
+        size_t end = min(reply.find('\n', pos), reply.size());
+        line.assign(reply, pos, end - pos);
+        pos = end + 1;
+        T record{};
+        if (parseCsvLine(line, &record)) rows.push_back(move(record));
+    }
+    return rows;
+}
+// Reads one shard's reply a line at a time, so that a merge holds a single
+// row per shard however long the lists are. A worker blocked on a full socket
+// simply waits until the merge gets to its rows.
+class ShardRowReader {
+public:
+    explicit ShardRowReader(size_t shard) : shard(shard) {}
+    // The next line of the reply; false at its end or when the worker stopped
+    bool nextLine(string& line) {
+        for (;;) {
+            size_t end = buffer.find('\n', pos);
+            if (end != string::npos) {
+                line.assign(buffer, pos, end - pos);
+                pos = end + 1;
+                return true;
+            }
+            if (done) return false;
+            buffer.erase(0, pos);
+            pos = 0;
+            char chunk[65536];
+            ssize_t count = read(shardWorkers[shard].socket, chunk, sizeof(chunk));
+            if (count < 0 && errno == EINTR) continue;
+            if (count <= 0) {
+                cout << "Error: shard " << shard << " stopped.\n";
+                failed = done = true;
+                return false;
+            }
+            buffer.append(chunk, static_cast<size_t>(count));
+            if (buffer.back() == SHARD_DONE) { // Nothing follows it until the next request
+                buffer.back() = '\n';
+                done = true;
+            }
+        }
+    }
+    template <typename T>
+    bool next(T& record) {
+        while (nextLine(line)) {
+            record = T{};
+            if (parseCsvLine(line, &record)) return true;
+        }
+        return false;
     }
-    if (current == nullptr) {
-        cout << "New passport ID not found.\n";
-        return;
+    bool failed = false;
+private:
+    size_t shard, pos = 0;
+    string buffer, line;
+    bool done = false;
+};
+// Sends the request to every shard and passes their rows, each shard's
+// already in list order, to `visit` in the active sort order as they arrive;
+// in insertion order the shards simply follow each other. Every reply is read
+// to its end. False if a worker stopped.
+template <typename T, typename Visit>
+bool mergeShardRows(const string& request, int sortOrder, Visit visit) {
+    for (size_t shard = 0; shard < shardWorkers.size(); ++shard) {
+        if (!sendShardRequest(shard, request)) return false;
     }
-    if (prev == nullptr) { // Deleting the head node
-        newHead = current->next;
-    } else { // Deleting a non-head node
-        prev->next = current->next;
+    vector<ShardRowReader> readers;
+    for (size_t shard = 0; shard < shardWorkers.size(); ++shard) readers.emplace_back(shard);
+    vector<T> heads(readers.size()); // Each shard's next row
+    bool ok = true;
+    if (sortOrder == 0) {
+        for (size_t shard = 0; shard < readers.size(); ++shard) {
+            while (readers[shard].next(heads[shard])) visit(heads[shard]);
+            ok = ok && !readers[shard].failed;
+        }
+        return ok;
     }
-    delete current; // Free the memory
-    saveNewPassportsToFile();
-    cout << "New passport deleted successfully!\n";
+    OrderKey (*keyOf)(const T*) = sortOrder == 1 ? nameOrderKey<T> : typeOrderKey<T>;
+    typedef pair<OrderKey, size_t> Head; // Key of a shard's next row, and the shard
+    priority_queue<Head, vector<Head>, greater<Head>> queue;
+    for (size_t shard = 0; shard < readers.size(); ++shard) {
+        if (readers[shard].next(heads[shard])) queue.push({keyOf(&heads[shard]), shard});
+    }
+    while (!queue.empty()) {
+        size_t shard = queue.top().second;
+        queue.pop();
+        visit(heads[shard]);
+        if (readers[shard].next(heads[shard])) queue.push({keyOf(&heads[shard]), shard});
+    }
+    for (const ShardRowReader& reader : readers) ok = ok && !reader.failed;
+    return ok;
 }
-void deleteOldPassport() {
-string idToDelete;
-    cout << "Enter Old Passport ID to delete: ";
-    getline(cin, idToDelete);
-    OldPassport* current = oldHead;
-    OldPassport* prev = nullptr;
-    while (current != nullptr && current->id != idToDelete) {
-        prev = current;
-        current = current->next;
+
+bool routeCreateNewPassport() {
+    string typeChoice, id;
+    cout << "Select Passport Type:\n1. Regular\n2. Urgent\nEnter choice (1 or 2): ";
+    getline(cin, typeChoice);
+    const int MAX_ID_LEN = 10;
+    bool taken;
+    do { // The ID picks the shard, so it is checked here
+        taken = false;
+        cout << "Enter ID (max " << MAX_ID_LEN << " chars, alphanumeric): ";
+        if (!getline(cin, id)) return false;
+        if (id.length() > MAX_ID_LEN) {
+            cout << "your size is limit pls try again (max " << MAX_ID_LEN << " chars).\n";
+            continue;
+        }
+        string reply;
+        if (!isAlphanumeric(id)) {
+            cout << "Invalid ID: Must be alphanumeric.\n";
+        } else {
+            size_t shard = shardOf(id);
+            if (!sendShardRequest(shard, "HAS\t" + id) || !readShardReply(shard, reply)) return false;
+            taken = reply == "1";
+            if (taken) cout << "Error: This ID already exists.\n";
+        }
+    } while (id.length() > MAX_ID_LEN || !isAlphanumeric(id) || taken);
+    return runOnShard(shardOf(id), "1.1", {to_string(atoi(typeChoice.c_str())), id});
+}
+bool routeCreateOldPassport() {
+    cout << "--- Create Old Passport ---\n";
+    int index = chooseSampleOldPassport();
+    if (index == -1) return true;
+    const string& id = sampleOldPassports[index][0];
+    return runOnShard(shardOf(id), "1.2", {"1", id});
+}
+bool routeById(const string& path, const char* prompt) {
+    string id;
+    cout << prompt;
+    if (!getline(cin, id)) return false;
+    return runOnShard(shardOf(id), path, {id});
+}
+template <typename T>
+bool searchShards(bool oldList, int choice, const string& input) {
+    const char* notFound = oldList ? "Old passport not found.\n" : "New passport not found.\n";
+    vector<string> replies;
+    string list = oldList ? "old" : "new";
+    if (!fanOutShardRequest((choice == 2 ? "FIND\t" : "MATCH\t") + list + "\t" + shardField(input), replies)) return false;
+    if (choice == 2) {
+        for (const string& reply : replies) {
+            vector<T> rows = parseShardRows<T>(reply);
+            if (rows.empty()) continue;
+            cout << (oldList ? "Old Passport Found:\n" : "New Passport Found:\n");
+            printRecordSummary(&rows[0]);
+            return true;
+        }
+        cout << notFound;
+        return true;
     }
-    if (current == nullptr) {
-        cout << "Old passport ID not found.\n";
-        return;
+    vector<pair<double, T>> matches;
+    string line;
+    for (const string& reply : replies) {
+        for (size_t pos = 0; pos < reply.size();) {
+            size_t end = min(reply.find('\n', pos), reply.size());
+            size_t tab = reply.find('\t', pos);
+            if (tab < end) {
+                line.assign(reply, tab + 1, end - tab - 1);
+                T record{};
+                if (parseCsvLine(line, &record)) matches.push_back({strtod(reply.c_str() + pos, nullptr), move(record)});
+            }
+            pos = end + 1;
+        }
     }
-    if (prev == nullptr) { // Deleting the head node
-        oldHead = current->next;
-    } else { // Deleting a non-head node
-        prev->next = current->next;
+    stable_sort(matches.begin(), matches.end(), [](const pair<double, T>& a, const pair<double, T>& b) {
+        return a.first > b.first;
+    });
+    if (matches.size() > 20) matches.erase(matches.begin() + 20, matches.end());
+    if (matches.empty()) {
+        cout << notFound;
+        return true;
     }
-    delete current; // Free the memory
-    saveOldPassportsToFile();
-    cout << "Old passport deleted successfully!\n";
+    cout << matches.size() << " match(es), best first:\n";
+    for (const auto& match : matches) {
+        cout << "[" << fixed << setprecision(2) << match.first << "] ";
+        printRecordSummary(&match.second);
+    }
+    return true;
 }
-void searchNewPassport() {
-   int choice;
-    cout << "Search New Passport By:\n1. ID\n2. Name\nEnter choice: ";
+bool routeSearch(bool oldList) {
+    int choice = 0;
+    cout << "Search " << (oldList ? "Old" : "New") << " Passport By:\n1. ID\n2. Name\n3. Name (partial or misspelled)\nEnter choice: ";
     cin >> choice;
-    cin.ignore();
-    string input;
-    if (choice == 1) {
-        cout << "Enter  ID to search: ";
-    } else if (choice == 2) {
-        cout << "Enter  Name to search: ";
-    } else {
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    if (choice < 1 || choice > 3) {
         cout << "Invalid choice.\n";
-        return;
+        return true;
     }
-    getline(cin, input);
-    NewPassport* temp = newHead;
-    while (temp != nullptr) {
-        if ((choice == 1 && temp->id == input) || (choice == 2 && temp->name == input)) {
-            cout << "New Passport Found:\n";
-            cout << "Type: " << temp->passType << ", ID: " << temp->id << ", Name: " << temp->name
-                 << ", DOB: " << temp->dob << ", Nationality: " << temp->nationality
-                 << ", Phone: " << temp->phoneNumber
-                 << ", Created: " << temp->createdDate << ", Appointment: " << temp->appointmentDate
-                 << ", Payment: $" << temp->payment << ", Status: " << temp->paymentStatus << "\n";
-            return;
-        }
-        temp = temp->next;
+    if (oldList) cout << (choice == 1 ? "Enter Old Passport ID to search: " : "Enter Old Passport Name to search: ");
+    else cout << (choice == 1 ? "Enter  ID to search: " : "Enter  Name to search: ");
+    string input;
+    if (!getline(cin, input)) return false;
+    if (choice == 1) return runOnShard(shardOf(input), oldList ? "4.2" : "4.1", {"1", input});
+    return oldList ? searchShards<OldPassport>(true, choice, input) : searchShards<NewPassport>(false, choice, input);
+}
+template <typename T>
+bool printShardQuery(bool oldList, const string& text) {
+    size_t matches = 0;
+    long long paymentCents = 0;
+    string request = string("QUERY\t") + (oldList ? "old" : "new") + "\t" + shardField(text);
+    if (!mergeShardRows<T>(request, oldList ? oldSortOrder : newSortOrder, [&](const T& record) {
+            printRecordSummary(&record);
+            paymentCents += llround(paymentAmount(&record) * 100);
+            ++matches;
+        })) {
+        return false;
     }
-    cout << "New passport not found.\n";
+    cout << matches << " match(es) from " << shardWorkers.size() << " shards, payments "
+         << formatCents(paymentCents) << ".\n";
+    return true;
 }
-void searchOldPassport() {
-    int choice;
-    cout << "Search Old Passport By:\n1. ID\n2. Name\nEnter choice: ";
-    cin >> choice;
-    cin.ignore();  
-    string input;
-    if (choice == 1) {
-        cout << "Enter Old Passport ID to search: ";
-    } else if (choice == 2) {
-        cout << "Enter Old Passport Name to search: ";
+bool routeQuery(bool oldList) {
+    string text = promptQueryText(oldList);
+    string error; // Checked here so that every shard gets a valid query
+    if (oldList) {
+        CompiledQuery<OldPassport> query;
+        error = compileQuery(text, oldQueryFields, query);
     } else {
-        cout << "Invalid choice.\n";
-        return;
+        CompiledQuery<NewPassport> query;
+        error = compileQuery(text, newQueryFields, query);
     }
-    getline(cin, input);
-    OldPassport* temp = oldHead;
-    while (temp != nullptr) {
-        if ((choice == 1 && temp->id == input) || (choice == 2 && temp->name == input)) {
-            cout << "Old Passport Found:\n";
-            cout << "Type: " << temp->passType << ", ID: " << temp->id << ", Name: " << temp->name
-                 << ", DOB: " << temp->dob << ", Issue Date: " << temp->issueDate
-                 << ", Expiry Date: " << temp->expiredDate << ", Passport Number: " << temp->passportNumber
-                 << ", Account Number: " << temp->accountNumber << ", Balance: $" << fixed << setprecision(2) << temp->balance
-                 << ", Created: " << temp->createdDate << ", Appointment: " << temp->appointmentDate
-                 << ", Payment: $" << temp->payment << ", Status: " << temp->paymentStatus << "\n";
-            return;
-        }
-        temp = temp->next;
+    if (!error.empty()) {
+        cout << "Invalid query: " << error << "\n";
+        return true;
     }
-    cout << "Old passport not found.\n";
+    return oldList ? printShardQuery<OldPassport>(true, text) : printShardQuery<NewPassport>(false, text);
 }
-void sortNewPassports() {
- if (newHead == nullptr || newHead->next == nullptr) {
-        cout << "No new passports to sort or only one passport exists.\n";
-        return;
+bool displayShardPassports(bool oldList) {
+    size_t shown = 0;
+    if (oldList) {
+        if (!mergeShardRows<OldPassport>("ROWS\told", oldSortOrder, [&shown](const OldPassport& record) {
+                if (shown++ == 0) cout << "\n-- List of Old Passports --\n";
+                printRecordSummary(&record);
+            })) {
+            return false;
+        }
+        if (shown == 0) cout << "No old passports found.\n";
+        return true;
     }
-    int sortOption;
-    cout << "Sort New Passports Options:\n1. Sort by Name\n2. Sort by Passport Type\nEnter choice (1 or 2): ";
+    cout << "\n--- New Passports ---\n";
+    if (!mergeShardRows<NewPassport>("ROWS\tnew", newSortOrder, [&shown](const NewPassport& record) {
+            printRecordBlock(&record);
+            ++shown;
+        })) {
+        return false;
+    }
+    if (shown == 0) cout << "No new passports to display.\n";
+    else cout << "--------------------------------\n";
+    return true;
+}
+bool routeSort(bool oldList) {
+    int sortOption = 0;
+    cout << "Sort " << (oldList ? "Old" : "New") << " Passports Options:\n1. Sort by Name\n2. Sort by Passport Type\nEnter choice (1 or 2): ";
     cin >> sortOption;
-    cin.ignore(numeric_limits<streamsize>::max(), '\n'); 
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
     if (sortOption != 1 && sortOption != 2) {
         cout << "Invalid sort option.\n";
-        return;
+        return true;
     }
-    NewPassport* current;
-    NewPassport* index;
-    for (current = newHead; current != nullptr; current = current->next) {
-        for (index = current->next; index != nullptr; index = index->next) {
-            bool shouldSwap = false;
-            if (sortOption == 1) {
-                if (current->name > index->name) {
-                    shouldSwap = true;
-                } else if (current->name == index->name && current->passType > index->passType) {
-                    shouldSwap = true; 
-                }
-            } else { 
-                if (current->passType > index->passType) {
-                    shouldSwap = true;
-                } else if (current->passType == index->passType && current->name > index->name) {
-                    shouldSwap = true; 
-                }
-            }
-            if (shouldSwap) {          
-                string tempPassType = current->passType;
-                string tempId = current->id;
-                string tempName = current->name;
-                string tempDob = current->dob;
-                string tempNationality = current->nationality;
-                string tempPhoneNumber = current->phoneNumber;
-                string tempCreatedDate = current->createdDate;
-                string tempAppointmentDate = current->appointmentDate;
-                string tempPayment = current->payment;
-                string tempPaymentStatus = current->paymentStatus;
-                current->passType = index->passType;
-                current->id = index->id;
-                current->name = index->name;
-                current->dob = index->dob;
-                current->nationality = index->nationality;
-                current->phoneNumber = index->phoneNumber;
-                current->createdDate = index->createdDate;
-                current->appointmentDate = index->appointmentDate;
-                current->payment = index->payment;
-                current->paymentStatus = index->paymentStatus;
-                index->passType = tempPassType;
-                index->id = tempId;
-                index->name = tempName;
-                index->dob = tempDob;
-                index->nationality = tempNationality;
-                index->phoneNumber = tempPhoneNumber;
-                index->createdDate = tempCreatedDate;
-                index->appointmentDate = tempAppointmentDate;
-                index->payment = tempPayment;
-                index->paymentStatus = tempPaymentStatus;
+    vector<string> replies;
+    if (!fanOutShardRequest(string("SORT\t") + (oldList ? "old" : "new") + "\t" + to_string(sortOption), replies)) return false;
+    (oldList ? oldSortOrder : newSortOrder) = sortOption; // The order the router merges in
+    saveSortOrder();
+    cout << (oldList ? "Old" : "New") << " passports sorted by " << (sortOption == 1 ? "name" : "passport type") << ".\n";
+    return true;
+}
+// Each shard sends its own report totals, which the router adds up
+bool readShardReports(const string& list, PassportReport& total) {
+    vector<string> replies;
+    if (!fanOutShardRequest("REPORT\t" + list, replies)) return false;
+    for (const string& reply : replies) {
+        const char* text = reply.c_str();
+        char* end;
+        total.records += strtoll(text, &end, 10);
+        total.collectedCents += strtoll(end, &end, 10);
+        total.outstandingCents += strtoll(end, &end, 10);
+        total.balanceCents += strtoll(end, &end, 10);
+        for (size_t pos = reply.find('\n'); pos != string::npos && pos + 1 < reply.size();) {
+            size_t lineEnd = min(reply.find('\n', pos + 1), reply.size());
+            size_t map = strtoul(text + pos + 1, &end, 10);
+            long long count = strtoll(end, &end, 10);
+            size_t key = static_cast<size_t>(end - text) + 1; // After the tab
+            if (map < size(reportCounts) && key <= lineEnd) {
+                adjustCount(total.*reportCounts[map], reply.substr(key, lineEnd - key), count);
             }
+            pos = lineEnd;
         }
     }
-    saveNewPassportsToFile();
-    cout << "New passports sorted by " << (sortOption == 1 ? "name" : "passport type") << ".\n";
+    return true;
 }
-void sortOldPassports() {
-   if (oldHead == nullptr || oldHead->next == nullptr) {
-        cout << "No old passports to sort or only one passport exists.\n";
-        return;
-    }
-    int sortOption;
-    cout << "Sort Old Passports Options:\n1. Sort by Name\n2. Sort by Passport Type\nEnter choice (1 or 2): ";
-    cin >> sortOption;
-    cin.ignore(numeric_limits<streamsize>::max(), '\n'); 
-    if (sortOption != 1 && sortOption != 2) {
-        cout << "Invalid sort option.\n";
-        return;
+bool routeReport() {
+    PassportReport newTotal, oldTotal;
+    if (!readShardReports("new", newTotal) || !readShardReports("old", oldTotal)) return false;
+    printReport(newTotal, oldTotal);
+    return true;
+}
+int promptShardSubmenu(const char* title, const char* first, const char* second) {
+    int choice = 0;
+    cout << "\n--- " << title << " ---\n1. " << first << "\n2. " << second << "\nEnter choice (1 or 2): ";
+    cin >> choice;
+    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    if (choice != 1 && choice != 2) cout << "Invalid choice. Returning to main menu.\n";
+    return choice;
+}
+// The router's menu loop; returns the exit code
+int runShardRouter() {
+    vector<string> replies;
+    if (!fanOutShardRequest("PING", replies)) { // Every shard has loaded its records
+        stopShardWorkers(true);
+        return 1;
     }
-    OldPassport* current;
-    OldPassport* index;
-    for (current = oldHead; current != nullptr; current = current->next) {
-        for (index = current->next; index != nullptr; index = index->next) {
-            bool shouldSwap = false;
-            if (sortOption == 1) { 
-                if (current->name > index->name) {
-                    shouldSwap = true;
-                } else if (current->name == index->name && current->passType > index->passType) {
-                    shouldSwap = true; 
-                }
-            } else { 
-                if (current->passType > index->passType) {
-                    shouldSwap = true;
-                } else if (current->passType == index->passType && current->name > index->name) {
-                    shouldSwap = true; 
-                }
-            }
-            if (shouldSwap) {               
-                string tempPassType = current->passType;
-                string tempId = current->id;
-                string tempName = current->name;
-                string tempDob = current->dob;
-                string tempIssueDate = current->issueDate;
-                string tempExpiredDate = current->expiredDate;
-                string tempPassportNumber = current->passportNumber;
-                string tempAccountNumber = current->accountNumber;
-                double tempBalance = current->balance;
-                string tempCreatedDate = current->createdDate;
-                string tempAppointmentDate = current->appointmentDate;
-                string tempPayment = current->payment;
-                string tempPaymentStatus = current->paymentStatus;
-                current->passType = index->passType;
-                current->id = index->id;
-                current->name = index->name;
-                current->dob = index->dob;
-                current->issueDate = index->issueDate;
-                current->expiredDate = index->expiredDate;
-                current->passportNumber = index->passportNumber;
-                current->accountNumber = index->accountNumber;
-                current->balance = index->balance;
-                current->createdDate = index->createdDate;
-                current->appointmentDate = index->appointmentDate;
-                current->payment = index->payment;
-                current->paymentStatus = index->paymentStatus;
-                index->passType = tempPassType;
-                index->id = tempId;
-                index->name = tempName;
-                index->dob = tempDob;
-                index->issueDate = tempIssueDate;
-                index->expiredDate = tempExpiredDate;
-                index->passportNumber = tempPassportNumber;
-                index->accountNumber = tempAccountNumber;
-                index->balance = tempBalance;
-                index->createdDate = tempCreatedDate;
-                index->appointmentDate = tempAppointmentDate;
-                index->payment = tempPayment;
-                index->paymentStatus = tempPaymentStatus;
-            }
+    int choice = 0;
+    bool running = true;
+    do {
+        cout << "\n--- Passport Management System ---\n";
+        cout << "1. Create Passport\n";
+        cout << "2. Update Passport\n";
+        cout << "3. Delete Passport\n";
+        cout << "4. Search Passport\n";
+        cout << "5. Display Passports\n";
+        cout << "6. Sort Passports\n";
+        cout << "7. Tools\n";
+        cout << "8. Reports\n";
+        cout << "0. Exit\n";
+        cout << "(Router for " << shardWorkers.size() << " shards)\n";
+        cout << "Enter your choice: ";
+        if (!(cin >> choice)) {
+            running = false;
+            break;
         }
-    }
-    saveOldPassportsToFile();
-    cout << "Old passports sorted by " << (sortOption == 1 ? "name" : "passport type") << ".\n";
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        int subChoice;
+        switch (choice) {
+            case 1:
+                subChoice = promptShardSubmenu("Create Passport", "Create New Passport", "Create Old Passports (Automated Sample)");
+                if (subChoice == 1) running = routeCreateNewPassport();
+                else if (subChoice == 2) running = routeCreateOldPassport();
+                break;
+            case 2:
+                subChoice = promptShardSubmenu("Update Passport", "Update New Passport", "Update Old Passport");
+                if (subChoice == 1) running = routeById("2.1", "Enter New Passport ID to update: ");
+                else if (subChoice == 2) running = routeById("2.2", "Enter Old Passport ID to update: ");
+                break;
+            case 3:
+                subChoice = promptShardSubmenu("Delete Passport", "Delete New Passport", "Delete Old Passport");
+                if (subChoice == 1) running = routeById("3.1", "Enter New Passport ID to delete: ");
+                else if (subChoice == 2) running = routeById("3.2", "Enter Old Passport ID to delete: ");
+                break;
+            case 4:
+                cout << "\n--- Search Passport ---\n";
+                cout << "1. Search New Passport\n2. Search Old Passport\n3. Query New Passports\n4. Query Old Passports\n";
+                cout << "Enter choice (1-4): ";
+                cin >> subChoice;
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                if (subChoice == 1 || subChoice == 2) running = routeSearch(subChoice == 2);
+                else if (subChoice == 3 || subChoice == 4) running = routeQuery(subChoice == 4);
+                else cout << "Invalid choice. Returning to main menu.\n";
+                break;
+            case 5:
+                subChoice = promptShardSubmenu("Display Passports", "Display New Passports", "Display Old Passports");
+                if (subChoice == 1 || subChoice == 2) running = displayShardPassports(subChoice == 2);
+                break;
+            case 6:
+                subChoice = promptShardSubmenu("Sort Passports", "Sort New Passports", "Sort Old Passports");
+                if (subChoice == 1 || subChoice == 2) running = routeSort(subChoice == 2);
+                break;
+            case 7:
+                cout << "The tools work on one shard at a time: run the program with --data-dir on a shard directory"
+                     << " (shard0 to shard" << shardWorkers.size() - 1 << ").\n";
+                break;
+            case 8: running = routeReport(); break;
+            case 0: cout << "Exiting program. Goodbye!\n"; break;
+            default: cout << "Invalid choice. Please try again.\n"; break;
+        }
+    } while (running && choice != 0);
+    stopShardWorkers(!running);
+    return 0;
 }
-void displayNewPassports() {
-    cout << "\n--- New Passports ---\n";
-    if (newHead == nullptr) {
-        cout << "No new passports to display.\n";
-        return;
+#else
+bool passportNumberOnOtherShards(const string&) { return false; }
+#endif
+
+// --- Self Test ---
+// --self-test runs checks that need no data directory and exits, with 1 if
+// any failed. Checks that write files work in a scratch directory.
+bool selfTestFailed = false;
+void selfTestCheck(bool passed, const string& what) {
+    cout << (passed ? "ok    " : "FAIL  ") << what << "\n";
+    if (!passed) selfTestFailed = true;
+}
+// Saves records whose date columns hold `dates` to the compact file and loads
+// them back; true if every field came back as written
+template <typename T, size_t N>
+bool compactDatesRoundTrip(const vector<string>& dates, const CompactColumn<T> (&columns)[N], void (*save)(), bool (*load)()) {
+    RecordPool<T>& pool = recordPool(static_cast<const T*>(nullptr));
+    for (size_t i = 0; i < dates.size(); ++i) {
+        T* record = pool.allocate();
+        for (const CompactColumn<T>& column : columns) {
+            record->*column.field = column.coding == DateColumn ? dates[i] : "T" + to_string(i);
+        }
+        appendRecord(record);
     }
-    NewPassport* temp = newHead;
-    while (temp != nullptr) {
-        cout << "--------------------------------\n";
-        cout << "Passport Type: " << temp->passType << "\n";
-        // Removed display for Site Location, City, Office
-        cout << "ID: " << temp->id << "\n";
-        cout << "Name: " << temp->name << "\n";
-        cout << "DOB: " << temp->dob << "\n";
-        cout << "Nationality: " << temp->nationality << "\n";
-        cout << "Phone Number: " << temp->phoneNumber << "\n";
-        cout << "Created Date: " << temp->createdDate << "\n";
-        cout << "Appointment Date: " << temp->appointmentDate << "\n";
-        cout << "Payment: " << temp->payment << "\n";
-        cout << "Payment Status: " << temp->paymentStatus << "\n";
-        temp = temp->next;
+    save();
+    size_t row = 0;
+    bool same = load() && !damagedDataFiles;
+    for (const T* record = listHead(static_cast<const T*>(nullptr)); record != nullptr && same; record = record->next, ++row) {
+        for (const CompactColumn<T>& column : columns) {
+            same = same && row < dates.size() && record->*column.field == (column.coding == DateColumn ? dates[row] : "T" + to_string(row));
+        }
     }
-    cout << "--------------------------------\n";
+    return same && row == dates.size();
 }
-void displayOldPassports() {
-    if (oldHead == nullptr) {
-        cout << "No old passports found.\n";
-        return;
-    }
-    cout << "\n-- List of Old Passports --\n";
-    OldPassport* temp = oldHead;
-    while (temp != nullptr) {
-        cout << "Type: " << temp->passType << ", ID: " << temp->id << ", Name: " << temp->name
-             << ", DOB: " << temp->dob << ", Issue Date: " << temp->issueDate
-             << ", Expiry Date: " << temp->expiredDate << ", Passport Number: " << temp->passportNumber
-             << ", Account Number: " << temp->accountNumber << ", Balance: $" << fixed << setprecision(2) << temp->balance
-             << ", Created: " << temp->createdDate << ", Appointment: " << temp->appointmentDate
-             << ", Payment: $" << temp->payment << ", Status: " << temp->paymentStatus << "\n";
-        temp = temp->next;
+void selfTestCompactDates() {
+    // Impossible dates are written by getDateOneMonthLater (Jan 31 + 1 month)
+    const vector<string> dates = {"2024-02-29", "2024-02-31", "2023-02-29", "2024-04-31", "", "N/A", "2024-13-01",
+                                  "0000-00-00", "1970-01-01", "2026-01-31"};
+    selfTestCheck(compactDatesRoundTrip(dates, newCompactColumns, saveNewPassportsCompact, loadNewPassportsCompact),
+                  "compact new passports keep impossible and empty dates");
+    selfTestCheck(compactDatesRoundTrip(dates, oldCompactColumns, saveOldPassportsCompact, loadOldPassportsCompact),
+                  "compact old passports keep impossible and empty dates");
+    freeNewPassportList();
+    freeOldPassportList();
+}
+// Runs each query through the column scan and through the text predicates
+// over the same records; true if both select the same rows every time
+bool queryPathsAgree(const ColumnStore<NewPassport>& columns, const vector<string>& queries) {
+    for (const string& text : queries) {
+        CompiledQuery<NewPassport> query;
+        if (!compileQuery(text, newQueryFields, query).empty()) return false;
+        set<const NewPassport*> scanned, expected;
+        scanColumns(query, columns, NEW_PAYMENT_FIELD, [&](const NewPassport* record) { scanned.insert(record); });
+        for (size_t row = 0; row < columns.size(); ++row) {
+            if (query.matches(columns.record(row))) expected.insert(columns.record(row));
+        }
+        if (scanned != expected) {
+            cout << "      '" << text << "': " << scanned.size() << " from the columns, " << expected.size() << " expected\n";
+            return false;
+        }
     }
+    return true;
 }
-void freeNewPassportList() {
-    NewPassport* current = newHead;
-    NewPassport* nextNode;
-    while (current != nullptr) {
-        nextNode = current->next;
-        delete current;
-        current = nextNode;
+void selfTestQueryDates() {
+    const vector<string> dates = {"2024-02-29", "2024-02-31", "2024-03-02", "", "N/A", "2024-13-01",
+                                  "1970-01-01", "2026-01-31", "2025-12-31", "0000-00-00", "2024-3-2"};
+    const vector<string> queries = {"appointment < 2026-01-01", "appointment <= 2024-03-02", "appointment = 2024-03-02",
+                                    "appointment != 2024-03-02", "appointment > 2024-02-29", "appointment >= 2024-02-31",
+                                    "appointment < 2026-01-01 AND created > 2024-02-31", "type = Regular AND created >= 2024-03-02",
+                                    "created != N/A AND appointment <= 2025-12-31"};
+    vector<NewPassport> records(200);
+    ColumnStore<NewPassport> columns(newQueryFields);
+    for (size_t i = 0; i < records.size(); ++i) {
+        NewPassport& record = records[i];
+        record.passType = i % 2 == 0 ? "Regular" : "Urgent";
+        record.id = "Q" + to_string(i);
+        record.createdDate = dates[i % dates.size()];
+        record.appointmentDate = dates[i * 7 % dates.size()];
+        record.payment = "0";
+        record.paymentStatus = "Unpaid";
+        columns.add(&record);
     }
-    newHead = nullptr;
+    selfTestCheck(queryPathsAgree(columns, queries), "column scan and text predicates agree on dates");
+    for (size_t i = 0; i < records.size(); i += 3) columns.remove(&records[i]);
+    selfTestCheck(queryPathsAgree(columns, queries), "column scan and text predicates agree after removals");
 }
-void freeOldPassportList() {
- OldPassport* current = oldHead;
-    OldPassport* nextNode;
-    while (current != nullptr) {
-        nextNode = current->next;
-        delete current;
-        current = nextNode;
+int runSelfTest() {
+    error_code ec;
+    filesystem::path previous = filesystem::current_path(ec);
+    filesystem::path scratch = filesystem::temp_directory_path(ec) /
+                               ("passport-self-test-" + to_string(chrono::steady_clock::now().time_since_epoch().count()));
+    if (ec || !filesystem::create_directory(scratch, ec)) {
+        cout << "Error: cannot create a scratch directory for the self test.\n";
+        return 1;
     }
-    oldHead = nullptr;
+    filesystem::current_path(scratch, ec);
+    selfTestCompactDates();
+    selfTestQueryDates();
+    filesystem::current_path(previous, ec);
+    filesystem::remove_all(scratch, ec);
+    cout << (selfTestFailed ? "Self test failed.\n" : "All checks passed.\n");
+    return selfTestFailed ? 1 : 0;
+}
 
+// Reads a command-line number: the whole argument, in decimal, within [lo, hi]
+bool parseOptionNumber(const char* text, long lo, long hi, long& value) {
+    char* end;
+    errno = 0;
+    value = strtol(text, &end, 10);
+    return end != text && *end == '\0' && errno == 0 && value >= lo && value <= hi;
 }
-int main() {
-    loadNewPassportsFromFile(); // Load data on startup
-    loadOldPassportsFromFile(); // Load data on startup
 
-    int choice;
-    do {
-        cout << "\n--- Passport Management System ---\n";
-        cout << "1. Create Passport\n";
-        cout << "2. Update Passport\n";   
-        cout << "3. Delete Passport\n";   
-        cout << "4. Search Passport\n";  
-        cout << "5. Display Passports\n"; 
-        cout << "6. Sort Passports\n";    
-        cout << "0. Exit\n";
-        cout << "Enter your choice: ";
-        cin >> choice;
-        cin.ignore(numeric_limits<streamsize>::max(), '\n'); // Clear buffer after numeric input
+int main(int argc, char* argv[]) {
+    string externalSortList, externalSortKeyName, dataDirectory;
+    bool replicatePrimary = false, tailChanges = false;
+    string changeConsumer, recordFileName, replayFileName, transcriptFileName, statementFileName;
+    string transcriptMix = defaultTranscriptMix;
+    size_t transcriptOperationCount = 0;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--lazy") {
+            lazyLoadMode = true;
+        } else if (arg == "--run-size" && i + 1 < argc) {
+            long megabytes;
+            if (!parseOptionNumber(argv[++i], 1, 1 << 20, megabytes)) {
+                cout << "Error: --run-size takes a whole number of megabytes, at least 1.\n";
+                return 1;
+            }
+            externalSortRunBytes = static_cast<size_t>(megabytes) << 20;
+        } else if (arg == "--external-sort" && i + 2 < argc) {
+            externalSortList = argv[++i];
+            externalSortKeyName = argv[++i];
+        } else if (arg == "--compact") {
+            compactStorageMode = true;
+        } else if (arg == "--slots") {
+            slotStorageMode = true;
+        } else if (arg == "--replicate") {
+            replicatePrimary = true;
+        } else if (arg == "--follow" && i + 1 < argc) {
+            followDirectory = argv[++i];
+        } else if (arg == "--data-dir" && i + 1 < argc) {
+            dataDirectory = argv[++i];
+        } else if ((arg == "--consume-changes" || arg == "--tail-changes") && i + 1 < argc) {
+            changeConsumer = argv[++i];
+            tailChanges = arg == "--tail-changes";
+        } else if (arg == "--record" && i + 1 < argc) {
+            recordFileName = argv[++i];
+        } else if (arg == "--replay" && i + 1 < argc) {
+            replayFileName = argv[++i];
+        } else if (arg == "--generate" && i + 2 < argc) {
+            transcriptFileName = argv[++i];
+            transcriptOperationCount = static_cast<size_t>(atol(argv[++i]));
+        } else if (arg == "--shards" && i + 1 < argc) {
+            long count;
+            if (!parseOptionNumber(argv[++i], 1, 64, count)) {
+                cout << "Error: --shards takes 1 to 64 shards.\n";
+                return 1;
+            }
+            shardCount = static_cast<int>(count);
+        } else if (arg == "--self-test") {
+            return runSelfTest();
+        } else if (arg == "--watch") {
+            watchDataFilesMode = true;
+        } else if (arg == "--reconcile" && i + 1 < argc) {
+            statementFileName = argv[++i];
+        } else if (arg == "--mix" && i + 1 < argc) {
+            transcriptMix = argv[++i];
+        } else if (arg == "--archive-after" && i + 1 < argc) {
+            long days;
+            if (!parseOptionNumber(argv[++i], 1, 36500, days)) {
+                cout << "Error: --archive-after takes a whole number of days, 1 to 36500.\n";
+                return 1;
+            }
+            archiveAfterDays = static_cast<int>(days);
+        } else if (arg == "--sweep-interval" && i + 1 < argc) {
+            long minutes;
+            if (!parseOptionNumber(argv[++i], 1, 525600, minutes)) {
+                cout << "Error: --sweep-interval takes a whole number of minutes, 1 to 525600 (a year).\n";
+                return 1;
+            }
+            sweepIntervalMinutes = static_cast<int>(minutes);
+        } else if (arg == "--cache-size" && i + 1 < argc) {
+            long capacity;
+            if (!parseOptionNumber(argv[++i], 1, 1 << 24, capacity)) {
+                cout << "Error: --cache-size takes a whole number of records, 1 to 16777216.\n";
+                return 1;
+            }
+            newRecordCache.setCapacity(static_cast<size_t>(capacity));
+            oldRecordCache.setCapacity(static_cast<size_t>(capacity));
+        } else {
+            cout << "Unknown option: " << arg << "\n";
+            cout << "Usage: " << argv[0] << " [--lazy] [--cache-size N] [--compact | --slots] [--run-size MB]"
+                 << " [--external-sort new|old name|type]"
+                 << " [--data-dir DIR] [--replicate | --follow PRIMARY_DIR | --shards N]"
+                 << " [--archive-after DAYS] [--sweep-interval MINUTES] [--watch]"
+                 << " [--consume-changes NAME | --tail-changes NAME] [--reconcile FILE]"
+                 << " [--record FILE | --replay FILE | --generate FILE OPS [--mix NAME=WEIGHT,...]] [--self-test]\n";
+            return 1;
+        }
+    }
+    if (!dataDirectory.empty()) {
+#ifdef HAVE_POSIX_IO
+        char cwd[4096];
+        if (!followDirectory.empty() && followDirectory[0] != '/' && getcwd(cwd, sizeof(cwd)) != nullptr) {
+            followDirectory = string(cwd) + "/" + followDirectory; // Relative to where we were started
+        }
+        if (chdir(dataDirectory.c_str()) != 0) {
+            cout << "Error: cannot use data directory " << dataDirectory << "\n";
+            return 1;
+        }
+#else
+        cout << "Error: --data-dir is not supported on this platform.\n";
+        return 1;
+#endif
+    }
+    if (!changeConsumer.empty()) { // Batch mode: print the change feed from a checkpoint
+        consumeChanges(changeConsumer, tailChanges);
+        return 0;
+    }
+    if (!externalSortList.empty()) { // Batch mode: sort the files and exit
+        if ((externalSortList != "new" && externalSortList != "old") || (externalSortKeyName != "name" && externalSortKeyName != "type")) {
+            cout << "Error: --external-sort takes new or old, then name or type.\n";
+            return 1;
+        }
+        externalSortPassports(externalSortList == "old", externalSortKeyName == "type" ? 2 : 1);
+        return 0;
+    }
+    loadSortOrder();
+    if (!recordFileName.empty() + !replayFileName.empty() + !transcriptFileName.empty() > 1) {
+        cout << "Error: choose one of --record, --replay and --generate.\n";
+        return 1;
+    }
+    if (compactStorageMode && slotStorageMode) {
+        cout << "Error: choose either --compact or --slots.\n";
+        return 1;
+    }
+    if (!followDirectory.empty() && (replicatePrimary || compactStorageMode || slotStorageMode)) {
+        cout << "Error: a follower keeps CSV files and cannot use --replicate, --compact or --slots.\n";
+        return 1;
+    }
+    if (sweepIntervalMinutes > 0 && archiveAfterDays <= 0) {
+        cout << "Error: --sweep-interval needs --archive-after DAYS.\n";
+        return 1;
+    }
+    if (!followDirectory.empty() && archiveAfterDays > 0) {
+        cout << "Error: a follower cannot archive records.\n";
+        return 1;
+    }
+    if (watchDataFilesMode && (compactStorageMode || slotStorageMode || !followDirectory.empty())) {
+        cout << "Error: --watch follows the CSV files and cannot be combined with --compact, --slots or --follow.\n";
+        return 1;
+    }
+#ifndef HAVE_INOTIFY
+    if (watchDataFilesMode) {
+        cout << "Error: --watch is not supported on this platform.\n";
+        return 1;
+    }
+#endif
+    if (shardCount > 0 && (lazyLoadMode || compactStorageMode || slotStorageMode || replicatePrimary || !followDirectory.empty()
+                           || archiveAfterDays > 0 || !recordFileName.empty() || !replayFileName.empty()
+                           || !transcriptFileName.empty() || !statementFileName.empty() || watchDataFilesMode)) {
+        cout << "Error: --shards keeps CSV files and runs the menu only; it cannot be combined with --lazy, --compact,"
+             << " --slots, --replicate, --follow, --archive-after, --record, --replay, --generate, --reconcile or --watch.\n";
+        return 1;
+    }
+    if (shardCount > 0) {
+#ifdef HAVE_POSIX_IO
+        if (!prepareShardDirectories(shardCount)) return 1;
+        if (startShardWorkers(shardCount)) return runShardRouter(); // Workers go on to load their shard
+#else
+        cout << "Error: --shards is not supported on this platform.\n";
+        return 1;
+#endif
+    }
+    if (!replayFileName.empty()) {
+        replayFileName = filesystem::absolute(replayFileName).string(); // Relative to the data directory
+        if (!enterReplayDirectory()) return 1;
+    }
+    if (lazyLoadMode && (replicatePrimary || !followDirectory.empty() || sweepIntervalMinutes > 0 || watchDataFilesMode)) {
+        cout << "Note: --lazy is ignored with --replicate, --follow, --sweep-interval or --watch.\n";
+        lazyLoadMode = false;
+    }
+    if (lazyLoadMode && (compactStorageMode || slotStorageMode)) {
+        cout << "Note: --lazy indexes CSV files only and is ignored with --compact or --slots.\n";
+        lazyLoadMode = false;
+    }
+    // A follower is the only writer of its directory; everyone else coordinates
+    bool coordinated = followDirectory.empty();
+    if (coordinated && !openInstanceLocks(slotStorageMode || replicatePrimary)) return 1;
+#ifdef HAVE_INOTIFY
+    int watchFd = watchDataFilesMode ? openDataFileWatch() : -1; // Before loading, so no change is missed
+    if (watchDataFilesMode && watchFd < 0) return 1;
+#endif
+    unique_lock<mutex> startupLock(storeMutex);
+    lockInstance(); // Read the files and the feed as of one generation
+    thread follower;
+    if (!followDirectory.empty()) { // Start empty; the lists come from the primary's log
+        rebuildBloomFilters();
+        followerRunning = true;
+        follower = thread(followPrimary);
+    } else if (lazyLoadMode) {
+        buildNewPassportIndex(); // Index only, records are read on demand
+        buildOldPassportIndex();
+    } else {
+        loadNewPassportsFromFile(); // Load data on startup
+        loadOldPassportsFromFile(); // Load data on startup
+    }
+    exitIfDataDamaged();
+    // Reuse the persisted filters when they match the data files; in lazy mode
+    // a stale file is rebuilt once the lists are loaded
+    if (followDirectory.empty() && !loadBloomFilters() && !lazyLoadMode) rebuildBloomFilters();
+    if (replicatePrimary && !startReplicationLog()) return 1;
+    if (followDirectory.empty() && !openChangeFeed()) return 1; // A follower's changes come from the primary
+    if (coordinated) syncWithChangeFeed();
+    if (followDirectory.empty() && !compactStorageMode && !slotStorageMode) {
+        recordMissingChecksums();
+        mergeOutsideChanges(); // Rows appended while no instance ran
+    }
+    unlockInstance();
+    startupLock.unlock();
+    if (!transcriptFileName.empty()) { // Batch mode: write a synthetic session and exit
+        bool written = generateTranscript(transcriptFileName, transcriptOperationCount, transcriptMix);
+        freeNewPassportList();
+        freeOldPassportList();
+        return written ? 0 : 1;
+    }
+    if (!statementFileName.empty()) { // Batch mode: settle the payments of a bank statement and exit
+        bool reconciled = reconcilePayments(statementFileName);
+        freeNewPassportList();
+        freeOldPassportList();
+        return reconciled ? 0 : 1;
+    }
+#ifdef HAVE_POSIX_IO
+    if (shardIndex >= 0) { // Shard worker: serve the router instead of the terminal
+        serveShard();
+        freeNewPassportList();
+        freeOldPassportList();
+        return 0;
+    }
+#endif
+    thread sweeper;
+    if (sweepIntervalMinutes > 0) {
+        sweeperRunning = true;
+        sweeper = thread(sweepPeriodically);
+    }
+    streambuf* consoleInput = cin.rdbuf();
+    ofstream recordFile;
+    TeeInputBuffer recordBuffer(consoleInput, recordFile);
+    if (!recordFileName.empty()) {
+        recordFile.open(recordFileName, ios::trunc);
+        if (!recordFile) {
+            cout << "Error opening file " << recordFileName << " for writing!\n";
+            return 1;
+        }
+        cin.rdbuf(&recordBuffer);
+    }
+    ifstream replayFile;
+    NullOutputBuffer discardedOutput;
+    streambuf* consoleOutput = cout.rdbuf();
+    chrono::steady_clock::time_point replayStarted = chrono::steady_clock::now();
+    if (!replayFileName.empty()) {
+        replayFile.open(replayFileName);
+        if (!replayFile) {
+            cout << "Error opening file " << replayFileName << " for reading!\n";
+            return 1;
+        }
+        replayMode = true;
+        cin.rdbuf(replayFile.rdbuf());
+        // A transcript made for other data would leave a prompt reading a
+        // failed stream forever; stop at the first input that does not fit.
+        // The exception unwinds to the menu loop, releasing the locks held.
+        cin.exceptions(ios::failbit);
+        cout.rdbuf(&discardedOutput); // Prompts and results would only measure the terminal
+        replayStarted = chrono::steady_clock::now();
+    }
+    thread watcher;
+#ifdef HAVE_INOTIFY
+    if (watchDataFilesMode) {
+        watcherRunning = true;
+        watcher = thread(watchDataFiles, watchFd);
+    }
+#endif
 
-        switch (choice) {
-            case 1: { // Create Passport Sub-menu
-                int createChoice;
-                cout << "\n--- Create Passport ---\n";
-                cout << "1. Create New Passport\n";
-                cout << "2. Create Old Passports (Automated Sample)\n";
-                cout << "Enter choice (1 or 2): ";
-                cin >> createChoice;
-                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    int choice, exitStatus = 0;
+    try {
+        do {
+            cout << "\n--- Passport Management System ---\n";
+            cout << "1. Create Passport\n";
+            cout << "2. Update Passport\n";   
+            cout << "3. Delete Passport\n";   
+            cout << "4. Search Passport\n";  
+            cout << "5. Display Passports\n"; 
+            cout << "6. Sort Passports\n";    
+            cout << "7. Tools\n";
+            cout << "8. Reports\n";
+            cout << "0. Exit\n";
+            if (!followDirectory.empty()) {
+                cout << "(Read-only replica of " << followDirectory << ", applied through change " << replicaAppliedSeq << ")\n";
+            }
+            if (watchDataFilesMode) {
+                cout << "(Watching the data files, " << outsideChangesApplied << " change(s) from other tools applied)\n";
+            }
+            cout << "Enter your choice: ";
+            if (replayMode && (cin >> ws).eof()) break; // The transcript ended without choosing Exit
+            cin >> choice;
+            cin.ignore(numeric_limits<streamsize>::max(), '\n'); // Clear buffer after numeric input
+            if (!followDirectory.empty() && (choice == 1 || choice == 2 || choice == 3 || choice == 6)) {
+                cout << "This is a read-only replica. Make changes on the primary.\n";
+                continue;
+            }
+            chrono::steady_clock::time_point started = chrono::steady_clock::now();
+            menuPath = to_string(choice);
+            refreshFromOtherInstances(); // Pick up what other terminals changed meanwhile
+
+            switch (choice) {
+                case 1: { // Create Passport Sub-menu
+                    int createChoice;
+                    cout << "\n--- Create Passport ---\n";
+                    cout << "1. Create New Passport\n";
+                    cout << "2. Create Old Passports (Automated Sample)\n";
+                    cout << "Enter choice (1 or 2): ";
+                    cin >> createChoice;
+                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    noteMenuChoice(createChoice);
 
-                switch (createChoice) {
-                    case 1: createNewPassport(); break;
-                    case 2: createOldPassports(); break;
-                    default: cout << "Invalid choice. Returning to main menu.\n"; break;
+                    switch (createChoice) {
+                        case 1: createNewPassport(); break;
+                        case 2: createOldPassports(); break;
+                        default: cout << "Invalid choice. Returning to main menu.\n"; break;
+                    }
+                    break;
                 }
-                break;
-            }
-            case 2: { // Update Passport Sub-menu
-                int updateChoice;
-                cout << "\n--- Update Passport ---\n";
-                cout << "1. Update New Passport\n";
-                cout << "2. Update Old Passport\n";
-                cout << "Enter choice (1 or 2): ";
-                cin >> updateChoice;
-                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                case 2: { // Update Passport Sub-menu
+                    int updateChoice;
+                    cout << "\n--- Update Passport ---\n";
+                    cout << "1. Update New Passport\n";
+                    cout << "2. Update Old Passport\n";
+                    cout << "Enter choice (1 or 2): ";
+                    cin >> updateChoice;
+                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    noteMenuChoice(updateChoice);
 
-                switch (updateChoice) {
-                    case 1: updateNewPassport(); break;
-                    case 2: updateOldPassport(); break;
-                    default: cout << "Invalid choice. Returning to main menu.\n"; break;
+                    switch (updateChoice) {
+                        case 1: updateNewPassport(); break;
+                        case 2: updateOldPassport(); break;
+                        default: cout << "Invalid choice. Returning to main menu.\n"; break;
+                    }
+                    break;
                 }
-                break;
-            }
-            case 3: { // Delete Passport Sub-menu
-                int deleteChoice;
-                cout << "\n--- Delete Passport ---\n";
-                cout << "1. Delete New Passport\n";
-                cout << "2. Delete Old Passport\n";
-                cout << "Enter choice (1 or 2): ";
-                cin >> deleteChoice;
-                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                case 3: { // Delete Passport Sub-menu
+                    int deleteChoice;
+                    cout << "\n--- Delete Passport ---\n";
+                    cout << "1. Delete New Passport\n";
+                    cout << "2. Delete Old Passport\n";
+                    cout << "Enter choice (1 or 2): ";
+                    cin >> deleteChoice;
+                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    noteMenuChoice(deleteChoice);
 
-                switch (deleteChoice) {
-                    case 1: deleteNewPassport(); break;
-                    case 2: deleteOldPassport(); break;
-                    default: cout << "Invalid choice. Returning to main menu.\n"; break;
+                    switch (deleteChoice) {
+                        case 1: deleteNewPassport(); break;
+                        case 2: deleteOldPassport(); break;
+                        default: cout << "Invalid choice. Returning to main menu.\n"; break;
+                    }
+                    break;
                 }
-                break;
-            }
-            case 4: { // Search Passport Sub-menu
-                int searchChoice;
-                cout << "\n--- Search Passport ---\n";
-                cout << "1. Search New Passport\n";
-                cout << "2. Search Old Passport\n";
-                cout << "Enter choice (1 or 2): ";
-                cin >> searchChoice;
-                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                case 4: { // Search Passport Sub-menu
+                    int searchChoice;
+                    cout << "\n--- Search Passport ---\n";
+                    cout << "1. Search New Passport\n";
+                    cout << "2. Search Old Passport\n";
+                    cout << "3. Query New Passports\n";
+                    cout << "4. Query Old Passports\n";
+                    cout << "Enter choice (1-4): ";
+                    cin >> searchChoice;
+                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    noteMenuChoice(searchChoice);
 
-                switch (searchChoice) {
-                    case 1: searchNewPassport(); break;
-                    case 2: searchOldPassport(); break;
-                    default: cout << "Invalid choice. Returning to main menu.\n"; break;
+                    switch (searchChoice) {
+                        case 1: searchNewPassport(); break;
+                        case 2: searchOldPassport(); break;
+                        case 3: queryPassports(false); break;
+                        case 4: queryPassports(true); break;
+                        default: cout << "Invalid choice. Returning to main menu.\n"; break;
+                    }
+                    break;
                 }
-                break;
-            }
-            case 5: { // Display Passports Sub-menu
-                int displayChoice;
-                cout << "\n--- Display Passports ---\n";
-                cout << "1. Display New Passports\n";
-                cout << "2. Display Old Passports\n";
-                cout << "Enter choice (1 or 2): ";
-                cin >> displayChoice;
-                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                case 5: { // Display Passports Sub-menu
+                    int displayChoice;
+                    cout << "\n--- Display Passports ---\n";
+                    cout << "1. Display New Passports\n";
+                    cout << "2. Display Old Passports\n";
+                    cout << "Enter choice (1 or 2): ";
+                    cin >> displayChoice;
+                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    noteMenuChoice(displayChoice);
 
-                switch (displayChoice) {
-                    case 1: displayNewPassports(); break;
-                    case 2: displayOldPassports(); break;
-                    default: cout << "Invalid choice. Returning to main menu.\n"; break;
+                    switch (displayChoice) {
+                        case 1: displayNewPassports(); break;
+                        case 2: displayOldPassports(); break;
+                        default: cout << "Invalid choice. Returning to main menu.\n"; break;
+                    }
+                    break;
                 }
-                break;
-            }
-            case 6: { 
-                int sortChoice;
-                cout << "\n--- Sort Passports ---\n";
-                cout << "1. Sort New Passports\n";
-                cout << "2. Sort Old Passports\n";
-                cout << "Enter choice (1 or 2): ";
-                cin >> sortChoice;
-                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                case 6: { 
+                    int sortChoice;
+                    cout << "\n--- Sort Passports ---\n";
+                    cout << "1. Sort New Passports\n";
+                    cout << "2. Sort Old Passports\n";
+                    cout << "Enter choice (1 or 2): ";
+                    cin >> sortChoice;
+                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    noteMenuChoice(sortChoice);
 
-                switch (sortChoice) {
-                    case 1: sortNewPassports(); break;
-                    case 2: sortOldPassports(); break;
-                    default: cout << "Invalid choice. Returning to main menu.\n"; break;
+                    switch (sortChoice) {
+                        case 1: sortNewPassports(); break;
+                        case 2: sortOldPassports(); break;
+                        default: cout << "Invalid choice. Returning to main menu.\n"; break;
+                    }
+                    break;
                 }
-                break;
+                case 7: {
+                    int toolChoice;
+                    cout << "\n--- Tools ---\n";
+                    cout << "1. Find Duplicate Applicants\n";
+                    cout << "2. Sort Data Files to Output File (large stores)\n";
+                    cout << "3. Archive Aged Records Now\n";
+                    cout << "4. Bulk Update or Delete by Query\n";
+                    cout << "5. Reconcile Payments from Bank Statement\n";
+                    cout << "Enter choice: ";
+                    cin >> toolChoice;
+                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    noteMenuChoice(toolChoice);
+                    if (!followDirectory.empty() && toolChoice >= 3 && toolChoice <= 5) { // Archive, bulk and reconcile write
+                        cout << "This is a read-only replica. Make changes on the primary.\n";
+                        break;
+                    }
+
+                    switch (toolChoice) {
+                        case 1: findDuplicateApplicants(); break;
+                        case 2: externalSortMenu(); break;
+                        case 3: archiveNow(); break;
+                        case 4: bulkChangePassports(); break;
+                        case 5: reconcilePaymentsMenu(); break;
+                        default: cout << "Invalid choice. Returning to main menu.\n"; break;
+                    }
+                    break;
+                }
+                case 8: displayReport(); break;
+                case 0: cout << "Exiting program. Goodbye!\n"; break;
+                default: cout << "Invalid choice. Please try again.\n"; break;
             }
-            case 0: cout << "Exiting program. Goodbye!\n"; break;
-            default: cout << "Invalid choice. Please try again.\n"; break;
-        }
-    } while (choice != 0);
+            if (replayMode && choice != 0) {
+                menuPathLatencies[menuPath].push_back(
+                    chrono::duration<double, micro>(chrono::steady_clock::now() - started).count());
+            }
+        } while (choice != 0);
+    } catch (const ios_base::failure&) { // Only replay makes cin throw
+        cout.rdbuf(consoleOutput);
+        cout << "Error: the transcript does not match this data (menu path " << menuPath << ").\n";
+        exitStatus = 1;
+    }
+    if (replayMode && exitStatus == 0) {
+        cout.rdbuf(consoleOutput);
+        printReplayReport(chrono::duration<double>(chrono::steady_clock::now() - replayStarted).count());
+    }
+    cin.rdbuf(consoleInput);
 
+    if (follower.joinable()) {
+        followerRunning = false;
+        follower.join();
+    }
+    if (sweeper.joinable()) {
+        sweeperRunning = false;
+        sweeper.join();
+    }
+    if (watcher.joinable()) {
+        watcherRunning = false;
+        watcher.join();
+    }
     // Free memory before exiting
     freeNewPassportList();
     freeOldPassportList();
 
-    return 0;
+    return exitStatus;
 }
\ No newline at end of file